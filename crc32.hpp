@@ -0,0 +1,254 @@
+//
+// CRC-32 with the two polynomials the project needs: the usual reflected 0xedb88320 (as in zlib, and the
+//  one the game hashes text keys with) and Castagnoli 0x82f63b78 (CRC-32C). Both have a bitwise reference
+//  version and a slice-by-8 version, which handles eight bytes per step with eight lookup tables. CRC-32C
+//  also has an SSE4.2 version using the crc32 instruction. As in simd.hpp, the best one the CPU supports
+//  is picked the first time it is used.
+//
+// The update functions work on the bare register, without the inversions before and after. crc32() and
+//  crc32c() add them. The game's key hash leaves out the final one.
+//
+
+#ifndef GTASM_CRC32_HPP
+#define GTASM_CRC32_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cctype>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <iostream>
+#include "simd.hpp"
+
+namespace crc {
+    constexpr uint32_t ieee_polynomial = 0xedb88320;
+    constexpr uint32_t castagnoli_polynomial = 0x82f63b78;
+
+    using UpdateFunction = uint32_t (*)(uint32_t, const uint8_t *, size_t);
+
+    namespace bitwise {
+        template <uint32_t Polynomial>
+        inline uint32_t update(uint32_t crc, const uint8_t *p, size_t n) {
+            while(n--) {
+                crc ^= *(p++);
+                for(int k = 0; k < 8; ++k) crc = crc & 1 ? (crc >> 1) ^ Polynomial : crc >> 1;
+            }
+
+            return crc;
+        }
+    }
+
+    namespace slice8 {
+        // entries[0] is the usual byte-at-a-time table. entries[k][b] is the CRC of byte b followed by k zero
+        //  bytes, so eight lookups can be combined to step over eight bytes at once.
+        template <uint32_t Polynomial>
+        struct Tables {
+            uint32_t entries[8][256];
+
+            Tables() {
+                for(uint32_t b = 0; b < 256; ++b) {
+                    entries[0][b] = bitwise::update<Polynomial>(0, (const uint8_t *)&b, 1);
+                }
+
+                for(int k = 1; k < 8; ++k) {
+                    for(uint32_t b = 0; b < 256; ++b) {
+                        uint32_t previous = entries[k - 1][b];
+                        entries[k][b] = entries[0][previous & 0xff] ^ (previous >> 8);
+                    }
+                }
+            }
+        };
+
+        template <uint32_t Polynomial>
+        inline const Tables<Polynomial> &tables() {
+            static const Tables<Polynomial> instance;
+            return instance;
+        }
+
+        template <uint32_t Polynomial>
+        inline uint32_t update(uint32_t crc, const uint8_t *p, size_t n) {
+            const auto &t = tables<Polynomial>().entries;
+
+            for(; n >= 8; p += 8, n -= 8) {
+                uint32_t low, high;
+                std::memcpy(&low, p, 4);
+                std::memcpy(&high, p + 4, 4);
+
+                low ^= crc;
+
+                crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24]
+                    ^ t[3][high & 0xff] ^ t[2][(high >> 8) & 0xff] ^ t[1][(high >> 16) & 0xff] ^ t[0][high >> 24];
+            }
+
+            while(n--) crc = t[0][(crc ^ *(p++)) & 0xff] ^ (crc >> 8);
+
+            return crc;
+        }
+    }
+
+#ifdef GTASM_SIMD_X86
+    namespace sse42 {
+        // The crc32 instruction always uses the Castagnoli polynomial.
+        __attribute__((target("sse4.2"))) inline uint32_t castagnoli(uint32_t crc, const uint8_t *p, size_t n) {
+#ifdef __x86_64__
+            uint64_t wide = crc;
+
+            for(; n >= 8; p += 8, n -= 8) {
+                uint64_t value;
+                std::memcpy(&value, p, 8);
+                wide = _mm_crc32_u64(wide, value);
+            }
+
+            crc = uint32_t(wide);
+#endif
+
+            for(; n >= 4; p += 4, n -= 4) {
+                uint32_t value;
+                std::memcpy(&value, p, 4);
+                crc = _mm_crc32_u32(crc, value);
+            }
+
+            while(n--) crc = _mm_crc32_u8(crc, *(p++));
+
+            return crc;
+        }
+    }
+#endif
+
+    // The CRC-32C update function for the best instruction set this CPU supports.
+    inline UpdateFunction castagnoliUpdate() {
+        static const UpdateFunction best = [] {
+#ifdef GTASM_SIMD_X86
+            if(__builtin_cpu_supports("sse4.2")) return UpdateFunction(sse42::castagnoli);
+#endif
+            return UpdateFunction(slice8::update<castagnoli_polynomial>);
+        }();
+
+        return best;
+    }
+
+    struct Variant {
+        const char *name;
+        uint32_t polynomial;
+        UpdateFunction update;
+    };
+
+    // Every implementation, for benchmarking them and checking them against each other.
+    inline std::vector<Variant> allVariants() {
+        std::vector<Variant> variants {
+            { "crc32/bitwise", ieee_polynomial, bitwise::update<ieee_polynomial> },
+            { "crc32/slice8", ieee_polynomial, slice8::update<ieee_polynomial> },
+            { "crc32c/bitwise", castagnoli_polynomial, bitwise::update<castagnoli_polynomial> },
+            { "crc32c/slice8", castagnoli_polynomial, slice8::update<castagnoli_polynomial> },
+        };
+
+#ifdef GTASM_SIMD_X86
+        if(__builtin_cpu_supports("sse4.2")) {
+            variants.push_back({ "crc32c/sse4.2", castagnoli_polynomial, sse42::castagnoli });
+        }
+#endif
+
+        return variants;
+    }
+
+    // The standard CRC-32 (zlib, PNG, Ethernet). Pass the previous result as 'crc' to continue it.
+    inline uint32_t crc32(const void *data, size_t size, uint32_t crc = 0) {
+        return ~slice8::update<ieee_polynomial>(~crc, (const uint8_t *)data, size);
+    }
+
+    inline uint32_t crc32c(const void *data, size_t size, uint32_t crc = 0) {
+        return ~castagnoliUpdate()(~crc, (const uint8_t *)data, size);
+    }
+
+    // The hash the game gives GXT keys: the CRC-32 of the key with a-z made upper case, without the final
+    //  inversion. Keys are short, so they are upper-cased into a buffer a block at a time.
+    inline uint32_t gxtKeyHash(std::string_view key) {
+        uint8_t buffer[64];
+        uint32_t crc = 0xffffffff;
+
+        while(not key.empty()) {
+            size_t count = std::min(key.size(), sizeof(buffer));
+
+            for(size_t i = 0; i < count; ++i) {
+                auto c = uint8_t(key[i]);
+                buffer[i] = c >= 'a' and c <= 'z' ? c - ('a' - 'A') : c;
+            }
+
+            crc = slice8::update<ieee_polynomial>(crc, buffer, count);
+            key.remove_prefix(count);
+        }
+
+        return crc;
+    }
+
+    // Checks every variant and convention against published check values (the CRC of "123456789") and
+    //  against the bitwise versions on data of every length and alignment up to 64 bytes. Problems are
+    //  written to 'log'.
+    inline bool selfTest(std::ostream &log = std::cerr) {
+        const std::string_view check = "123456789";
+        bool passed = true;
+
+        auto expect = [&](const char *what, uint32_t actual, uint32_t expected) {
+            if(actual == expected) return;
+
+            log << "error: " << what << " gives 0x" << std::hex << actual << " instead of 0x" << expected << std::dec << '\n';
+            passed = false;
+        };
+
+        expect("crc32(\"123456789\")", crc32(check.data(), check.size()), 0xcbf43926);
+        expect("crc32c(\"123456789\")", crc32c(check.data(), check.size()), 0xe3069283);
+
+        // The key hash is the plain CRC-32 without the final inversion (JAMCRC), and ignores case. The hashes
+        //  of these San Andreas keys are written out rather than worked out with crc32(), so they also catch a
+        //  mistake that both functions share.
+        static const std::pair<const char *, uint32_t> known_keys[] = {
+            { "FEP_OPT", 0x1cdb2966 },
+            { "FEM_OK", 0x9f5e42ab },
+            { "FESZ_CA", 0x7cb1a58d },
+            { "INTRO", 0x12aef86f },
+            { "MAIN", 0x7642df2f },
+            { "CRED001", 0x78a02d93 },
+            { "BCESAR", 0xbdc9a1d8 },
+        };
+
+        expect("gxtKeyHash(\"123456789\")", gxtKeyHash(check), 0x340bc6d9);
+
+        for(auto &[key, hash] : known_keys) {
+            std::string lower(key);
+            for(char &c : lower) c = char(std::tolower((unsigned char)c));
+
+            expect(key, gxtKeyHash(key), hash);
+            expect(lower.c_str(), gxtKeyHash(lower), hash);
+        }
+
+        uint8_t data[72];
+        for(size_t i = 0; i < sizeof(data); ++i) data[i] = uint8_t(i * 151 + 7);
+
+        for(const Variant &variant : allVariants()) {
+            uint32_t expected = variant.polynomial == ieee_polynomial ? 0xcbf43926 : 0xe3069283;
+            expect(variant.name, ~variant.update(~0u, (const uint8_t *)check.data(), check.size()), expected);
+
+            UpdateFunction reference = variant.polynomial == ieee_polynomial ? bitwise::update<ieee_polynomial>
+                                                                             : bitwise::update<castagnoli_polynomial>;
+
+            for(size_t start = 0; start < 8; ++start) {
+                for(size_t length = 0; length <= 64; ++length) {
+                    uint32_t actual = variant.update(~0u, data + start, length);
+
+                    if(actual != reference(~0u, data + start, length)) {
+                        log << "error: " << variant.name << " is wrong for " << length << " bytes at alignment " << start << '\n';
+                        return false;
+                    }
+                }
+            }
+        }
+
+        return passed;
+    }
+}
+
+#endif //GTASM_CRC32_HPP
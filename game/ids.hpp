@@ -0,0 +1,182 @@
+/*
+ * Names for model IDs. Vehicles, peds, weapons and objects all share one ID space in the game, so a single
+ *  table covers them. The names are kept back to back in one string pool and found by indexing an array
+ *  with the ID, so a lookup is constant time and returns a view into the pool.
+ *
+ * The vehicle names in gtasa.hpp are built in. The rest come from the game's IDE files (data/default.ide,
+ *  data/peds.ide, data/vehicles.ide and the map IDE files), which list each model as "id, name, ..." lines
+ *  in sections such as "objs" or "cars" that close with "end".
+ */
+
+#ifndef GTASM_IDS_HPP
+#define GTASM_IDS_HPP
+
+#include <cctype>
+#include <cstdint>
+#include <charconv>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "gtasa.hpp"
+
+namespace game {
+    enum class ModelKind : uint8_t {
+        None,
+        Vehicle,
+        Ped,
+        Weapon,
+        Object,
+    };
+
+    // How a model of each kind is described in comments.
+    inline const char *modelKindName(ModelKind kind) {
+        switch(kind) {
+            case ModelKind::Vehicle:
+                return "Car";
+            case ModelKind::Ped:
+                return "Ped";
+            case ModelKind::Weapon:
+                return "Weapon";
+            case ModelKind::Object:
+                return "Object";
+            default:
+                return "Model";
+        }
+    }
+
+    class ModelTable {
+        struct Entry {
+            uint32_t offset = 0;
+            uint16_t length = 0;
+            ModelKind kind = ModelKind::None;
+        };
+
+        // The game's highest model ID is under 20000.
+        static constexpr int32_t max_id = 0xffff;
+
+        std::string pool;
+        std::vector<Entry> entries;
+
+        static ModelKind sectionKind(std::string_view section) {
+            if(section == "cars") return ModelKind::Vehicle;
+            if(section == "peds") return ModelKind::Ped;
+            if(section == "weap") return ModelKind::Weapon;
+            if(section == "objs" or section == "tobj" or section == "anim" or section == "hier") return ModelKind::Object;
+
+            return ModelKind::None;
+        }
+
+    public:
+        // The built-in names (see gtasa.hpp).
+        static const ModelTable &builtIn() {
+            static const ModelTable table = [] {
+                ModelTable builtIn;
+
+                for(size_t i = 0; i < std::size(sa::vehicleNames); ++i) {
+                    builtIn.add(sa::first_vehicle_id + int32_t(i), sa::vehicleNames[i], ModelKind::Vehicle);
+                }
+
+                return builtIn;
+            }();
+
+            return table;
+        }
+
+        // Names a model. Returns false if the ID is out of range or already has a name (unless 'replace').
+        bool add(int32_t id, std::string_view name, ModelKind kind, bool replace = false) {
+            if(id < 0 or id > max_id or name.empty() or name.size() > 0xffff) return false;
+
+            if(size_t(id) >= entries.size()) entries.resize(size_t(id) + 1);
+
+            Entry &entry = entries[size_t(id)];
+            if(entry.length and not replace) return false;
+
+            entry = { uint32_t(pool.size()), uint16_t(name.size()), kind };
+            pool += name;
+
+            return true;
+        }
+
+        // Adds the models listed in an IDE file. Models that already have a name keep it, so the built-in
+        //  vehicle names win over the model names in vehicles.ide.
+        bool loadIDE(const std::string &path, std::ostream &log = std::cerr) {
+            std::ifstream stream(path);
+
+            if(not stream) {
+                log << "error: could not read " << path << '\n';
+                return false;
+            }
+
+            auto trimmed = [](std::string_view text) {
+                while(not text.empty() and std::isspace((unsigned char)text.front())) text.remove_prefix(1);
+                while(not text.empty() and std::isspace((unsigned char)text.back())) text.remove_suffix(1);
+
+                return text;
+            };
+
+            ModelKind kind = ModelKind::None;
+            bool inSection = false;
+
+            for(std::string line; std::getline(stream, line);) {
+                std::string_view text = line;
+
+                size_t comment = text.find('#');
+                if(comment != std::string_view::npos) text = text.substr(0, comment);
+
+                text = trimmed(text);
+                if(text.empty()) continue;
+
+                if(not inSection) {
+                    kind = sectionKind(text);
+                    inSection = true;
+                    continue;
+                }
+
+                if(text == "end") {
+                    inSection = false;
+                    continue;
+                }
+
+                if(kind == ModelKind::None) continue;
+
+                size_t comma = text.find(',');
+                if(comma == std::string_view::npos) continue;
+
+                int32_t id;
+                std::string_view idText = trimmed(text.substr(0, comma));
+                auto result = std::from_chars(idText.data(), idText.data() + idText.size(), id);
+                if(result.ec != std::errc() or result.ptr != idText.data() + idText.size()) continue;
+
+                std::string_view name = trimmed(text.substr(comma + 1));
+                name = trimmed(name.substr(0, name.find(',')));
+
+                add(id, name, kind);
+            }
+
+            return true;
+        }
+
+        std::string_view name(int32_t id) const {
+            if(id < 0 or size_t(id) >= entries.size()) return {};
+
+            const Entry &entry = entries[size_t(id)];
+            return std::string_view(pool).substr(entry.offset, entry.length);
+        }
+
+        ModelKind kind(int32_t id) const {
+            if(id < 0 or size_t(id) >= entries.size()) return ModelKind::None;
+            return entries[size_t(id)].kind;
+        }
+    };
+
+    // The built-in name of a vehicle, or "<null vehicle>" if the ID isn't a vehicle.
+    inline std::string_view vehicleNameForID(int32_t id) {
+        if(ModelTable::builtIn().kind(id) != ModelKind::Vehicle) return "<null vehicle>";
+        return ModelTable::builtIn().name(id);
+    }
+}
+
+#endif //GTASM_IDS_HPP
@@ -0,0 +1,84 @@
+/*
+ * C interface to the decompiler, for embedding it in another process (e.g. through JNI or the Java FFM API)
+ *  instead of running the gtasm executable and parsing its output.
+ *
+ * Typical use:
+ *
+ *     gtasm_load_opcodes("Opcodes.ini");
+ *
+ *     gtasm_result result;
+ *     if(gtasm_decompile(bytes, size, GTASM_IR_BINARY, &result) == GTASM_OK) {
+ *         // result.data holds result.size bytes of IR (see miss2/ir.hpp for the formats).
+ *         gtasm_free_result(&result);
+ *     }
+ *
+ * The result memory belongs to the caller, but must be released with gtasm_free_result() rather than free().
+ *
+ * The functions may be called from any thread. Calls to gtasm_decompile() run at the same time, and
+ *  gtasm_load_opcodes() waits for the ones in progress to finish.
+ */
+
+#ifndef GTASM_H
+#define GTASM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(GTASM_BUILDING_LIBRARY) && defined(__GNUC__)
+#define GTASM_API __attribute__((visibility("default")))
+#else
+#define GTASM_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Incremented whenever a function signature or structure layout changes. */
+#define GTASM_API_VERSION 1
+
+typedef enum {
+    GTASM_OK = 0,
+    GTASM_ERROR_ARGUMENT = 1,   /* A required pointer was null or a value was out of range. */
+    GTASM_ERROR_READ = 2,       /* The opcode database could not be read. */
+    GTASM_ERROR_NO_OPCODES = 3, /* gtasm_decompile() was called before gtasm_load_opcodes(). */
+    GTASM_ERROR_MEMORY = 4,     /* The result (or memory needed along the way) could not be allocated. */
+    GTASM_ERROR_INTERNAL = 5    /* Something unexpected went wrong inside the library. */
+} gtasm_status;
+
+typedef enum {
+    GTASM_IR_BINARY = 0, /* Versioned binary IR with a string table. */
+    GTASM_IR_TEXT = 1    /* The original "offset:opcode[params]" text format, not NUL-terminated. */
+} gtasm_ir_format;
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+
+    /* Number of commands that were decoded. */
+    uint32_t command_count;
+} gtasm_result;
+
+/* Returns GTASM_API_VERSION as it was when the library was built. */
+GTASM_API int gtasm_api_version(void);
+
+/* Returns a short description of a status code. The string is static. */
+GTASM_API const char *gtasm_status_string(gtasm_status status);
+
+/* Loads the opcode database (Opcodes.ini format). Calling this again adds to or replaces earlier definitions. */
+GTASM_API gtasm_status gtasm_load_opcodes(const char *path);
+
+/*
+ * Decompiles 'size' bytes of compiled script to IR in the requested format. On success, 'result' is filled in
+ *  and must later be passed to gtasm_free_result(). On failure, 'result' is zeroed.
+ */
+GTASM_API gtasm_status gtasm_decompile(const uint8_t *bytes, size_t size, gtasm_ir_format format, gtasm_result *result);
+
+/* Frees the memory held by a result and zeroes it. Passing a zeroed result is allowed. */
+GTASM_API void gtasm_free_result(gtasm_result *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GTASM_H */
@@ -0,0 +1,134 @@
+//
+// Implementation of the C interface in gtasm.h.
+//
+
+#include <iostream>
+#include <map>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <functional>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <shared_mutex>
+#include "gtasm.h"
+#include "util.hpp"
+#include "opcode_file.hpp"
+#include "miss2/decompiler.hpp"
+#include "miss2/ir.hpp"
+
+namespace {
+    // The library's opcodes, kept apart from those of any program it is loaded into. Decompiling only reads
+    //  them, so any number of calls can decompile at once. Loading waits for them to finish.
+    miss2::DecompilerContext &context() {
+        static miss2::DecompilerContext libraryContext;
+        return libraryContext;
+    }
+
+    std::shared_mutex contextLock;
+    bool opcodesLoaded = false;
+
+    // Copies 'bytes' into memory allocated with malloc(), which gtasm_free_result() releases.
+    gtasm_status makeResult(const void *bytes, size_t size, size_t commandCount, gtasm_result *result) {
+        result->data = (uint8_t *)std::malloc(std::max(size, size_t(1)));
+        if(not result->data) return GTASM_ERROR_MEMORY;
+
+        std::memcpy(result->data, bytes, size);
+        result->size = size;
+        result->command_count = uint32_t(commandCount);
+
+        return GTASM_OK;
+    }
+
+    // Runs 'body', turning any exception into a status, since an exception leaving an extern "C" function
+    //  would end the host process. The other exported functions can't throw.
+    template <typename Body>
+    gtasm_status guarded(Body body) {
+        try {
+            return body();
+        } catch(const std::bad_alloc &) {
+            return GTASM_ERROR_MEMORY;
+        } catch(...) {
+            return GTASM_ERROR_INTERNAL;
+        }
+    }
+}
+
+extern "C" {
+
+GTASM_API int gtasm_api_version(void) {
+    return GTASM_API_VERSION;
+}
+
+GTASM_API const char *gtasm_status_string(gtasm_status status) {
+    switch(status) {
+        case GTASM_OK:
+            return "ok";
+        case GTASM_ERROR_ARGUMENT:
+            return "invalid argument";
+        case GTASM_ERROR_READ:
+            return "could not read the opcode database";
+        case GTASM_ERROR_NO_OPCODES:
+            return "no opcode database has been loaded";
+        case GTASM_ERROR_MEMORY:
+            return "out of memory";
+        case GTASM_ERROR_INTERNAL:
+            return "internal error";
+    }
+
+    return "unknown status";
+}
+
+GTASM_API gtasm_status gtasm_load_opcodes(const char *path) {
+    if(not path) return GTASM_ERROR_ARGUMENT;
+
+    // parseOpcodeFile() doesn't report failure, so check that the file can be opened first.
+    if(not std::ifstream(path)) return GTASM_ERROR_READ;
+
+    return guarded([&] {
+        std::unique_lock<std::shared_mutex> guard(contextLock);
+        parseOpcodeFile(path, context());
+        opcodesLoaded = true;
+
+        return GTASM_OK;
+    });
+}
+
+GTASM_API gtasm_status gtasm_decompile(const uint8_t *bytes, size_t size, gtasm_ir_format format, gtasm_result *result) {
+    if(not result) return GTASM_ERROR_ARGUMENT;
+    *result = {};
+
+    if((not bytes and size) or (format != GTASM_IR_BINARY and format != GTASM_IR_TEXT)) {
+        return GTASM_ERROR_ARGUMENT;
+    }
+
+    return guarded([&] {
+        std::shared_lock<std::shared_mutex> guard(contextLock);
+        if(not opcodesLoaded) return GTASM_ERROR_NO_OPCODES;
+
+        // Nothing is written to stdout or stderr by the library.
+        std::ostream nullStream(nullptr);
+        miss2::Script script = miss2::Decompiler::decompile((uint8_t *)bytes, size, nullStream, nullptr, context());
+
+        if(format == GTASM_IR_BINARY) {
+            auto ir = miss2::encodeBinaryIR(script.commands, script.sourceSize);
+            return makeResult(ir.data(), ir.size(), script.commands.size(), result);
+        }
+
+        std::ostringstream stream;
+        miss2::writeTextIR(stream, script.commands);
+
+        std::string text = stream.str();
+        return makeResult(text.data(), text.size(), script.commands.size(), result);
+    });
+}
+
+GTASM_API void gtasm_free_result(gtasm_result *result) {
+    if(not result) return;
+
+    std::free(result->data);
+    *result = {};
+}
+
+}
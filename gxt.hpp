@@ -1,134 +1,367 @@
 //
 // Created by Alex Gallon on 16/07/2020.
 //
+// Reader for GXT (game text) files from GTA: San Andreas. The file is mapped and read in place: the key
+//  table of each subtable is indexed in a hash table keyed by the key hash, and strings are only decoded
+//  when they are looked up.
+//
+// Layout (little-endian):
+//
+//   u16      version (4)
+//   u16      bits per character (8 or 16)
+//   char[4]  "TABL", then u32 size and size / 12 entries of { char name[8], u32 offset }
+//   at each subtable's offset:
+//     char[8]  the subtable name again (except for MAIN, which is always first)
+//     char[4]  "TKEY", then u32 size and size / 8 entries of { u32 string offset (into TDAT), u32 key hash }
+//     char[4]  "TDAT", then u32 size and the NUL-terminated strings
+//
+// Only the hash of each key name is stored (see crc::gxtKeyHash()).
+//
+// 8-bit files use the game's own character set: ASCII, then the accented letters of the European versions
+//  from 0x80 (see gxtCharacters). 16-bit files hold UTF-16. Both are decoded to UTF-8, copying runs of ASCII
+//  straight through with the SIMD kernels.
+//
 
 #ifndef GTASM_GXT_HPP
 #define GTASM_GXT_HPP
 
-// I'm lazy, OK?
-#define init_read(varname) stream.read((char *)&gxt.varname, sizeof(gxt.varname))
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include "util.hpp"
+#include "crc32.hpp"
+
+// The code point of each 8-bit character from 0x80. The game's fonts only have the first 49; the rest are
+//  read as Latin-1.
+inline constexpr uint16_t gxtCharacters[128] {
+        0x00c0, 0x00c1, 0x00c2, 0x00c4, 0x00c6, 0x00c7, 0x00c8, 0x00c9,
+        0x00ca, 0x00cb, 0x00cc, 0x00cd, 0x00ce, 0x00cf, 0x00d2, 0x00d3,
+        0x00d4, 0x00d6, 0x00d9, 0x00da, 0x00db, 0x00dc, 0x00df, 0x00e0,
+        0x00e1, 0x00e2, 0x00e4, 0x00e6, 0x00e7, 0x00e8, 0x00e9, 0x00ea,
+        0x00eb, 0x00ec, 0x00ed, 0x00ee, 0x00ef, 0x00f2, 0x00f3, 0x00f4,
+        0x00f6, 0x00f9, 0x00fa, 0x00fb, 0x00fc, 0x00d1, 0x00f1, 0x00bf,
+        0x00a1, 0x00b1, 0x00b2, 0x00b3, 0x00b4, 0x00b5, 0x00b6, 0x00b7,
+        0x00b8, 0x00b9, 0x00ba, 0x00bb, 0x00bc, 0x00bd, 0x00be, 0x00bf,
+        0x00c0, 0x00c1, 0x00c2, 0x00c3, 0x00c4, 0x00c5, 0x00c6, 0x00c7,
+        0x00c8, 0x00c9, 0x00ca, 0x00cb, 0x00cc, 0x00cd, 0x00ce, 0x00cf,
+        0x00d0, 0x00d1, 0x00d2, 0x00d3, 0x00d4, 0x00d5, 0x00d6, 0x00d7,
+        0x00d8, 0x00d9, 0x00da, 0x00db, 0x00dc, 0x00dd, 0x00de, 0x00df,
+        0x00e0, 0x00e1, 0x00e2, 0x00e3, 0x00e4, 0x00e5, 0x00e6, 0x00e7,
+        0x00e8, 0x00e9, 0x00ea, 0x00eb, 0x00ec, 0x00ed, 0x00ee, 0x00ef,
+        0x00f0, 0x00f1, 0x00f2, 0x00f3, 0x00f4, 0x00f5, 0x00f6, 0x00f7,
+        0x00f8, 0x00f9, 0x00fa, 0x00fb, 0x00fc, 0x00fd, 0x00fe, 0x00ff,
+};
 
-#define POLY 0x82f63b78
+inline void appendUTF8(std::string &out, uint32_t c) {
+    if(c < 0x80) {
+        out += char(c);
+    } else if(c < 0x800) {
+        out += char(0xc0 | (c >> 6));
+        out += char(0x80 | (c & 0x3f));
+    } else if(c < 0x10000) {
+        out += char(0xe0 | (c >> 12));
+        out += char(0x80 | ((c >> 6) & 0x3f));
+        out += char(0x80 | (c & 0x3f));
+    } else {
+        out += char(0xf0 | (c >> 18));
+        out += char(0x80 | ((c >> 12) & 0x3f));
+        out += char(0x80 | ((c >> 6) & 0x3f));
+        out += char(0x80 | (c & 0x3f));
+    }
+}
 
-/* CRC-32 (Ethernet, ZIP, etc.) polynomial in reversed bit order. */
-/* #define POLY 0xedb88320 */
+// Appends an 8-bit GXT string of up to 'size' bytes (stopping at a NUL) to 'out' as UTF-8.
+inline void gxtDecode8(const uint8_t *p, size_t size, std::string &out) {
+    size = simd::nulLength(p, size);
 
-uint32_t crc32c(uint32_t crc, const unsigned char *buf, size_t len)
-{
-    int k;
+    for(size_t i = 0; i < size;) {
+        size_t run = simd::asciiPrefix(p + i, size - i);
+        out.append((const char *)p + i, run);
+        i += run;
 
-    crc = ~crc;
-    while (len--) {
-        crc ^= *buf++;
-        for (k = 0; k < 8; k++)
-            crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+        if(i < size) appendUTF8(out, gxtCharacters[p[i++] - 0x80]);
     }
-    return ~crc;
 }
 
-struct GXT {
-    uint16_t version;
-    uint16_t encoding; // 8/16 for ASCII/UTF-8
+// Appends a UTF-16 GXT string of up to 'size' bytes (stopping at a NUL) to 'out' as UTF-8. Unpaired
+//  surrogates become U+FFFD.
+inline void gxtDecode16(const uint8_t *p, size_t size, std::string &out) {
+    size_t units = size / 2;
+
+    auto unit = [p](size_t i) {
+        return uint32_t(p[i * 2] | (p[i * 2 + 1] << 8));
+    };
+
+    for(size_t i = 0; i < units;) {
+        size_t run = simd::asciiPrefix16(p + i * 2, units - i);
+
+        // Narrow the run, which may include the terminator.
+        size_t start = out.size();
+        out.resize(start + run);
+
+        for(size_t k = 0; k < run; ++k) out[start + k] = char(p[(i + k) * 2]);
 
-    struct KeyTable {
-        char tkeyStr[4];
-        uint32_t blockSize;
+        size_t terminator = out.find('\0', start);
+
+        if(terminator != std::string::npos) {
+            out.resize(terminator);
+            return;
+        }
 
-        struct KeyTableEntry {
-            uint32_t entryOffset;
-            uint32_t nameCRC32;
-        };
+        i += run;
+        if(i == units) break;
 
-        // blockSize / 8
-        KeyTableEntry *entries {};
+        uint32_t c = unit(i++);
 
-        virtual ~KeyTable() {
-            delete[] entries;
+        if(c >= 0xd800 and c < 0xdc00 and i < units and unit(i) >= 0xdc00 and unit(i) < 0xe000) {
+            c = 0x10000 + ((c - 0xd800) << 10) + (unit(i++) - 0xdc00);
+        } else if(c >= 0xd800 and c < 0xe000) {
+            c = 0xfffd;
         }
+
+        appendUTF8(out, c);
+    }
+}
+
+// Open-addressing hash table from key hashes to 32-bit values. Key hashes are already evenly spread, so
+//  they are only scrambled enough to use the high bits as the slot index.
+class GXTKeyIndex {
+    struct Slot {
+        uint32_t hash;
+        uint32_t value;
     };
 
-    struct TableBlock {
-        char tableStr[4];
-        uint32_t blockSize;
+    static constexpr uint32_t empty = 0xffffffff;
+
+    std::vector<Slot> slots;
+    uint32_t mask = 0;
+    int shift = 32;
 
-        struct SubtableEntry {
-            char name[8];
-            uint32_t offset;
+    size_t slotFor(uint32_t hash) const {
+        return size_t((hash * 0x9e3779b1u) >> shift);
+    }
+
+public:
+    // Makes room for 'count' entries with the table no more than half full.
+    void reserve(size_t count) {
+        size_t capacity = 16;
+        int bits = 4;
+
+        while(capacity < count * 2) {
+            capacity *= 2;
+            ++bits;
+        }
+
+        slots.assign(capacity, { 0, empty });
+        mask = uint32_t(capacity - 1);
+        shift = 32 - bits;
+    }
+
+    // Adds an entry unless the hash is already there. Returns false if it was.
+    bool insert(uint32_t hash, uint32_t value) {
+        for(size_t i = slotFor(hash);; i = (i + 1) & mask) {
+            Slot &slot = slots[i];
+
+            if(slot.value == empty) {
+                slot = { hash, value };
+                return true;
+            }
+
+            if(slot.hash == hash) return false;
+        }
+    }
 
-            KeyTable keyTable;
-        };
+    const uint32_t *find(uint32_t hash) const {
+        if(slots.empty()) return nullptr;
 
-        // blockSize / 12
-        SubtableEntry *entries {};
+        for(size_t i = slotFor(hash);; i = (i + 1) & mask) {
+            const Slot &slot = slots[i];
 
-        virtual ~TableBlock() {
-            delete[] entries;
+            if(slot.value == empty) return nullptr;
+            if(slot.hash == hash) return &slot.value;
         }
+    }
+};
+
+class GXT {
+public:
+    struct KeyEntry {
+        uint32_t offset;
+        uint32_t hash;
     };
 
-    TableBlock tableBlock;
+    struct Subtable {
+        std::string name;
 
-    static GXT read(string_ref filename) {
-        const char *searchStr = "FEP_OPT";
-        //std::crc
+        // The TKEY entries and the TDAT block, both in the mapped file.
+        const uint8_t *keys = nullptr;
+        uint32_t keyCount = 0;
+        const uint8_t *data = nullptr;
+        uint32_t dataSize = 0;
 
-        uint32_t crc = 3810842265;//crc32c(0, (const unsigned char *)searchStr, 8);
+        // Key hash to entry number.
+        GXTKeyIndex index;
 
-        GXT gxt;
+        KeyEntry key(uint32_t entry) const {
+            KeyEntry key;
+            std::memcpy(&key, keys + entry * 8, 8);
 
-        std::ifstream stream(filename, std::ios::binary);
-        init_read(version);
-        init_read(encoding);
+            return key;
+        }
+    };
 
-        stream.read(gxt.tableBlock.tableStr, 4);
-        init_read(tableBlock.blockSize);
+private:
+    MappedFile file;
+    uint16_t charBits = 8;
+    std::vector<Subtable> subtables;
 
-        auto numSubtables = gxt.tableBlock.blockSize / 12;
-        gxt.tableBlock.entries = new TableBlock::SubtableEntry[numSubtables];
+    // Key hash to the first subtable (MAIN, then file order) that has the key.
+    GXTKeyIndex allKeys;
 
-        for(int i = 0; i < numSubtables; ++i) {
-            auto &entry = gxt.tableBlock.entries[i];
+    bool fail(std::ostream &log, const std::string &path, const char *reason) {
+        log << "error: " << path << " is not a valid GXT file (" << reason << ")\n";
+        subtables.clear();
 
-            stream.read(entry.name, 8);
-            init_read(tableBlock.entries[i].offset);
+        return false;
+    }
 
-            // Move to the key table and read that, then go back.
-            auto savedPos = stream.tellg(); {
-                stream.seekg(entry.offset);
+    bool readU32(size_t offset, uint32_t &value) const {
+        if(offset > file.size or file.size - offset < 4) return false;
 
-                if(std::strcmp(entry.name, "MAIN") != 0) {
-                    // Not the main table, so 'read' the name (skip it).
-                    stream.ignore(8);
-                }
+        std::memcpy(&value, file.data + offset, 4);
+        return true;
+    }
 
-                stream.read(gxt.tableBlock.entries[i].keyTable.tkeyStr, 4);
-                init_read(tableBlock.entries[i].keyTable.blockSize);
+    // Reads a "TKEY"/"TDAT" style block header. The block must fit in the file.
+    bool readBlock(size_t offset, const char *tag, uint32_t &size) const {
+        if(offset > file.size or file.size - offset < 8 or std::memcmp(file.data + offset, tag, 4) != 0) return false;
+        if(not readU32(offset + 4, size)) return false;
 
-                auto &keyTable = gxt.tableBlock.entries[i].keyTable;
+        return file.size - offset - 8 >= size;
+    }
 
-                auto keyEntries = keyTable.blockSize / 8;
-                keyTable.entries = new KeyTable::KeyTableEntry[keyEntries];
+public:
+    bool open(const std::string &path, std::ostream &log = std::cerr) {
+        file = MappedFile(path.c_str());
+        subtables.clear();
 
-                for(int j = 0; j < keyEntries; ++j) {
-                    init_read(tableBlock.entries[i].keyTable.entries[j].entryOffset);
-                    init_read(tableBlock.entries[i].keyTable.entries[j].nameCRC32);
+        if(not file) {
+            log << "error: could not read " << path << '\n';
+            return false;
+        }
 
-                    if(keyTable.entries[j].nameCRC32 == crc) {
-                        std::cout << "yes\n";
-                        exit(0);
-                    }
+        if(file.size < 4) return fail(log, path, "no header");
 
-                    std::cout << keyTable.entries[j].nameCRC32 << '\n';
-                }
-            } stream.seekg(savedPos);
+        std::memcpy(&charBits, file.data + 2, 2);
+        if(charBits != 8 and charBits != 16) return fail(log, path, "unknown character size");
 
-            std::cout << entry.name << '\n';
+        uint32_t tableSize;
+        if(not readBlock(4, "TABL", tableSize)) return fail(log, path, "bad TABL block");
+
+        size_t subtableCount = tableSize / 12;
+        subtables.resize(subtableCount);
+
+        size_t totalKeys = 0;
+
+        for(size_t i = 0; i < subtableCount; ++i) {
+            Subtable &subtable = subtables[i];
+            const uint8_t *entry = file.data + 12 + i * 12;
+
+            subtable.name.assign((const char *)entry, simd::nulLength(entry, 8));
+
+            uint32_t tableOffset;
+            std::memcpy(&tableOffset, entry + 8, 4);
+
+            // Every subtable but MAIN repeats its name before the key table.
+            size_t keysOffset = size_t(tableOffset) + (subtable.name == "MAIN" ? 0 : 8);
+
+            uint32_t keysSize, dataSize;
+            if(not readBlock(keysOffset, "TKEY", keysSize)) return fail(log, path, "bad TKEY block");
+
+            size_t dataOffset = keysOffset + 8 + keysSize;
+            if(not readBlock(dataOffset, "TDAT", dataSize)) return fail(log, path, "bad TDAT block");
+
+            subtable.keys = file.data + keysOffset + 8;
+            subtable.keyCount = keysSize / 8;
+            subtable.data = file.data + dataOffset + 8;
+            subtable.dataSize = dataSize;
+
+            subtable.index.reserve(subtable.keyCount);
+
+            for(uint32_t k = 0; k < subtable.keyCount; ++k) {
+                subtable.index.insert(subtable.key(k).hash, k);
+            }
+
+            totalKeys += subtable.keyCount;
+        }
+
+        allKeys.reserve(totalKeys);
+
+        for(size_t i = 0; i < subtables.size(); ++i) {
+            for(uint32_t k = 0; k < subtables[i].keyCount; ++k) {
+                allKeys.insert(subtables[i].key(k).hash, uint32_t(i));
+            }
         }
 
-        return gxt;
+        return true;
+    }
+
+    operator bool() const {
+        return not subtables.empty();
+    }
+
+    uint16_t bitsPerCharacter() const {
+        return charBits;
     }
-};
 
-#undef init_read
+    const std::vector<Subtable> &allSubtables() const {
+        return subtables;
+    }
+
+    const Subtable *subtable(std::string_view name) const {
+        for(const Subtable &subtable : subtables) {
+            if(subtable.name == name) return &subtable;
+        }
+
+        return nullptr;
+    }
+
+    // Decodes a string from the subtable's TDAT block to UTF-8. Returns false if its offset is out of range.
+    bool text(const Subtable &subtable, uint32_t entry, std::string &out) const {
+        uint32_t offset = subtable.key(entry).offset;
+        if(offset >= subtable.dataSize) return false;
+
+        const uint8_t *start = subtable.data + offset;
+        size_t available = subtable.dataSize - offset;
+
+        out.clear();
+
+        if(charBits == 8) {
+            gxtDecode8(start, available, out);
+        } else {
+            gxtDecode16(start, available, out);
+        }
+
+        return true;
+    }
+
+    // Finds the text for a key hash in a particular subtable.
+    bool lookup(const Subtable &subtable, uint32_t hash, std::string &out) const {
+        const uint32_t *entry = subtable.index.find(hash);
+        return entry and text(subtable, *entry, out);
+    }
+
+    // Finds the text for a key hash, looking in MAIN before the other subtables.
+    bool lookup(uint32_t hash, std::string &out) const {
+        const uint32_t *subtableIndex = allKeys.find(hash);
+        return subtableIndex and lookup(subtables[*subtableIndex], hash, out);
+    }
+
+    bool lookup(std::string_view key, std::string &out) const {
+        return lookup(crc::gxtKeyHash(key), out);
+    }
+};
 
 #endif //GTASM_GXT_HPP
@@ -0,0 +1,213 @@
+//
+// Dumps the text of GXT files (one per language) as UTF-8 text files. Files and their subtables are
+//  decoded on a pool of threads. Each output file has a "[NAME]" line for every subtable (MAIN first, then
+//  in file order), followed by a "KEY=text" line for every key, sorted by key. Keys are shown by name if the
+//  name is known (see gxt_keys.hpp) and as their eight-digit hash otherwise.
+//
+
+#ifndef GTASM_GXT_EXPORT_HPP
+#define GTASM_GXT_EXPORT_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <iostream>
+#include "gxt.hpp"
+#include "work_stealing.hpp"
+#include "util.hpp"
+
+using GXTKeyNames = std::unordered_map<uint32_t, std::string>;
+
+// Reads the "hash=NAME" lines that gtasm --recover-keys writes.
+inline bool readGXTKeyNames(const std::string &path, GXTKeyNames &names, std::ostream &log = std::cerr) {
+    std::ifstream stream(path);
+
+    if(not stream) {
+        log << "error: could not read " << path << '\n';
+        return false;
+    }
+
+    size_t lineNumber = 0;
+
+    for(std::string line; std::getline(stream, line);) {
+        ++lineNumber;
+
+        while(not line.empty() and std::isspace((unsigned char)line.back())) line.pop_back();
+        if(line.empty()) continue;
+
+        size_t equals = line.find('=');
+        uint32_t hash = 0;
+
+        auto result = std::from_chars(line.data(), line.data() + std::min(equals, line.size()), hash, 16);
+
+        if(equals == std::string::npos or equals == 0 or result.ptr != line.data() + equals) {
+            log << "error: " << path << ':' << lineNumber << ": expected hash=NAME\n";
+            return false;
+        }
+
+        names[hash] = line.substr(equals + 1);
+    }
+
+    return true;
+}
+
+struct GXTExportSummary {
+    size_t files = 0;
+    size_t strings = 0;
+    size_t inputBytes = 0;
+    size_t outputBytes = 0;
+};
+
+// The text of one subtable, sorted by key.
+inline std::string exportGXTSubtable(const GXT &gxt, const GXT::Subtable &subtable, const GXTKeyNames &keyNames) {
+    std::vector<std::pair<std::string, uint32_t>> keys;
+    keys.reserve(subtable.keyCount);
+
+    for(uint32_t k = 0; k < subtable.keyCount; ++k) {
+        uint32_t hash = subtable.key(k).hash;
+        auto name = keyNames.find(hash);
+
+        if(name != keyNames.end()) {
+            keys.emplace_back(name->second, k);
+            continue;
+        }
+
+        char hex[9];
+        std::snprintf(hex, sizeof(hex), "%08x", hash);
+        keys.emplace_back(hex, k);
+    }
+
+    std::sort(keys.begin(), keys.end());
+
+    std::string out = "[" + subtable.name + "]\n";
+    std::string text;
+
+    for(auto &[key, entry] : keys) {
+        if(not gxt.text(subtable, entry, text)) text.clear();
+
+        out += key;
+        out += '=';
+        out += text;
+        out += '\n';
+    }
+
+    return out;
+}
+
+// Exports each GXT file in 'paths' to "<stem>.txt" in 'outputDirectory' on 'pool', biggest first. Returns
+//  false if any file could not be read or written; the others are still exported. Nothing is exported if
+//  two files would be written to the same name.
+inline bool exportGXTFiles(const std::vector<std::string> &paths, const std::string &outputDirectory,
+                           const GXTKeyNames &keyNames, GXTExportSummary &summary, WorkStealingPool &pool,
+                           std::ostream &log = std::cerr) {
+    // Files with the same name in different directories (or that only differ in case, for case-insensitive
+    //  file systems) would overwrite each other.
+    std::map<std::string, std::string> pathsByOutputName;
+    bool clashes = false;
+
+    for(const std::string &path : paths) {
+        std::string outputName = std::filesystem::path(path).stem().string() + ".txt";
+        auto [existing, added] = pathsByOutputName.emplace(stringLower(outputName), path);
+
+        if(not added) {
+            log << "error: " << existing->second << " and " << path << " would both be exported to " << outputName << '\n';
+            clashes = true;
+        }
+    }
+
+    if(clashes) return false;
+
+    std::error_code error;
+    std::filesystem::create_directories(outputDirectory, error);
+
+    if(error) {
+        log << "error: could not create " << outputDirectory << ": " << error.message() << '\n';
+        return false;
+    }
+
+    std::vector<GXT> files(paths.size());
+    std::vector<std::vector<std::string>> sections(paths.size());
+    std::vector<size_t> stringCounts(paths.size(), 0);
+    std::atomic<bool> failed = false;
+
+    // The jobs share 'log'.
+    std::mutex logLock;
+
+    // Each file is opened by one job, which then queues a job for each of its subtables and waits for them.
+    //  Idle workers steal the subtables, so one big file doesn't hold up the end of the run.
+    forEachFileLargestFirst(pool, paths, [&](size_t f) {
+        GXT &gxt = files[f];
+
+        std::ostringstream messages;
+
+        if(not gxt.open(paths[f], messages)) {
+            std::lock_guard<std::mutex> guard(logLock);
+            log << messages.str();
+            failed = true;
+
+            return;
+        }
+
+        auto &subtables = gxt.allSubtables();
+        sections[f].resize(subtables.size());
+
+        WorkStealingPool::TaskGroup group;
+
+        for(size_t s = 0; s < subtables.size(); ++s) {
+            stringCounts[f] += subtables[s].keyCount;
+
+            pool.submit([&, f, s] {
+                sections[f][s] = exportGXTSubtable(files[f], files[f].allSubtables()[s], keyNames);
+            }, &group);
+        }
+
+        pool.wait(group);
+    });
+
+    std::vector<size_t> outputSizes(paths.size(), 0);
+
+    forEachFileLargestFirst(pool, paths, [&](size_t f) {
+        if(not files[f]) return;
+
+        auto outputPath = std::filesystem::path(outputDirectory) / std::filesystem::path(paths[f]).stem();
+        outputPath += ".txt";
+
+        std::ofstream stream(outputPath, std::ios::binary | std::ios::trunc);
+
+        for(const std::string &section : sections[f]) {
+            stream.write(section.data(), std::streamsize(section.size()));
+            outputSizes[f] += section.size();
+        }
+
+        if(not stream) {
+            std::lock_guard<std::mutex> guard(logLock);
+            log << "error: failed to write " << outputPath.string() << '\n';
+            failed = true;
+        }
+    });
+
+    for(size_t f = 0; f < paths.size(); ++f) {
+        if(not files[f]) continue;
+
+        ++summary.files;
+        summary.strings += stringCounts[f];
+        summary.outputBytes += outputSizes[f];
+
+        std::error_code sizeError;
+        auto size = std::filesystem::file_size(paths[f], sizeError);
+        if(not sizeError) summary.inputBytes += size;
+    }
+
+    return not failed;
+}
+
+#endif //GTASM_GXT_EXPORT_HPP
@@ -0,0 +1,463 @@
+//
+// Recovers GXT key names from the hashes a GXT file stores instead of them (see crc::gxtKeyHash()).
+//  Candidate names come from word lists, from masks, and from the text labels that scripts pass to
+//  commands. Candidates whose hash is one of the file's keys are kept.
+//
+// Mask syntax: letters, digits and '_' stand for themselves, '?' is any of A-Z, 0-9 and '_', and "[...]" is
+//  any of the characters listed, where "A-Z" is a range. "{n}" or "{m,n}" after any of these repeats it.
+//  Case doesn't matter, because keys are hashed in upper case. "MIS_[A-Z]{2}[0-9]" matches MIS_AB1.
+//
+// A mask is enumerated like an odometer. The CRC state after every prefix is kept, so moving to the next
+//  candidate only costs a table step for each character that changed. The last character changes every
+//  time, so its whole set is tried in a tight loop that checks a bitmap of the key hashes before the hash
+//  table. Work is spread over threads by the first few characters.
+//
+// A 32-bit hash doesn't say much, so a wide mask will find names that only happen to have the right hash.
+//  Names from labels are preferred over ones from word lists, which are preferred over ones from masks;
+//  after that, the shortest name wins.
+//
+
+#ifndef GTASM_GXT_KEYS_HPP
+#define GTASM_GXT_KEYS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <iomanip>
+#include <iostream>
+#include "gxt.hpp"
+#include "crc32.hpp"
+#include "work_stealing.hpp"
+#include "miss2/opcode_table.hpp"
+
+// The key hashes of a GXT file.
+class GXTKeyTargets {
+    // One bit for each value of the low bits of the hashes. Almost every candidate is rejected by this
+    //  alone, and it's small enough to stay in the cache.
+    static constexpr int filter_bits = 22;
+
+    std::vector<uint64_t> filter = std::vector<uint64_t>(size_t(1) << (filter_bits - 6), 0);
+
+    // Key hash to the index of the first subtable that has it.
+    GXTKeyIndex index;
+    size_t count = 0;
+
+public:
+    explicit GXTKeyTargets(const GXT &gxt) {
+        size_t total = 0;
+        for(const GXT::Subtable &subtable : gxt.allSubtables()) total += subtable.keyCount;
+
+        index.reserve(total);
+
+        for(size_t i = 0; i < gxt.allSubtables().size(); ++i) {
+            const GXT::Subtable &subtable = gxt.allSubtables()[i];
+
+            for(uint32_t k = 0; k < subtable.keyCount; ++k) {
+                uint32_t hash = subtable.key(k).hash;
+                if(not index.insert(hash, uint32_t(i))) continue;
+
+                uint32_t bit = hash & ((1u << filter_bits) - 1);
+                filter[bit >> 6] |= uint64_t(1) << (bit & 63);
+                ++count;
+            }
+        }
+    }
+
+    bool mayContain(uint32_t hash) const {
+        uint32_t bit = hash & ((1u << filter_bits) - 1);
+        return (filter[bit >> 6] >> (bit & 63)) & 1;
+    }
+
+    // The index of the subtable that has the key, or null.
+    const uint32_t *find(uint32_t hash) const {
+        return mayContain(hash) ? index.find(hash) : nullptr;
+    }
+
+    size_t size() const {
+        return count;
+    }
+};
+
+struct GXTKeyMask {
+    // Refuse masks that would take more than a few hours.
+    static constexpr double max_candidates = 1e12;
+
+    // The characters each position can hold: upper case, without repeats.
+    std::vector<std::string> positions;
+
+    double candidateCount() const {
+        double count = positions.empty() ? 0 : 1;
+        for(const std::string &choices : positions) count *= double(choices.size());
+
+        return count;
+    }
+
+    // Parses a mask. "{m,n}" gives one mask for each length, so there can be more than one.
+    static bool parse(std::string_view text, std::vector<GXTKeyMask> &out, std::string &error) {
+        struct Element {
+            std::string choices;
+            size_t min = 1, max = 1;
+        };
+
+        auto upper = [](char c) {
+            return c >= 'a' and c <= 'z' ? char(c - ('a' - 'A')) : c;
+        };
+
+        auto isNameCharacter = [](char c) {
+            return (c >= 'A' and c <= 'Z') or (c >= 'a' and c <= 'z') or (c >= '0' and c <= '9') or c == '_';
+        };
+
+        std::vector<Element> elements;
+
+        for(size_t i = 0; i < text.size();) {
+            char c = text[i];
+
+            if(c == '{') {
+                if(elements.empty()) {
+                    error = "'{' with nothing to repeat";
+                    return false;
+                }
+
+                size_t close = text.find('}', i);
+                if(close == std::string_view::npos) {
+                    error = "unterminated '{'";
+                    return false;
+                }
+
+                std::string_view counts = text.substr(i + 1, close - i - 1);
+                size_t comma = counts.find(',');
+
+                auto number = [&](std::string_view digits, size_t &value) {
+                    auto result = std::from_chars(digits.data(), digits.data() + digits.size(), value);
+                    return result.ec == std::errc() and result.ptr == digits.data() + digits.size();
+                };
+
+                Element &element = elements.back();
+
+                if(comma == std::string_view::npos ? not number(counts, element.min)
+                                                   : not number(counts.substr(0, comma), element.min)
+                                                         or not number(counts.substr(comma + 1), element.max)) {
+                    error = "bad repeat count '" + std::string(counts) + "'";
+                    return false;
+                }
+
+                if(comma == std::string_view::npos) element.max = element.min;
+
+                if(element.min > element.max or element.max > 64) {
+                    error = "bad repeat count '" + std::string(counts) + "'";
+                    return false;
+                }
+
+                i = close + 1;
+                continue;
+            }
+
+            Element element;
+
+            if(c == '?') {
+                element.choices = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
+                ++i;
+            } else if(c == '[') {
+                size_t close = text.find(']', i);
+                if(close == std::string_view::npos) {
+                    error = "unterminated '['";
+                    return false;
+                }
+
+                for(size_t j = i + 1; j < close; ++j) {
+                    char first = upper(text[j]);
+                    char last = first;
+
+                    if(j + 2 < close and text[j + 1] == '-') {
+                        last = upper(text[j + 2]);
+                        j += 2;
+                    }
+
+                    if(first > last) {
+                        error = "bad range in '" + std::string(text.substr(i, close - i + 1)) + "'";
+                        return false;
+                    }
+
+                    for(int r = first; r <= last; ++r) {
+                        if(element.choices.find(upper(char(r))) == std::string::npos) element.choices += upper(char(r));
+                    }
+                }
+
+                if(element.choices.empty()) {
+                    error = "empty character class";
+                    return false;
+                }
+
+                i = close + 1;
+            } else if(isNameCharacter(c)) {
+                element.choices = std::string(1, upper(c));
+                ++i;
+            } else {
+                error = std::string("unexpected '") + c + "'";
+                return false;
+            }
+
+            elements.push_back(std::move(element));
+        }
+
+        if(elements.empty()) {
+            error = "empty mask";
+            return false;
+        }
+
+        // Every combination of repeat counts, like an odometer again.
+        std::vector<size_t> repeats;
+        for(const Element &element : elements) repeats.push_back(element.min);
+
+        while(true) {
+            GXTKeyMask mask;
+
+            for(size_t e = 0; e < elements.size(); ++e) {
+                mask.positions.insert(mask.positions.end(), repeats[e], elements[e].choices);
+            }
+
+            if(not mask.positions.empty()) out.push_back(std::move(mask));
+
+            size_t e = elements.size();
+            while(e > 0 and repeats[e - 1] == elements[e - 1].max) {
+                repeats[e - 1] = elements[e - 1].min;
+                --e;
+            }
+
+            if(e == 0) break;
+            ++repeats[e - 1];
+        }
+
+        return true;
+    }
+};
+
+class GXTKeyRecovery {
+public:
+    // Where a name came from, most trusted first.
+    enum Source : uint8_t {
+        Label,
+        Word,
+        Mask,
+    };
+
+    struct Candidate {
+        std::string name;
+        Source source;
+
+        bool operator<(const Candidate &other) const {
+            if(source != other.source) return source < other.source;
+            if(name.size() != other.name.size()) return name.size() < other.name.size();
+
+            return name < other.name;
+        }
+    };
+
+private:
+    const GXTKeyTargets &targets;
+
+    std::mutex lock;
+    std::unordered_map<uint32_t, std::vector<Candidate>> found;
+    std::atomic<uint64_t> tried = 0;
+
+    void record(uint32_t hash, std::string_view name, Source source) {
+        std::string upper(name);
+        for(char &c : upper) {
+            if(c >= 'a' and c <= 'z') c -= 'a' - 'A';
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+
+        for(Candidate &candidate : found[hash]) {
+            if(candidate.name != upper) continue;
+
+            candidate.source = std::min(candidate.source, source);
+            return;
+        }
+
+        found[hash].push_back({ std::move(upper), source });
+    }
+
+public:
+    explicit GXTKeyRecovery(const GXTKeyTargets &targets) : targets { targets } {}
+
+    // Hashes every name in 'names' on 'pool'.
+    void addNames(const std::vector<std::string> &names, Source source, WorkStealingPool &pool) {
+        static constexpr size_t batch_size = 4096;
+
+        WorkStealingPool::TaskGroup group;
+
+        for(size_t start = 0; start < names.size(); start += batch_size) {
+            pool.submit([&, start] {
+                size_t end = std::min(names.size(), start + batch_size);
+
+                for(size_t i = start; i < end; ++i) {
+                    uint32_t hash = crc::gxtKeyHash(names[i]);
+                    if(targets.find(hash)) record(hash, names[i], source);
+                }
+            }, &group);
+        }
+
+        pool.wait(group);
+        tried += names.size();
+    }
+
+    // Tries every name a mask matches on 'pool'. Returns false if there are too many.
+    bool addMask(const GXTKeyMask &mask, WorkStealingPool &pool, std::ostream &log = std::cerr) {
+        const std::vector<std::string> &positions = mask.positions;
+        if(positions.empty()) return true;
+
+        if(mask.candidateCount() > GXTKeyMask::max_candidates) {
+            log << "error: mask matches " << mask.candidateCount() << " names, more than the limit of "
+                << GXTKeyMask::max_candidates << '\n';
+            return false;
+        }
+
+        const uint32_t *table = crc::slice8::tables<crc::ieee_polynomial>().entries[0];
+
+        auto step = [table](uint32_t state, char c) {
+            return table[(state ^ uint8_t(c)) & 0xff] ^ (state >> 8);
+        };
+
+        size_t length = positions.size();
+        size_t last = length - 1;
+
+        // Each job gets one choice for each of the first 'splitDepth' positions. The last position is
+        //  never split, so every job has at least one full set of last characters to try.
+        size_t splitDepth = 0;
+        uint64_t jobCount = 1;
+
+        while(splitDepth < last and jobCount < pool.size() * 64) {
+            jobCount *= positions[splitDepth++].size();
+        }
+
+        WorkStealingPool::TaskGroup group;
+
+        for(uint64_t job = 0; job < jobCount; ++job) {
+            pool.submit([&, job] {
+                std::string name(length, ' ');
+                std::vector<uint32_t> states(length + 1);
+                std::vector<size_t> digits(length, 0);
+
+                uint64_t rest = job;
+                for(size_t i = splitDepth; i-- > 0;) {
+                    name[i] = positions[i][rest % positions[i].size()];
+                    rest /= positions[i].size();
+                }
+
+                states[0] = 0xffffffff;
+
+                for(size_t i = 0; i < last; ++i) {
+                    if(i >= splitDepth) name[i] = positions[i][0];
+                    states[i + 1] = step(states[i], name[i]);
+                }
+
+                const std::string &lastChoices = positions[last];
+
+                while(true) {
+                    uint32_t state = states[last];
+
+                    for(char c : lastChoices) {
+                        uint32_t hash = step(state, c);
+                        if(not targets.mayContain(hash) or not targets.find(hash)) continue;
+
+                        name[last] = c;
+                        record(hash, name, Mask);
+                    }
+
+                    // Move to the next prefix. 'changed' is the leftmost position that changed.
+                    size_t changed = last;
+
+                    while(changed > splitDepth) {
+                        --changed;
+                        if(++digits[changed] < positions[changed].size()) break;
+
+                        digits[changed] = 0;
+                        if(changed == splitDepth) return;
+                    }
+
+                    if(changed == last) return;
+
+                    for(size_t i = changed; i < last; ++i) {
+                        name[i] = positions[i][digits[i]];
+                        states[i + 1] = step(states[i], name[i]);
+                    }
+                }
+            }, &group);
+        }
+
+        pool.wait(group);
+        tried += uint64_t(mask.candidateCount());
+
+        return true;
+    }
+
+    uint64_t candidatesTried() const {
+        return tried;
+    }
+
+    // The names found for each hash, best first, in hash order.
+    std::vector<std::pair<uint32_t, std::vector<Candidate>>> results() {
+        std::lock_guard<std::mutex> guard(lock);
+
+        std::vector<std::pair<uint32_t, std::vector<Candidate>>> sorted(found.begin(), found.end());
+        std::sort(sorted.begin(), sorted.end(), [](auto &a, auto &b) { return a.first < b.first; });
+
+        for(auto &[hash, candidates] : sorted) std::sort(candidates.begin(), candidates.end());
+
+        return sorted;
+    }
+};
+
+// Collects the distinct text of every string immediate in the scripts, decoding them on 'pool', biggest
+//  first. These are mostly GXT keys and mission names.
+inline std::vector<std::string> harvestTextLabels(const std::vector<std::string> &paths, const miss2::OpcodeTable &table,
+                                                  WorkStealingPool &pool, std::ostream &log = std::cerr) {
+    // Guards 'labels' and 'log'.
+    std::mutex lock;
+    std::vector<std::string> labels;
+
+    forEachFileLargestFirst(pool, paths, [&](size_t i) {
+        const std::string &path = paths[i];
+        MappedFile file(path.c_str());
+
+        if(not file) {
+            std::lock_guard<std::mutex> guard(lock);
+            log << "error: could not read " << path << '\n';
+
+            return;
+        }
+
+        std::vector<std::string> local;
+        miss2::FlatDecoder decoder(table, file.data, file.size);
+        miss2::FlatInstruction instruction;
+
+        while(decoder.next(instruction)) {
+            for(size_t p = 0; p < instruction.paramCount; ++p) {
+                const miss2::FlatParam &param = instruction.params[p];
+                if(not param.isString()) continue;
+
+                std::string_view text = param.text();
+                if(not text.empty()) local.emplace_back(text);
+            }
+        }
+
+        std::sort(local.begin(), local.end());
+        local.erase(std::unique(local.begin(), local.end()), local.end());
+
+        std::lock_guard<std::mutex> guard(lock);
+        labels.insert(labels.end(), local.begin(), local.end());
+    });
+
+    std::sort(labels.begin(), labels.end());
+    labels.erase(std::unique(labels.begin(), labels.end()), labels.end());
+
+    return labels;
+}
+
+#endif //GTASM_GXT_KEYS_HPP
@@ -3,6 +3,8 @@
 #include <vector>
 #include <fstream>
 #include <sstream>
+#include <functional>
+#include <charconv>
 #include "util.hpp"
 #include "opcodes.hpp"
 #include "highlighting.hpp"
@@ -14,9 +16,19 @@
 #include "miss2/decompiler.hpp"
 #include "miss2/serialization.hpp"
 #include "miss2/script.hpp"
-
-// Stores all call destinations.
-std::set<int32_t> procedureLocations;
+#include "miss2/ir.hpp"
+#include "opcode_file.hpp"
+#include "miss2/assembler.hpp"
+#include "server.hpp"
+#include "miss2/stats.hpp"
+#include "simd.hpp"
+#include "miss2/search.hpp"
+#include "miss2/corpus_index.hpp"
+#include "miss2/xref.hpp"
+#include "miss2/signatures.hpp"
+#include "gxt_keys.hpp"
+#include "gxt_export.hpp"
+#include "work_stealing.hpp"
 
 /* https://gtamods.com/wiki/Opcode */
 enum ParamType : uint8_t {
@@ -60,8 +72,6 @@ std::string strrepFunc(uint8_t *bytes) {
     return std::to_string(*(typ *)bytes);
 }
 
-static int varStrSizeForRep = 0;
-
 #define STRREP(typ) strrepFunc<typ>//[](uint8_t *bytes){return std::to_string(*(typ *)bytes);}
 #define NUMREP(typ) [](uint8_t *bytes){return std::to_string((long long)(*(typ *)bytes));}
 //#define ARRREP [](uint8_t *){return "<array>";}
@@ -81,7 +91,8 @@ static std::map<ParamType, ParamInfo> paramTypeInfo {
     { LocalString8, {2, "LocalString8", STRREP(uint16_t)} },
     { GlobalString8Arr, {6, "GlobalString8Arr", ARRREP} },
     { LocalString8Arr, {6, "LocalString8Arr", ARRREP} },
-    { StringVar, {0, "VarStr", [](uint8_t *bytes){return "'" + std::string(bytes, bytes + varStrSizeForRep) + "'";}} },
+    // The length isn't known from the bytes, so getParamStrings() formats these itself.
+    { StringVar, {0, "VarStr", [](uint8_t *){return "''";}} },
     { String16, {16, "Char[16]", [](uint8_t *bytes){return std::string(bytes, bytes + 16);}} },
     { GlobalString16, {2, "GlobalString16", STRREP(uint16_t)} },
     { LocalString16, {2, "LocalString16", STRREP(uint16_t)} },
@@ -112,24 +123,6 @@ struct Instruction {
     }
 };
 
-struct PlaceholderInstruction {
-    std::string name;
-    uint16_t opcode;
-    std::vector<uint8_t> paramSizes;
-
-    std::string toString() {
-        std::stringstream stream;
-
-        stream << std::hex << opcode << ": " << name << std::dec;
-
-        for(auto psize : paramSizes) {
-            stream << (int)psize << ' ';
-        }
-
-        return stream.str();
-    }
-};
-
 static std::map<uint16_t, Instruction> opcodeIndex {
     Instruction::create("nop", 0x0),
     Instruction::create("scriptname", 0x03A4, {String8}),
@@ -137,26 +130,6 @@ static std::map<uint16_t, Instruction> opcodeIndex {
     Instruction::create("goto", 0x0002, {S8}),
 };
 
-static std::vector<uint8_t> psizes;
-static int foundTokenIndex = 0;
-std::string removeTokens(std::string &dirty) {
-    auto firstPercent = dirty.find("%");
-    if(firstPercent == std::string::npos) return dirty;
-
-    auto secondPercent = dirty.find_first_of('%', firstPercent + 1);
-    if(secondPercent == firstPercent or secondPercent == std::string::npos) return dirty;
-
-    //std::cout << dirty.substr(firstPercent, (secondPercent - firstPercent) + 1) << '\n';
-    auto numstr = dirty.substr(firstPercent + 1, (secondPercent - firstPercent) - 2);
-    //std::cout << numstr << '\n';
-    psizes.push_back(std::stoi(numstr));
-
-    //dirty.erase(firstPercent, (secondPercent - firstPercent) + 1);
-    dirty.replace(firstPercent, (secondPercent - firstPercent) + 1, "$" +/* std::to_string(foundTokenIndex++)*/std::to_string(std::stoi(numstr) - 1));
-
-    return removeTokens(dirty);
-}
-
 struct ScriptParam {
     int m_iIntValue {};
     unsigned short m_usGlobalOffset {};
@@ -171,87 +144,6 @@ struct ScriptParam {
     }
 };
 
-std::map<uint16_t, PlaceholderInstruction> placeholderInstructions;
-
-void parseOpcodeFile(string_ref path) {
-    std::ifstream stream(path);
-
-    while(stream) {
-        std::stringstream thisLine;
-
-        char c;
-        while(stream and (c = stream.get()) != '\n') {
-            thisLine << c;
-        }
-
-        std::string s = thisLine.str();
-
-        if(s.starts_with(';') or s.starts_with('[')) continue;
-
-        auto commentIndex = s.find(';');
-        if(commentIndex != std::string::npos) {
-            s = s.substr(0, commentIndex);
-        }
-
-        commentIndex = s.find("//");
-        if(commentIndex != std::string::npos) {
-            s = s.substr(0, commentIndex);
-        }
-
-        trim(s);
-
-        PlaceholderInstruction instruction;
-
-        auto equalsIndex = s.find('=');
-        if(equalsIndex == std::string::npos) continue;
-
-        std::string opcodeString = s.substr(0, equalsIndex);
-        trim(opcodeString);
-
-        if(opcodeString.find_first_not_of("abcdefABCDEF0123456789") != std::string::npos) continue;
-
-        std::string infoString = s.substr(equalsIndex + 1);
-
-        auto commaIndex = s.find(',');
-        infoString = s.substr(commaIndex + 1);
-        trim(infoString);
-
-        instruction.opcode = std::stoi(opcodeString, 0, 16);
-        std::string before = infoString;
-        instruction.name = removeTokens(infoString);
-
-        instruction.paramSizes = psizes;
-
-        psizes.clear();
-        foundTokenIndex = 0;
-
-        placeholderInstructions[instruction.opcode] = instruction;
-
-        miss2::Command m2cmd {
-            .name = instruction.name,
-            .opcode = instruction.opcode
-        };
-
-        int i = 0;
-        for(auto &p : instruction.paramSizes) {
-            // Add and unknown type for now. The real type will be added when the decompiler
-            //  finds an instance of this command.
-            m2cmd.parameters.push_back(miss2::Unknown);
-            m2cmd.parameters.back().size = instruction.paramSizes[i++];
-        }
-
-        miss2::Command::registerOpcode(instruction.opcode, m2cmd);
-
-        if(not (instruction.opcode & 0xF000)) {
-            uint16_t otherOpcode = instruction.opcode | 0x8000;
-            if(not miss2::Command::get(otherOpcode)) {
-                m2cmd.opcode = otherOpcode;
-                miss2::Command::registerOpcode(otherOpcode, m2cmd);
-            }
-        }
-    }
-}
-
 template <typename T>
 T readAndAdvance(uint8_t *&ptr) {
     T val = *(T *)ptr;
@@ -300,22 +192,16 @@ std::vector<DecompiledParam> getParamStrings(PlaceholderInstruction &instruction
             size = readAndAdvance<uint8_t>(scriptPointer);// + 1;
         }
 
-        varStrSizeForRep = size;
-
         uint8_t *paramBytes = new uint8_t[size];
 
-        bool varStrDidEnd = false;
-        for(int i = 0; i < size; ++i) {
-            uint8_t thisByte = *(scriptPointer++);
+        // Variable-length strings end at the first unprintable character, and everything after it is zeroed.
+        size_t keep = typeIsVStr ? simd::printablePrefix(scriptPointer, size) : size;
 
-            if(typeIsVStr and not std::isprint(thisByte)) {
-                varStrDidEnd = true;
-            }
-
-            paramBytes[i] = varStrDidEnd ? 0 : thisByte;
-        }
+        std::memcpy(paramBytes, scriptPointer, keep);
+        std::memset(paramBytes + keep, 0, size - keep);
+        scriptPointer += size;
 
-        std::string stringRep = info.stringRep(paramBytes);
+        std::string stringRep = typeIsVStr ? "'" + std::string(paramBytes, paramBytes + size) + "'" : info.stringRep(paramBytes);
 
         std::vector<uint8_t> bytesVector(paramBytes, paramBytes + size);
         delete[] paramBytes;
@@ -351,8 +237,6 @@ struct GlobalVariable {
     }
 };
 
-static std::map<uint16_t, GlobalVariable> allGlobalVariables;
-
 void printEmptyLine(size_t offset, string_ref comment = "") {
     // Match the number of digits in the offset with spaces.
     std::string spaceStr(countDigits(offset), ' ');
@@ -362,13 +246,15 @@ void printEmptyLine(size_t offset, string_ref comment = "") {
 }
 
 struct CompiledParameter {
-    ParamType type;
+    ParamType type {};
     uint8_t *data = nullptr;
 
     // This is *NOT* designed for proper decompilation. Use only when no better methods
     //  are available (e.g. when the instruction is not known).
-    static CompiledParameter read(uint8_t *&scriptPointer) {
+    static CompiledParameter read(uint8_t *&scriptPointer, const uint8_t *end,
+                                  const miss2::DecompilerContext &context = miss2::DecompilerContext::shared()) {
         CompiledParameter param;
+        if(scriptPointer >= end) return param;
 
         param.type = readAndAdvance<ParamType>(scriptPointer);
 
@@ -376,9 +262,11 @@ struct CompiledParameter {
 
         uint8_t readByte;// = *(scriptPointer++);
 
+        // The scan looks up to three bytes ahead, so it stops that far from the end.
         while(
-            not isValidParamType(readByte = *(scriptPointer + 1))
-            and not placeholderInstructions.count(*(uint16_t *)(scriptPointer + 1))
+            scriptPointer + 3 <= end
+            and not isValidParamType(readByte = *(scriptPointer + 1))
+            and not context.validOpcodes()[*(uint16_t *)(scriptPointer + 1)]
             ) {
 
             readData.push_back(readByte);
@@ -398,7 +286,7 @@ struct CompiledParameter {
     }
 };
 
-void printDisassembly(string_ref filename) {
+void printDisassembly(string_ref filename, const miss2::DecompilerContext &context = miss2::DecompilerContext::shared()) {
     std::string topCommentFormat = "/*\n  $0\n  Decompiled by miss3 on $1.\n*/\n";
     std::string lpc = lastPathComponent(filename);
     std::string dateTime = currentDateString();
@@ -414,6 +302,11 @@ void printDisassembly(string_ref filename) {
     // Becomes true on entering 'if', becomes false when something that should end the 'if' is found (call, jump, etc.)
     bool inIfCondition = false;
 
+    // Stores all call destinations.
+    std::set<int32_t> procedureLocations;
+
+    std::map<uint16_t, GlobalVariable> allGlobalVariables;
+
     for(size_t scriptOffset = 0; scriptPointer < bytes + bytesVector.size(); ++scriptOffset) {
         size_t opcodeOffset = scriptPointer - bytes;
 
@@ -441,7 +334,9 @@ void printDisassembly(string_ref filename) {
             printEmptyLine(opcodeOffset);
         }
 
-        if(not placeholderInstructions.count(opcode)) {
+        const miss2::Command &known = context.get(opcode);
+
+        if(not known) {
             std::string offsetStr = asComment(replaceTokens("/* $0 */ ", { std::to_string(opcodeOffset) }));
             std::cout << offsetStr << std::hex << "// 0x" << opcode << std::dec << '\n';
 
@@ -450,7 +345,11 @@ void printDisassembly(string_ref filename) {
             continue;
         }
 
-        PlaceholderInstruction instruction = placeholderInstructions[opcode];
+        PlaceholderInstruction instruction { std::string(known.name), opcode };
+
+        for(const miss2::Value &param : known.parameters) {
+            instruction.paramSizes.push_back(uint8_t(param.size));
+        }
 
         auto paramObjects = getParamStrings(instruction, scriptPointer, bytes);
 
@@ -517,49 +416,840 @@ void printDisassembly(string_ref filename) {
     delete[] bytes;
 }
 
+static void reportThroughput(string_ref what, size_t commandCount, size_t byteCount, std::chrono::steady_clock::duration elapsed) {
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    double megabytesPerSecond = seconds > 0 ? (double(byteCount) / 1e6) / seconds : 0;
+
+    std::cerr << what << ' ' << commandCount << " commands (" << byteCount << " bytes) in "
+              << seconds * 1000.0 << " ms, " << megabytesPerSecond << " MB/s\n";
+}
+
+// Decodes the input one command at a time and writes each IR record as soon as it is decoded.
+// Unlike the full path, no Script is built, so memory use stays constant.
+static int streamIR(string_ref inputPath, string_ref outputPath, bool textIR) {
+    MappedFile input(inputPath.c_str());
+    if(not input) {
+        std::cerr << "error: could not read " << inputPath << '\n';
+        return 1;
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+    size_t commandCount = 0;
+    miss2::DecodeResult decodeResult;
+
+    if(textIR) {
+        std::ofstream outFile(outputPath);
+
+        decodeResult = miss2::Decompiler::forEachCommand(input.data, input.size, [&](miss2::Command &command) {
+            if(commandCount++) {
+                outFile << '\n';
+            }
+
+            miss2::writeTextIR(outFile, command);
+        });
+    } else {
+        int fd = open(outputPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0) {
+            std::cerr << "error: could not open " << outputPath << '\n';
+            return 1;
+        }
+
+        miss2::StreamingIRWriter writer(fd);
+
+        decodeResult = miss2::Decompiler::forEachCommand(input.data, input.size, [&](miss2::Command &command) {
+            writer.add(command);
+        });
+
+        bool ok = writer.finish(input.size);
+        close(fd);
+
+        if(not ok) {
+            std::cerr << "error: failed to write " << outputPath << '\n';
+            return 1;
+        }
+
+        commandCount = writer.count();
+    }
+
+    if(decodeResult.truncated) {
+        std::cerr << "warning: " << decodeResult.message() << '\n';
+    }
+
+    reportThroughput("streamed", commandCount, input.size, std::chrono::steady_clock::now() - startTime);
+    return 0;
+}
+
+// Assembles text or binary IR (detected from the header) back into bytecode.
+static int assembleIR(string_ref inputPath, string_ref outputPath, bool preserveOffsets, bool optimizeJumps) {
+    MappedFile input(inputPath.c_str());
+    if(not input) {
+        std::cerr << "error: could not read " << inputPath << '\n';
+        return 1;
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    std::vector<miss2::Command> commands;
+    std::string error;
+    size_t sourceSize = 0;
+
+    bool isBinary = input.size >= 4 and std::memcmp(input.data, "GTIR", 4) == 0;
+    bool parsed = isBinary
+                  ? miss2::Assembler::parseBinaryIR(input.data, input.size, commands, sourceSize, error)
+                  : miss2::Assembler::parseTextIR(std::string_view((char *)input.data, input.size), commands, error);
+
+    if(not parsed) {
+        std::cerr << "error: " << inputPath << ": " << error << '\n';
+        return 1;
+    }
+
+    size_t unresolvedLabels;
+    auto bytecode = miss2::Assembler::assemble(commands, preserveOffsets, sourceSize, unresolvedLabels, optimizeJumps);
+
+    if(unresolvedLabels) {
+        std::cerr << "warning: " << unresolvedLabels << " labels did not point at a command and were not relocated\n";
+    }
+
+    if(not writeFileBytes(outputPath.c_str(), bytecode)) {
+        std::cerr << "error: failed to write " << outputPath << '\n';
+        return 1;
+    }
+
+    reportThroughput("assembled", commands.size(), bytecode.size(), std::chrono::steady_clock::now() - startTime);
+    return 0;
+}
+
+// Records how the jobs of a mode that works on many scripts were spread over the workers.
+static void recordUtilisation(miss2::Stats *stats, const WorkStealingPool &pool) {
+    if(not stats) return;
+
+    auto utilisation = pool.utilisation();
+
+    stats->count("workers", pool.size());
+    stats->count("jobs", utilisation.jobs());
+    stats->count("stolen_jobs", utilisation.stolen());
+    stats->count("busy_percent", size_t(utilisation.busyFraction() * 100.0 + 0.5));
+}
+
+// Searches scripts (or directories of scripts) for a pattern and prints each match as "file:offset".
+static int searchScripts(string_ref patternText, const std::vector<std::string> &paths, size_t workerCount,
+                         miss2::Stats *stats) {
+    miss2::SearchPattern pattern;
+    std::string error;
+
+    if(not miss2::SearchPattern::compile(patternText, pattern, error)) {
+        std::cerr << "error: bad pattern: " << error << '\n';
+        return 1;
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    auto table = miss2::OpcodeTable::fromContext();
+    auto scripts = collectFiles(paths, ".scm");
+
+    WorkStealingPool pool(workerCount);
+    auto matches = miss2::searchFiles(scripts, pattern, table, pool);
+    recordUtilisation(stats, pool);
+
+    size_t byteCount = 0;
+    for(auto &path : scripts) {
+        std::error_code sizeError;
+        auto size = std::filesystem::file_size(path, sizeError);
+        if(not sizeError) byteCount += size;
+    }
+
+    for(auto &match : matches) {
+        std::cout << match.file << ':' << match.offset << '\n';
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cerr << matches.size() << " matches in " << scripts.size() << " scripts (" << byteCount << " bytes) in "
+              << seconds * 1000.0 << " ms, " << (seconds > 0 ? (double(byteCount) / 1e6) / seconds : 0) << " MB/s\n";
+
+    return 0;
+}
+
+// Builds or updates an index of the scripts (or directories of scripts) in 'paths'.
+static int buildIndex(const std::string &indexPath, const std::vector<std::string> &paths, size_t workerCount,
+                      miss2::Stats *stats) {
+    auto startTime = std::chrono::steady_clock::now();
+
+    auto table = miss2::OpcodeTable::fromContext();
+    auto scripts = collectFiles(paths, ".scm");
+
+    miss2::IndexUpdateSummary summary;
+    WorkStealingPool pool(workerCount);
+
+    if(not miss2::updateCorpusIndex(indexPath, scripts, table, summary, pool)) return 1;
+    recordUtilisation(stats, pool);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cerr << "indexed " << summary.scripts << " scripts (" << summary.scanned << " scanned, " << summary.reused
+              << " unchanged, " << summary.removed << " removed): " << summary.keys << " keys, " << summary.postings
+              << " postings in " << seconds * 1000.0 << " ms\n";
+
+    return 0;
+}
+
+// Looks up each query in an index and prints the places it is used as "file:offset".
+static int queryIndex(const std::string &indexPath, const std::vector<std::string> &queries) {
+    miss2::CorpusIndex index;
+    if(not index.open(indexPath)) return 1;
+
+    for(const std::string &query : queries) {
+        miss2::IndexKey key {};
+        std::string error;
+
+        if(not miss2::parseIndexQuery(query, key, error)) {
+            std::cerr << "error: bad query '" << query << "': " << error << '\n';
+            return 1;
+        }
+
+        std::vector<miss2::IndexPosting> postings;
+        auto startTime = std::chrono::steady_clock::now();
+
+        if(not index.lookup(key, postings)) {
+            std::cerr << "error: index " << indexPath << " is damaged\n";
+            return 1;
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+        for(auto &posting : postings) {
+            std::cout << index.scriptPath(posting.script) << ':' << posting.offset << '\n';
+        }
+
+        std::cerr << query << ": " << postings.size() << " uses in " << seconds * 1e6 << " us\n";
+    }
+
+    return 0;
+}
+
+// Builds cross-references for the globals used by 'paths', then answers "who reads/writes" queries and
+//  exports the table if an output path is given.
+static int crossReferenceGlobals(const std::vector<std::string> &paths, const std::string &outputPath,
+                                 const std::vector<std::pair<uint32_t, bool>> &queries, size_t workerCount,
+                                 miss2::Stats *stats) {
+    auto startTime = std::chrono::steady_clock::now();
+
+    auto table = miss2::OpcodeTable::fromContext();
+    auto scripts = collectFiles(paths, ".scm");
+
+    miss2::GlobalXrefTable xrefs;
+    WorkStealingPool pool(workerCount);
+
+    xrefs.addScripts(scripts, table, pool);
+    recordUtilisation(stats, pool);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cerr << xrefs.offsets().size() << " globals in " << scripts.size() << " scripts in " << seconds * 1000.0
+              << " ms\n";
+
+    for(auto &[offset, writes] : queries) {
+        miss2::GlobalXref xref;
+        xrefs.lookup(offset, xref);
+
+        std::cerr << "global " << offset << " (" << miss2::xrefTypeName(xref.type) << "): " << xref.reads.size()
+                  << " reads, " << xref.writes.size() << " writes\n";
+
+        for(auto &site : writes ? xref.writes : xref.reads) {
+            std::cout << xrefs.scripts()[site.script] << ':' << site.offset << " " << std::hex
+                      << std::setw(4) << std::setfill('0') << site.opcode << std::dec << '\n';
+        }
+    }
+
+    if(not outputPath.empty() and not xrefs.writeBinary(outputPath)) return 1;
+
+    return 0;
+}
+
+// Learns the parameter signatures of every opcode used by 'paths' and saves them to 'outputPath'.
+static int learnSignatures(const std::string &outputPath, const std::vector<std::string> &paths, size_t workerCount,
+                           miss2::Stats *stats) {
+    auto startTime = std::chrono::steady_clock::now();
+
+    auto table = miss2::OpcodeTable::fromContext();
+    auto scripts = collectFiles(paths, ".scm");
+
+    miss2::SignatureDatabase signatures;
+    WorkStealingPool pool(workerCount);
+
+    signatures.addScripts(scripts, table, pool);
+    recordUtilisation(stats, pool);
+
+    size_t variadic = 0, fixed = 0;
+
+    for(auto &[opcode, signature] : signatures.all()) {
+        if(signature.arities.size() > 1) ++variadic;
+        if(signature.fixed()) ++fixed;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cerr << signatures.all().size() << " opcodes used in " << signatures.scripts() << " scripts (" << fixed
+              << " always with the same parameters, " << variadic << " with more than one parameter count) in "
+              << seconds * 1000.0 << " ms\n";
+
+    return signatures.writeBinary(outputPath) ? 0 : 1;
+}
+
+// Prints the instructions in 'paths' whose parameters the signature database says are unusual, as
+//  "file:offset opcode: reason".
+static int findOutliers(const std::string &signaturesPath, const std::vector<std::string> &paths, size_t workerCount,
+                        miss2::Stats *stats) {
+    miss2::SignatureDatabase signatures;
+    if(not signatures.readBinary(signaturesPath)) return 1;
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    auto table = miss2::OpcodeTable::fromContext();
+    auto scripts = collectFiles(paths, ".scm");
+
+    std::vector<std::string> reports(scripts.size());
+    size_t outlierCount = 0;
+    std::mutex countLock;
+
+    WorkStealingPool pool(workerCount);
+
+    forEachFileLargestFirst(pool, scripts, [&](size_t i) {
+        MappedFile file(scripts[i].c_str());
+
+        if(not file) {
+            std::lock_guard<std::mutex> guard(countLock);
+            std::cerr << "error: could not read " << scripts[i] << '\n';
+            return;
+        }
+
+        miss2::FlatDecoder decoder(table, file.data, file.size);
+        miss2::FlatInstruction instruction;
+        std::ostringstream out;
+        size_t found = 0;
+
+        while(decoder.next(instruction)) {
+            miss2::SignatureCheck check = signatures.check(instruction);
+            if(not check) continue;
+
+            out << scripts[i] << ':' << instruction.offset << ' ' << std::hex << std::setw(4) << std::setfill('0')
+                << instruction.opcode << std::dec << ": " << miss2::signatureMismatchName(check.mismatch);
+
+            if(check.parameter >= 0) out << " (parameter " << check.parameter << ')';
+            out << '\n';
+
+            ++found;
+        }
+
+        reports[i] = out.str();
+
+        std::lock_guard<std::mutex> guard(countLock);
+        outlierCount += found;
+    });
+
+    recordUtilisation(stats, pool);
+
+    for(const std::string &report : reports) {
+        std::cout << report;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cerr << outlierCount << " unusual instructions in " << scripts.size() << " scripts in " << seconds * 1000.0
+              << " ms\n";
+
+    return 0;
+}
+
+static std::string defaultOpcodePath = "/Users/squ1dd13/Documents/MSD-Project/cpp/GTA-ASM/Opcodes.ini";
+
+// Recovers the names of the keys in a GXT file from word lists, masks and the text labels used by the
+//  scripts in 'paths', and prints them as "hash=NAME" (see gxt_keys.hpp).
+static int recoverKeyNames(const std::string &gxtPath, const std::vector<std::string> &dictionaryPaths,
+                           const std::vector<std::string> &maskTexts, const std::vector<std::string> &paths,
+                           size_t workerCount, miss2::Stats *stats) {
+    std::vector<GXTKeyMask> masks;
+
+    for(const std::string &text : maskTexts) {
+        std::string error;
+
+        if(not GXTKeyMask::parse(text, masks, error)) {
+            std::cerr << "error: bad mask '" << text << "': " << error << '\n';
+            return 1;
+        }
+    }
+
+    GXT gxt;
+    if(not gxt.open(gxtPath)) return 1;
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    GXTKeyTargets targets(gxt);
+    GXTKeyRecovery recovery(targets);
+
+    WorkStealingPool pool(workerCount);
+
+    if(not paths.empty()) {
+        auto table = miss2::OpcodeTable::fromContext();
+        auto labels = harvestTextLabels(collectFiles(paths, ".scm"), table, pool);
+
+        recovery.addNames(labels, GXTKeyRecovery::Label, pool);
+    }
+
+    for(const std::string &path : dictionaryPaths) {
+        std::ifstream stream(path);
+
+        if(not stream) {
+            std::cerr << "error: could not read " << path << '\n';
+            return 1;
+        }
+
+        std::vector<std::string> words;
+
+        for(std::string line; std::getline(stream, line);) {
+            while(not line.empty() and std::isspace((unsigned char)line.back())) line.pop_back();
+            if(not line.empty()) words.push_back(std::move(line));
+        }
+
+        recovery.addNames(words, GXTKeyRecovery::Word, pool);
+    }
+
+    for(const GXTKeyMask &mask : masks) {
+        if(not recovery.addMask(mask, pool)) return 1;
+    }
+
+    recordUtilisation(stats, pool);
+
+    auto results = recovery.results();
+    size_t bySource[3] = {}, ambiguous = 0;
+
+    for(auto &[hash, candidates] : results) {
+        std::cout << std::hex << std::setw(8) << std::setfill('0') << hash << std::dec << '=' << candidates[0].name << '\n';
+
+        ++bySource[candidates[0].source];
+        if(candidates.size() > 1) ++ambiguous;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cerr << "recovered " << results.size() << " of " << targets.size() << " keys (" << bySource[GXTKeyRecovery::Label]
+              << " from labels, " << bySource[GXTKeyRecovery::Word] << " from word lists, "
+              << bySource[GXTKeyRecovery::Mask] << " from masks, " << ambiguous << " with more than one name) from "
+              << recovery.candidatesTried() << " candidates in " << seconds * 1000.0 << " ms, "
+              << (seconds > 0 ? double(recovery.candidatesTried()) / 1e6 / seconds : 0) << " M/s\n";
+
+    return 0;
+}
+
+// Exports the text of every GXT file in 'paths' to UTF-8 text files in 'outputDirectory' (see gxt_export.hpp).
+static int exportGXT(const std::string &outputDirectory, const std::string &keyNamesPath,
+                     const std::vector<std::string> &paths, size_t workerCount, miss2::Stats *stats) {
+    GXTKeyNames keyNames;
+    if(not keyNamesPath.empty() and not readGXTKeyNames(keyNamesPath, keyNames)) return 1;
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    GXTExportSummary summary;
+    WorkStealingPool pool(workerCount);
+
+    bool exported = exportGXTFiles(collectFiles(paths, ".gxt"), outputDirectory, keyNames, summary, pool);
+    recordUtilisation(stats, pool);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cerr << "exported " << summary.strings << " strings from " << summary.files << " files (" << summary.inputBytes
+              << " bytes in, " << summary.outputBytes << " bytes out) in " << seconds * 1000.0 << " ms, "
+              << (seconds > 0 ? (double(summary.inputBytes) / 1e6) / seconds : 0) << " MB/s\n";
+
+    return exported ? 0 : 1;
+}
+
+// Reads the number after the '=' in an option such as --workers=4. Prints an error if it isn't one.
+template <typename Number>
+static bool parseOptionNumber(string_ref arg, Number &value) {
+    std::string_view option(arg);
+    std::string_view text = option.substr(option.find('=') + 1);
+
+    auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+
+    if(result.ec != std::errc() or result.ptr != text.data() + text.size()) {
+        std::cerr << "error: bad number '" << text << "' for " << option.substr(0, option.find('=')) << '\n';
+        return false;
+    }
+
+    return true;
+}
+
 int main(int argc, char **argv) {
+    // Options are "--name" or "--name=value"; everything else is a positional argument.
+    std::vector<std::string> arguments;
+    bool textIR = false;
+    bool streamOutput = false;
+    bool serve = false;
+    bool assemble = false;
+    bool preserveOffsets = false;
+    bool optimizeJumps = false;
+    std::string socketPath;
+    std::string searchPattern;
+    std::string indexPath;
+    std::vector<std::string> indexQueries;
+    bool crossReference = false;
+    std::string xrefPath;
+    std::vector<std::pair<uint32_t, bool>> xrefQueries;
+    size_t workerCount = ThreadPool::defaultThreadCount();
+    std::string opcodePath = defaultOpcodePath;
+    std::string gxtPath;
+    std::vector<std::string> idePaths;
+    std::string recoverKeysPath;
+    std::vector<std::string> dictionaryPaths;
+    std::vector<std::string> keyMasks;
+    std::string gxtExportPath;
+    std::string keyNamesPath;
+    std::string learnSignaturesPath;
+    std::string outliersPath;
+    bool collectStats = false;
+    int statsFD = STDERR_FILENO;
+
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+
+        if(arg == "--text") {
+            // Write the old text IR instead of the binary IR.
+            textIR = true;
+        } else if(arg == "--stream") {
+            // Decode and write one command at a time without building a Script.
+            streamOutput = true;
+        } else if(arg.starts_with("--opcodes=")) {
+            opcodePath = arg.substr(std::strlen("--opcodes="));
+        } else if(arg.starts_with("--gxt=")) {
+            // Show the game text for text labels when printing code.
+            gxtPath = arg.substr(std::strlen("--gxt="));
+        } else if(arg.starts_with("--ide=")) {
+            // Name the models in an IDE file when printing code.
+            idePaths.push_back(arg.substr(std::strlen("--ide=")));
+        } else if(arg == "--assemble") {
+            // Turn IR back into bytecode.
+            assemble = true;
+        } else if(arg == "--preserve-offsets") {
+            // Keep every command at its original offset when assembling.
+            preserveOffsets = true;
+        } else if(arg == "--optimize-jumps") {
+            // Bypass chains of jumps when assembling.
+            optimizeJumps = true;
+        } else if(arg == "--serve") {
+            // Serve requests over stdin/stdout.
+            serve = true;
+        } else if(arg.starts_with("--serve=")) {
+            // Serve requests over a Unix socket.
+            serve = true;
+            socketPath = arg.substr(std::strlen("--serve="));
+        } else if(arg.starts_with("--search=")) {
+            // Search scripts for a pattern (see miss2/search.hpp) instead of decompiling them.
+            searchPattern = arg.substr(std::strlen("--search="));
+        } else if(arg.starts_with("--index=")) {
+            // Build or update a corpus index (see miss2/corpus_index.hpp), or query one with --query.
+            indexPath = arg.substr(std::strlen("--index="));
+        } else if(arg.starts_with("--query=")) {
+            indexQueries.push_back(arg.substr(std::strlen("--query=")));
+        } else if(arg == "--xref") {
+            // Cross-reference globals across scripts (see miss2/xref.hpp).
+            crossReference = true;
+        } else if(arg.starts_with("--xref=")) {
+            // As above, and export the table to a file.
+            crossReference = true;
+            xrefPath = arg.substr(std::strlen("--xref="));
+        } else if(arg.starts_with("--who-writes=") or arg.starts_with("--who-reads=")) {
+            crossReference = true;
+
+            uint32_t offset;
+            if(not parseOptionNumber(arg, offset)) return 1;
+
+            xrefQueries.emplace_back(offset, arg.starts_with("--who-writes="));
+        } else if(arg.starts_with("--recover-keys=")) {
+            // Recover the key names of a GXT file (see gxt_keys.hpp).
+            recoverKeysPath = arg.substr(std::strlen("--recover-keys="));
+        } else if(arg.starts_with("--dict=")) {
+            dictionaryPaths.push_back(arg.substr(std::strlen("--dict=")));
+        } else if(arg.starts_with("--mask=")) {
+            keyMasks.push_back(arg.substr(std::strlen("--mask=")));
+        } else if(arg.starts_with("--export-gxt=")) {
+            // Dump the text of GXT files (see gxt_export.hpp).
+            gxtExportPath = arg.substr(std::strlen("--export-gxt="));
+        } else if(arg.starts_with("--key-names=")) {
+            keyNamesPath = arg.substr(std::strlen("--key-names="));
+        } else if(arg.starts_with("--learn-signatures=")) {
+            // Learn the parameter types of every opcode from the scripts and save them.
+            learnSignaturesPath = arg.substr(std::strlen("--learn-signatures="));
+        } else if(arg.starts_with("--outliers=")) {
+            // Print the instructions that don't fit a database from --learn-signatures.
+            outliersPath = arg.substr(std::strlen("--outliers="));
+        } else if(arg.starts_with("--workers=")) {
+            if(not parseOptionNumber(arg, workerCount)) return 1;
+            workerCount = std::max<size_t>(1, workerCount);
+        } else if(arg == "--stats" or arg == "--stats=json") {
+            // Report phase timings and counters as JSON.
+            collectStats = true;
+        } else if(arg.starts_with("--stats=")) {
+            std::cerr << "error: unknown stats format '" << arg.substr(std::strlen("--stats=")) << "' (only json is supported)\n";
+            return 1;
+        } else if(arg.starts_with("--stats-fd=")) {
+            // Where the stats report is written (stderr by default).
+            if(not parseOptionNumber(arg, statsFD)) return 1;
+        } else {
+            arguments.push_back(arg);
+        }
+    }
+
+    if(serve) {
+        // Nothing else may be written to stdout when it carries the replies.
+        parseOpcodeFile(opcodePath);
+
+        DecompileServer server(workerCount);
+
+        if(socketPath.empty()) {
+            server.serveStdio();
+            return 0;
+        }
+
+        return server.serveSocket(socketPath) ? 0 : 1;
+    }
+
+    std::cerr << "GTA-ASM v1.0\n";
 
-    std::cout << "GTA-ASM v1.0\n";
+    miss2::Stats stats;
+    miss2::Stats *statsOrNull = collectStats ? &stats : nullptr;
 
-    if(argc > 2) {
-        // argv[1] is the input file
-        // argv[2] is the output file
+    // Writes the stats report (if wanted) before exiting with 'result'.
+    auto finish = [&](int result) {
+        if(collectStats and not stats.writeJSON(statsFD)) {
+            std::cerr << "error: could not write stats to file descriptor " << statsFD << '\n';
+        }
+
+        return result;
+    };
+
+    auto loadOpcodes = [&] {
+        miss2::Stats::Timer timer(statsOrNull, "opcode_db");
+        parseOpcodeFile(opcodePath);
+    };
+
+    if(not searchPattern.empty()) {
+        if(arguments.empty()) {
+            std::cerr << "usage: gtasm --search=<pattern> [--workers=<n>] <script or directory>...\n";
+            return 1;
+        }
+
+        loadOpcodes();
+
+        int result;
+
+        {
+            miss2::Stats::Timer timer(statsOrNull, "search");
+            result = searchScripts(searchPattern, arguments, workerCount, statsOrNull);
+        }
+
+        return finish(result);
+    }
+
+    if(not indexPath.empty()) {
+        if(indexQueries.empty() == arguments.empty()) {
+            std::cerr << "usage: gtasm --index=<index file> [--workers=<n>] <script or directory>...\n"
+                      << "       gtasm --index=<index file> --query=<kind>:<value>...\n";
+            return 1;
+        }
+
+        int result;
+
+        if(not indexQueries.empty()) {
+            miss2::Stats::Timer timer(statsOrNull, "index_query");
+            result = queryIndex(indexPath, indexQueries);
+        } else {
+            loadOpcodes();
+
+            miss2::Stats::Timer timer(statsOrNull, "index_build");
+            result = buildIndex(indexPath, arguments, workerCount, statsOrNull);
+        }
+
+        return finish(result);
+    }
+
+    if(crossReference) {
+        if(arguments.empty()) {
+            std::cerr << "usage: gtasm --xref[=<output file>] [--who-writes=<global>] [--who-reads=<global>] "
+                         "<script or directory>...\n";
+            return 1;
+        }
+
+        loadOpcodes();
+
+        int result;
+
+        {
+            miss2::Stats::Timer timer(statsOrNull, "xref");
+            result = crossReferenceGlobals(arguments, xrefPath, xrefQueries, workerCount, statsOrNull);
+        }
+
+        return finish(result);
+    }
+
+    if(not learnSignaturesPath.empty()) {
+        if(arguments.empty()) {
+            std::cerr << "usage: gtasm --learn-signatures=<output file> [--workers=<n>] <script or directory>...\n";
+            return 1;
+        }
+
+        loadOpcodes();
+
+        int result;
+
+        {
+            miss2::Stats::Timer timer(statsOrNull, "learn_signatures");
+            result = learnSignatures(learnSignaturesPath, arguments, workerCount, statsOrNull);
+        }
+
+        return finish(result);
+    }
+
+    if(not outliersPath.empty()) {
+        if(arguments.empty()) {
+            std::cerr << "usage: gtasm --outliers=<signature file> [--workers=<n>] <script or directory>...\n";
+            return 1;
+        }
+
+        loadOpcodes();
+
+        int result;
+
+        {
+            miss2::Stats::Timer timer(statsOrNull, "outliers");
+            result = findOutliers(outliersPath, arguments, workerCount, statsOrNull);
+        }
+
+        return finish(result);
+    }
+
+    if(not recoverKeysPath.empty()) {
+        if(arguments.empty() and dictionaryPaths.empty() and keyMasks.empty()) {
+            std::cerr << "usage: gtasm --recover-keys=<file.gxt> [--dict=<word list>]... [--mask=<pattern>]... "
+                         "[--workers=<n>] [script or directory]...\n";
+            return 1;
+        }
+
+        // Only needed for decoding the scripts that labels are taken from.
+        if(not arguments.empty()) loadOpcodes();
+
+        int result;
+
+        {
+            miss2::Stats::Timer timer(statsOrNull, "recover_keys");
+            result = recoverKeyNames(recoverKeysPath, dictionaryPaths, keyMasks, arguments, workerCount, statsOrNull);
+        }
+
+        return finish(result);
+    }
+
+    if(not gxtExportPath.empty()) {
+        if(arguments.empty()) {
+            std::cerr << "usage: gtasm --export-gxt=<output directory> [--key-names=<file>] [--workers=<n>] "
+                         "<file.gxt or directory>...\n";
+            return 1;
+        }
+
+        int result;
+
+        {
+            miss2::Stats::Timer timer(statsOrNull, "export_gxt");
+            result = exportGXT(gxtExportPath, keyNamesPath, arguments, workerCount, statsOrNull);
+        }
+
+        return finish(result);
+    }
+
+    if(assemble) {
+        if(arguments.size() < 2) {
+            std::cerr << "usage: gtasm --assemble [--preserve-offsets] <input IR> <output.scm>\n";
+            return 1;
+        }
+
+        // Only needed for finding label parameters.
+        loadOpcodes();
+
+        int result;
+
+        {
+            miss2::Stats::Timer timer(statsOrNull, "assemble");
+            result = assembleIR(arguments[0], arguments[1], preserveOffsets, optimizeJumps);
+        }
+
+        return finish(result);
+    }
+
+    if(arguments.size() > 1) {
+        // arguments[0] is the input file
+        // arguments[1] is the output file
 
         // Decompile the file to an intermediate representation and output
         //  that representation to a file for further processing.
 
-        parseOpcodeFile("/Users/squ1dd13/Documents/MSD-Project/cpp/GTA-ASM/Opcodes.ini");
+        loadOpcodes();
 
-        unlink(argv[2]);
-        std::ofstream outFile(argv[2]);
+        unlink(arguments[1].c_str());
 
-        miss2::Script script = miss2::Decompiler::decompile(argv[1]);
+        if(streamOutput) {
+            int result;
 
-        bool first = true;
-        for(miss2::Command &command : script.commands) {
-            if(not first) {
-                outFile << '\n';
+            {
+                miss2::Stats::Timer timer(statsOrNull, "stream");
+                result = streamIR(arguments[0], arguments[1], textIR);
             }
 
-            first = false;
+            return finish(result);
+        }
 
-            outFile << command.offset << ':' << command.opcode << '[';
+        auto startTime = std::chrono::steady_clock::now();
 
-            int i = 0;
-            for(miss2::Value &param : command.parameters) {
-                outFile << miss2::primitiveVtoS(param);
+        // Big scripts are decoded in chunks on the pool.
+        WorkStealingPool pool(workerCount);
+        miss2::Script script = miss2::Decompiler::decompile(arguments[0], std::cerr, statsOrNull,
+                                                            miss2::DecompilerContext::shared(), &pool);
 
-                // << ','
+        {
+            miss2::Stats::Timer timer(statsOrNull, "write_ir", script.commands.size());
 
-                if(i++ != command.parameters.size() - 1) {
-                    outFile  << ',';
-                }
+            if(textIR) {
+                std::ofstream outFile(arguments[1]);
+                miss2::writeTextIR(outFile, script.commands);
+            } else {
+                // The binary IR is built in memory and written in one go.
+                writeFileBytes(arguments[1].c_str(), miss2::encodeBinaryIR(script.commands, script.sourceSize));
             }
+        }
 
-            outFile << ']';
+        reportThroughput("decompiled", script.commands.size(), script.sourceSize, std::chrono::steady_clock::now() - startTime);
+        stats.count("instructions", script.commands.size());
+
+        return finish(0);
+    }
+
+    if(arguments.size() == 1) {
+        // Decompile a single script and print the code to stdout. Everything else goes to stderr.
+        loadOpcodes();
+
+        GXT gxt;
+        if(not gxtPath.empty() and not gxt.open(gxtPath)) return finish(1);
+
+        game::ModelTable models = game::ModelTable::builtIn();
+
+        for(const std::string &path : idePaths) {
+            if(not models.loadIDE(path)) return finish(1);
         }
 
-        return 0;
+        // Decoding, the analysis passes and the rendering of big scripts are split into jobs.
+        WorkStealingPool pool(workerCount);
+
+        miss2::Script script = miss2::Decompiler::decompile(arguments[0], std::cerr, statsOrNull,
+                                                            miss2::DecompilerContext::shared(), &pool);
+        if(gxt) script.gxt = &gxt;
+        script.models = &models;
+        script.scheduler = &pool;
+
+        script.prettyPrint(std::cout);
+        recordUtilisation(statsOrNull, pool);
+
+        return finish(0);
     }
 
     // /Users/squ1dd13/CLionProjects/gtasm/GTA Scripts/planes.scm
@@ -569,14 +1259,13 @@ int main(int argc, char **argv) {
     // drive_c/Program Files/Steam/steamapps/common/
     // Grand Theft Auto San Andreas/data/script/main.scm
 // /Users/squ1dd13/gta_wine/drive_c/Program Files/Rockstar Games/GTA San Andreas/data/script/main.scm
-    miss2::optimize_jumps = true;
 
     // /Users/squ1dd13/Downloads/1300424050_pimpmycar/PimpCarA_FULL/TuningA.cm
 
     bool testingDecompilation = true;
 
     if(testingDecompilation) {
-        parseOpcodeFile("/Users/squ1dd13/Documents/MSD-Project/cpp/GTA-ASM/Opcodes.ini");
+        loadOpcodes();
 
         miss2::Script script = miss2::Decompiler::decompile("/Users/squ1dd13/Documents/MSD-Project/cpp/GTA-ASM/GTA Scripts/debt.scm");
         script.prettyPrint();
@@ -597,12 +1286,5 @@ int main(int argc, char **argv) {
     //    std::cout << replaceTokens(cmd.name, paramStrs) << '\n';
     //}
 
-    //GXT gxt = GXT::read("/Users/squ1dd13/Library"
-    //                    "/Application Support/CrossOver"
-    //                    "/Bottles/Grand Theft Auto San Andreas"
-    //                    "/drive_c/Program Files/Steam"
-    //                    "/steamapps/common/GTA San Andreas"
-    //                    "/text/american.gxt");
-
     return 0;
 }
@@ -0,0 +1,466 @@
+/*
+ * Assembler for the intermediate representation (see ir.hpp). Turns text or binary IR back into .SCM bytecode.
+ *
+ * Each parameter is encoded from its DataType tag: the tag byte, then (for StringVar) a length byte, then
+ *  the value's bytes. Commands are laid out one after the other and every label parameter (jumps, calls and
+ *  any parameter marked as a label in the opcode file) is relocated to the new offset of its target.
+ *
+ * Binary IR is lossless. Text IR is not: floats only have six decimal places and the string types (String8,
+ *  String16 and StringVar) all look the same, so the type of a string is worked out from the space between
+ *  the command and the next one.
+ */
+
+#ifndef GTASM_ASSEMBLER_HPP
+#define GTASM_ASSEMBLER_HPP
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <unordered_map>
+#include "constructs.hpp"
+#include "context.hpp"
+#include "decompiler_context.hpp"
+#include "script.hpp"
+#include "ir.hpp"
+
+namespace miss2 {
+    class Assembler {
+        // A StringVar's length is written in one byte.
+        static const size_t max_string_var_length = 255;
+
+        template <typename T>
+        static bool parseNumber(std::string_view s, T &value) {
+            auto result = std::from_chars(s.data(), s.data() + s.size(), value);
+            return result.ec == std::errc() and result.ptr == s.data() + s.size();
+        }
+
+        // 'A1.2.3.4.5.6' style byte lists ('!' for none).
+        static bool parseByteList(std::string_view s, std::vector<uint8_t> &bytes) {
+            if(s == "!") return true;
+
+            while(not s.empty()) {
+                auto dot = s.find('.');
+                int byte;
+
+                if(not parseNumber(s.substr(0, dot), byte)) return false;
+                bytes.push_back(uint8_t(byte));
+
+                if(dot == std::string_view::npos) break;
+                s.remove_prefix(dot + 1);
+            }
+
+            return true;
+        }
+
+        template <typename T>
+        static Value makeValue(DataType type, T value) {
+            return Value(type, (uint8_t *)&value, sizeof(T));
+        }
+
+        static bool parseParam(std::string_view s, Value &value) {
+            if(s.empty()) return false;
+
+            if(s == "<unknown type>") {
+                // primitiveVtoS() gives no details for type tags it doesn't recognise.
+                value = Value(Unknown);
+                value.size = 0;
+                return true;
+            }
+
+            char prefix = s.front();
+            std::string_view rest = s.substr(1);
+
+            switch(prefix) {
+                case 'E':
+                    value = Value(EOAL);
+                    value.size = 0;
+                    return true;
+                case 'U':
+                    value = Value(Unknown);
+                    value.size = 0;
+                    return true;
+                case 'S': {
+                    int32_t v;
+                    if(not parseNumber(rest, v)) return false;
+                    value = makeValue(S32, v);
+                    return true;
+                }
+                case 'B': {
+                    int v;
+                    if(not parseNumber(rest, v)) return false;
+                    value = makeValue(S8, int8_t(v));
+                    return true;
+                }
+                case 'T': {
+                    int16_t v;
+                    if(not parseNumber(rest, v)) return false;
+                    value = makeValue(S16, v);
+                    return true;
+                }
+                case 'F': {
+                    float v;
+                    if(not parseNumber(rest, v)) return false;
+                    value = makeValue(F32, v);
+                    return true;
+                }
+                case 'G': case 'L': case 'M': case 'N': case 'K': case 'J': {
+                    static const std::unordered_map<char, DataType> types {
+                        {'G', GlobalIntFloat}, {'L', LocalIntFloat},
+                        {'M', GlobalString8}, {'N', LocalString8},
+                        {'K', GlobalString16}, {'J', LocalString16},
+                    };
+
+                    uint16_t v;
+                    if(not parseNumber(rest, v)) return false;
+                    value = makeValue(types.at(prefix), v);
+                    return true;
+                }
+                case 'A': case 'X': case 'V': case 'W': case 'R': case 'Z': {
+                    static const std::unordered_map<char, DataType> types {
+                        {'A', GlobalIntFloatArr}, {'X', LocalIntFloatArr},
+                        {'V', GlobalString8Arr}, {'W', LocalString8Arr},
+                        {'R', GlobalString16Arr}, {'Z', LocalString16Arr},
+                    };
+
+                    std::vector<uint8_t> bytes;
+                    if(not parseByteList(rest, bytes)) return false;
+
+                    bytes.resize(dataTypeSize(types.at(prefix)), 0);
+                    value = Value(types.at(prefix), bytes.data(), bytes.size());
+                    return true;
+                }
+                case 'H': {
+                    if(rest.size() % 2) return false;
+
+                    std::vector<uint8_t> bytes;
+
+                    for(size_t i = 0; i < rest.size(); i += 2) {
+                        uint8_t byte;
+                        auto parsed = std::from_chars(rest.data() + i, rest.data() + i + 2, byte, 16);
+                        if(parsed.ec != std::errc() or parsed.ptr != rest.data() + i + 2) return false;
+
+                        bytes.push_back(byte);
+                    }
+
+                    value = Value(RawBytes, bytes.data(), bytes.size());
+                    return true;
+                }
+                case '\'': {
+                    if(s.size() < 2 or s.back() != '\'') return false;
+
+                    // The real string type is chosen later, once the space available is known.
+                    std::string_view text = s.substr(1, s.size() - 2);
+                    value = Value(StringVar, (uint8_t *)text.data(), text.size());
+                    return true;
+                }
+                default:
+                    return false;
+            }
+        }
+
+        static size_t encodedSize(const Value &value) {
+            if(value.type == RawBytes) return value.byteCount();
+
+            return 1 + (value.type == StringVar ? 1 : 0) + value.byteCount();
+        }
+
+        static Value asStringType(const Value &value, DataType type) {
+            if(type == StringVar) return value;
+
+            std::vector<uint8_t> bytes(value.getBytes(), value.getBytes() + value.byteCount());
+            bytes.resize(dataTypeSize(type), 0);
+
+            return Value(type, bytes.data(), bytes.size());
+        }
+
+        // Picks String8, String16 or StringVar for each string parameter so that the command takes up exactly
+        //  'available' bytes. If that is not possible, the smallest type that fits each string is used.
+        static void resolveStringTypes(Command &command, size_t available) {
+            std::vector<size_t> stringIndices;
+            size_t fixedSize = 2;
+
+            for(size_t i = 0; i < command.parameters.size(); ++i) {
+                if(command.parameters[i].type == StringVar) {
+                    stringIndices.push_back(i);
+                } else {
+                    fixedSize += encodedSize(command.parameters[i]);
+                }
+            }
+
+            if(stringIndices.empty()) return;
+
+            static const DataType candidates[] = { String8, String16, StringVar };
+
+            // Only a handful of commands take more than one string, so trying every combination is fine.
+            size_t combinations = 1;
+            for(size_t i = 0; i < stringIndices.size() and combinations < 729; ++i) combinations *= 3;
+
+            for(size_t combination = 0; available and combination < combinations; ++combination) {
+                size_t total = fixedSize;
+                bool fits = true;
+                size_t c = combination;
+
+                for(size_t index : stringIndices) {
+                    DataType type = candidates[c % 3];
+                    c /= 3;
+
+                    size_t length = command.parameters[index].byteCount();
+                    if(type != StringVar and length > dataTypeSize(type)) {
+                        fits = false;
+                        break;
+                    }
+
+                    total += type == StringVar ? 2 + length : 1 + dataTypeSize(type);
+                }
+
+                if(fits and total == available) {
+                    c = combination;
+
+                    for(size_t index : stringIndices) {
+                        command.parameters[index] = asStringType(command.parameters[index], candidates[c % 3]);
+                        c /= 3;
+                    }
+
+                    return;
+                }
+            }
+
+            for(size_t index : stringIndices) {
+                size_t length = command.parameters[index].byteCount();
+                DataType type = length <= 8 ? String8 : length <= 16 ? String16 : StringVar;
+
+                command.parameters[index] = asStringType(command.parameters[index], type);
+            }
+        }
+
+        // Whether parameter 'index' of the command holds a script offset.
+        static bool isLabelParam(const DecompilerContext &context, const Command &command, size_t index) {
+            if(index == 0 and Goto::isJumpOpcode(command.opcode)) return true;
+
+            uint32_t mask = context.get(command.opcode).labelMask;
+            return index < 32 and (mask & (1u << index));
+        }
+
+    public:
+        // Parses text IR ('offset:opcode[params]' per line). On failure, 'error' describes the bad line.
+        static bool parseTextIR(std::string_view text, std::vector<Command> &commands, std::string &error) {
+            size_t lineNumber = 0;
+
+            while(not text.empty()) {
+                auto lineEnd = text.find('\n');
+                std::string_view line = text.substr(0, lineEnd);
+                text.remove_prefix(lineEnd == std::string_view::npos ? text.size() : lineEnd + 1);
+                ++lineNumber;
+
+                if(not line.empty() and line.back() == '\r') line.remove_suffix(1);
+                if(line.empty()) continue;
+
+                auto colon = line.find(':');
+                auto open = line.find('[');
+
+                Command command;
+                if(colon == std::string_view::npos or open == std::string_view::npos or open < colon or line.back() != ']'
+                   or not parseNumber(line.substr(0, colon), command.offset)
+                   or not parseNumber(line.substr(colon + 1, open - colon - 1), command.opcode)) {
+                    error = "line " + std::to_string(lineNumber) + ": expected 'offset:opcode[params]'";
+                    return false;
+                }
+
+                std::string_view params = line.substr(open + 1, line.size() - open - 2);
+
+                while(not params.empty()) {
+                    size_t end;
+
+                    if(params.front() == '\'') {
+                        // Strings can contain commas, so find the quote that ends this parameter.
+                        end = 1;
+                        while(true) {
+                            end = params.find('\'', end);
+                            if(end == std::string_view::npos or end + 1 == params.size() or params[end + 1] == ',') break;
+                            ++end;
+                        }
+
+                        end = end == std::string_view::npos ? params.size() : end + 1;
+                    } else {
+                        end = std::min(params.find(','), params.size());
+                    }
+
+                    Value value;
+                    if(not parseParam(params.substr(0, end), value)) {
+                        error = "line " + std::to_string(lineNumber) + ": bad parameter '" + std::string(params.substr(0, end)) + "'";
+                        return false;
+                    }
+
+                    if(value.type == StringVar and value.byteCount() > max_string_var_length) {
+                        error = "line " + std::to_string(lineNumber) + ": string is " + std::to_string(value.byteCount())
+                                + " bytes long (the limit is " + std::to_string(max_string_var_length) + ")";
+                        return false;
+                    }
+
+                    command.parameters.push_back(value);
+                    params.remove_prefix(std::min(end + 1, params.size()));
+                }
+
+                commands.push_back(std::move(command));
+            }
+
+            // Work out the string types now that the offset of every command is known.
+            for(size_t i = 0; i < commands.size(); ++i) {
+                size_t available = 0;
+
+                if(i + 1 < commands.size() and commands[i + 1].offset > commands[i].offset) {
+                    available = commands[i + 1].offset - commands[i].offset;
+                }
+
+                resolveStringTypes(commands[i], available);
+            }
+
+            return true;
+        }
+
+        static bool parseBinaryIR(const uint8_t *data, size_t size, std::vector<Command> &commands, size_t &sourceSize, std::string &error) {
+            BinaryIRReader reader(data, size);
+            if(not reader.valid()) {
+                error = "not a valid binary IR file (or an unsupported version)";
+                return false;
+            }
+
+            sourceSize = reader.header().sourceSize;
+
+            if(reader.header().recordCount != ir_size_unknown) {
+                commands.reserve(reader.header().recordCount);
+            }
+
+            BinaryIRRecord record;
+            while(reader.next(record)) {
+                Command command;
+                command.offset = record.offset;
+                command.opcode = record.opcode;
+                command.parameters.reserve(record.paramCount);
+
+                for(size_t i = 0; i < record.paramCount; ++i) {
+                    const BinaryIRParam &param = record.params[i];
+
+                    if(param.type == StringVar and param.size > max_string_var_length) {
+                        error = "the string at offset " + std::to_string(record.offset) + " is " + std::to_string(param.size)
+                                + " bytes long (the limit is " + std::to_string(max_string_var_length) + ")";
+                        return false;
+                    }
+
+                    command.parameters.emplace_back(param.type, (uint8_t *)param.data, param.size);
+                }
+
+                commands.push_back(std::move(command));
+            }
+
+            if(reader.header().recordCount != ir_size_unknown and commands.size() != reader.header().recordCount) {
+                error = "binary IR is truncated or malformed after " + std::to_string(commands.size()) + " records";
+                return false;
+            }
+
+            return true;
+        }
+
+        static void encodeCommand(const Command &command, std::vector<uint8_t> &out) {
+            appendLE<uint16_t>(out, command.opcode);
+
+            for(const Value &param : command.parameters) {
+                // Undecoded bytes are written back without a type tag.
+                if(param.type != RawBytes) out.push_back(param.type);
+
+                if(param.type == StringVar) {
+                    out.push_back(uint8_t(param.byteCount()));
+                }
+
+                out.insert(out.end(), param.getBytes(), param.getBytes() + param.byteCount());
+            }
+        }
+
+        // Assembles the commands into bytecode.
+        // If 'preserveOffsets' is set, each command is placed at its original offset (with NOPs filling any
+        //  gaps) and the output is padded to 'sourceSize', so no relocation is needed. Otherwise the commands are
+        //  packed together and every label is relocated. 'unresolvedLabels' counts labels that did not point at
+        //  the start of a command and were left as they were. With 'optimizeJumps', chains of jumps are bypassed
+        //  before packing. Label parameters are found from the opcodes in 'context'.
+        static std::vector<uint8_t> assemble(std::vector<Command> &commands, bool preserveOffsets, size_t sourceSize, size_t &unresolvedLabels,
+                                             bool optimizeJumps = false, const DecompilerContext &context = DecompilerContext::shared()) {
+            unresolvedLabels = 0;
+
+            std::vector<uint8_t> out;
+            out.reserve(std::max(sourceSize, commands.size() * 8));
+
+            if(preserveOffsets) {
+                for(const Command &command : commands) {
+                    if(command.offset >= 0 and size_t(command.offset) > out.size()) {
+                        out.resize(command.offset, 0);
+                    }
+
+                    encodeCommand(command, out);
+                }
+
+                if(out.size() < sourceSize) out.resize(sourceSize, 0);
+                return out;
+            }
+
+            if(optimizeJumps) {
+                // Jump optimisation needs the script's jump information.
+                Script script;
+                script.context = &context;
+                script.options.optimizeJumps = true;
+                script.commands = std::move(commands);
+
+                for(size_t i = 0; i < script.commands.size(); ++i) {
+                    script.offsetsToIndices[script.commands[i].offset] = i;
+
+                    if(Goto::isJump(script.commands[i])) {
+                        script.addJump(Goto(script.commands[i]));
+                    }
+                }
+
+                script.optimizeScript();
+                commands = std::move(script.commands);
+            }
+
+            // Every parameter has a fixed encoded size regardless of its value, so the new offsets can be
+            //  worked out before anything is relocated.
+            std::unordered_map<int32_t, int32_t> newOffsets;
+            newOffsets.reserve(commands.size());
+
+            int32_t offset = 0;
+            for(const Command &command : commands) {
+                newOffsets.emplace(command.offset, offset);
+
+                offset += 2;
+                for(const Value &param : command.parameters) {
+                    offset += encodedSize(param);
+                }
+            }
+
+            for(Command &command : commands) {
+                for(size_t i = 0; i < command.parameters.size(); ++i) {
+                    Value &param = command.parameters[i];
+                    if(param.type != S32 or not isLabelParam(context, command, i)) continue;
+
+                    // Negative offsets are relative to the start of a mission script.
+                    int32_t target = param.cast<int32_t>();
+                    auto found = newOffsets.find(std::abs(target));
+
+                    if(found == newOffsets.end()) {
+                        ++unresolvedLabels;
+                        continue;
+                    }
+
+                    int32_t relocated = target < 0 ? -found->second : found->second;
+                    param = Value(S32, (uint8_t *)&relocated, sizeof(relocated));
+                }
+
+                encodeCommand(command, out);
+            }
+
+            return out;
+        }
+    };
+}
+
+#endif //GTASM_ASSEMBLER_HPP
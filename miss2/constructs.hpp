@@ -8,8 +8,14 @@
 
 #include <vector>
 #include <map>
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include <cstdio>
 #include "opcodes.hpp"
+#include "interner.hpp"
 #include "../highlighting.hpp"
+#include "../simd.hpp"
 
 namespace miss2 {
     enum DataType : uint8_t {
@@ -38,9 +44,18 @@ namespace miss2 {
         LocalString16Arr = 0x13,
 
         // Placeholder for until the decompiler knows the type.
-        Unknown
+        Unknown,
+
+        // Not a real type tag. Holds the bytes between an instruction that couldn't be decoded and the next
+        //  one (see resync.hpp), which are written back as they are, without a tag.
+        RawBytes = 0xFF
     };
 
+    // Whether a byte can be the type tag of a parameter in compiled code.
+    inline bool isValidTypeTag(uint8_t tag) {
+        return tag < Unknown;
+    }
+
     inline bool isArrayType(DataType t) {
         return t == GlobalIntFloatArr
             or t == LocalIntFloatArr
@@ -50,6 +65,13 @@ namespace miss2 {
             or t == GlobalString16Arr;
     }
 
+    // True for the scalar global variable types (the ones Script::createGlobals() collects).
+    inline bool isGlobalVarType(DataType t) {
+        return t == GlobalIntFloat
+            or t == GlobalString8
+            or t == GlobalString16;
+    }
+
     struct Value {
     private:
         //uint8_t *bytes = nullptr;
@@ -83,6 +105,15 @@ namespace miss2 {
             return bytes.data();
         }
 
+        const uint8_t *getBytes() const {
+            return bytes.data();
+        }
+
+        // The number of bytes actually stored (may differ from 'size' for types without a fixed size).
+        size_t byteCount() const {
+            return bytes.size();
+        }
+
         uint32_t sumBytes() {
             uint32_t sum {};
             for(uint8_t &b : bytes) sum += b;
@@ -122,12 +153,15 @@ namespace miss2 {
 
             std::string elementTypeStr() {
                 static std::string strs[] = {"Int", "Float", "Char8", "Char16"};
+
+                // Misdecoded parameters can have any value here.
+                if(elementType > TextLabel16) return "Unknown";
                 return strs[elementType];
             }
         } __attribute__((packed)) properties;
     } __attribute__((packed));
 
-    std::string valueToString(Value &value) {
+    inline std::string valueToString(Value &value) {
         switch(value.type) {
             case EOAL:
                 return "end";
@@ -154,11 +188,9 @@ namespace miss2 {
                 return "[" + std::to_string(arr.arrayIndex) + "]";
             }
             case String8: {
-                // Copy to another buffer to get rid of any junk in the string.
-                char dest[8];
-                std::strncpy(dest, (char *)value.getBytes(), 8);
-
-                return "'" + std::string(dest) + "'";
+                // Anything after the terminator is junk. The field isn't always terminated.
+                const uint8_t *bytes = value.getBytes();
+                return "'" + std::string((const char *)bytes, simd::nulLength8(bytes)) + "'";
             }
             case GlobalString8:
                 return std::to_string(value.cast<uint16_t>());
@@ -188,13 +220,15 @@ namespace miss2 {
                 return "<local string16 array>";
             case Unknown:
                 return "<unknown>";
+            case RawBytes:
+                return "<" + std::to_string(value.byteCount()) + " undecoded bytes>";
         }
 
         // Hopefully we never get here...
         return "<unknown type>";
     }
 
-    std::string primitiveVtoS(Value &value) {
+    inline std::string primitiveVtoS(Value &value) {
         switch(value.type) {
             case EOAL:
                 return "E";
@@ -229,11 +263,9 @@ namespace miss2 {
                 return "X" + (stream.str().empty() ? "!" : stream.str().substr(1));
             }
             case String8: {
-                // Copy to another buffer to get rid of any junk in the string.
-                char dest[8];
-                std::strncpy(dest, (char *)value.getBytes(), 8);
-
-                return "'" + std::string(dest) + "'";
+                // Stop at the terminator to get rid of any junk in the string (there may not be one).
+                const uint8_t *bytes = value.getBytes();
+                return "'" + std::string((const char *)bytes, simd::nulLength8(bytes)) + "'";
             }
 
             case GlobalString8:
@@ -294,13 +326,24 @@ namespace miss2 {
             }
             case Unknown:
                 return "U!";
+            case RawBytes: {
+                static const char digits[] = "0123456789abcdef";
+
+                std::string text = "H";
+                for(size_t i = 0; i < value.byteCount(); ++i) {
+                    text += digits[value.getBytes()[i] >> 4];
+                    text += digits[value.getBytes()[i] & 0xF];
+                }
+
+                return text;
+            }
         }
 
         // Hopefully we never get here...
         return "<unknown type>";
     }
 
-    std::string dataTypeName(DataType type) {
+    inline std::string dataTypeName(DataType type) {
         switch(type) {
             case EOAL:
                 return "<null type>";
@@ -344,14 +387,17 @@ namespace miss2 {
                 return "LChar16Arr";
             case Unknown:
                 return "<unknown type>";
+            case RawBytes:
+                return "<raw bytes>";
         }
 
         // Hopefully we never get here...
         return "<unknown type>";
     }
 
-    size_t getValueSize(Value &value) {
-        switch(value.type) {
+    // The encoded size of a value of the given type, or 0 if the size is not implied by the type.
+    inline size_t dataTypeSize(DataType type) {
+        switch(type) {
             case EOAL:
                 return 0;
             case S32:
@@ -393,27 +439,54 @@ namespace miss2 {
             case LocalString16Arr:
                 return 6;
             case Unknown:
+            case RawBytes:
                 return 0;
         }
 
         return 0;
     }
 
-    struct Command {
-    private:
-        static std::map<uint16_t, Command> knownCommands;
-        static Command nullCommand;
+    inline size_t getValueSize(Value &value) {
+        return dataTypeSize(value.type);
+    }
 
-    public:
-        std::string name;
+    // What the decoder needs to know to find the end of an instruction without building a Command.
+    struct OpcodeShape {
+        bool known = false;
+
+        // Takes any number of extra parameters after the fixed ones, ended by an EOAL tag.
+        bool variadic = false;
+
+        uint8_t paramCount = 0;
+    };
+
+    struct Command {
+        // Interned in the DecompilerContext the opcode is registered with (or the interner given to create()),
+        //  so copying a command (as every decoded instruction does) doesn't copy its name.
+        std::string_view name;
         uint16_t opcode;
         int32_t offset = -1;
         std::vector<Value> parameters;
         size_t scriptIndex;
 
-        static std::pair<uint16_t, Command> create(string_ref mn, uint16_t op, const std::vector<Value> &types = {}) {
+        // Bit i is set if parameter i is a label (a script offset), so it has to be relocated when assembling.
+        uint32_t labelMask {};
+
+        // Bit i is set if parameter i is a model ID.
+        uint32_t modelMask {};
+
+        // Set for opcodes defined with a parameter count of -1. Any parameters after the ones in the name are
+        //  read up to and including an EOAL tag.
+        bool variadic = false;
+
+        // The most extra parameters read for a variadic opcode before giving up on finding the EOAL tag.
+        static constexpr size_t max_variadic_params = 32;
+
+        // The name is kept in 'names', which must outlive the command.
+        static std::pair<uint16_t, Command> create(StringInterner &names, string_ref mn, uint16_t op,
+                                                   const std::vector<Value> &types = {}) {
             Command instr;
-            instr.name = mn;
+            instr.name = names.internView(mn);
             instr.opcode = op;
             instr.parameters = types;
 
@@ -427,94 +500,38 @@ namespace miss2 {
             return not name.empty();
         }
 
-        static Command &get(uint16_t op) {
-            auto iter = knownCommands.find(op);
-
-            if(iter != knownCommands.end()) {
-                return iter->second;
-            }
-
-            return nullCommand;
-        }
-
         /*
          * The offset of this command UNLESS the command is an unconditional jump,
          * in which case the jumped-to command's offset is returned.
          */
         int32_t effectiveOffset() {
-            if(opcode == miss2::Opcode::Jump) return parameters[0].cast<int32_t>();
+            if(opcode == miss2::Opcode::Jump and not parameters.empty()) return parameters[0].cast<int32_t>();
 
             return offset;
         }
+    };
 
-        static Command read(uint8_t *&scriptPointer) {
-            uint16_t opcode = *(uint16_t *)scriptPointer;
-            scriptPointer += 2;
-
-            Command foundCommand = get(opcode);
-            if(not foundCommand) {
-                foundCommand.opcode = opcode;
-
-                // Try to read the arguments. Max 40 bytes so we don't get stuck.
-                //uint8_t *ptrBackup = scriptPointer;
-                //
-                //bool broken = false;
-                //for(int i = 0; i < 40; ++i) {
-                //    if(get(*(uint16_t *)scriptPointer)) {
-                //        broken = true;
-                //        break;
-                //    }
-                //
-                //    Value paramValue = Value((DataType)*scriptPointer);
-                //
-                //    auto expectedSize = getValueSize(paramValue);
-                //    paramValue.setBytes(scriptPointer, expectedSize);
-                //
-                //    scriptPointer += expectedSize;
-                //}
-                //
-                //if(not broken) {
-                //    // Got nowhere, so restore the pointer.
-                //    scriptPointer = ptrBackup;
-                //}
-
-                return foundCommand;
-            }
-
-            // Get a reference so we can update parameter types.
-            Command &commandRef = get(opcode);
-
-            int pIndex = 0;
-            for(Value &param : foundCommand.parameters) {
-                param.type = (DataType)*(scriptPointer++);
-                commandRef.parameters[pIndex++].type = param.type;
-
-                if(param.type != Unknown and param.type != EOAL) {
-                    param.size = getValueSize(param);
-                }
+    // The outcome of decoding a buffer. If the last instruction runs past the end of the buffer, decoding
+    //  stops there and the instruction is described here instead of being decoded.
+    struct DecodeResult {
+        bool truncated = false;
 
-                if(param.type == StringVar) {
-                    param.size = *(scriptPointer++);
-                }
+        // Where the truncated instruction starts.
+        size_t offset = 0;
+        uint16_t opcode = 0;
 
-                if(param.size) {
-                    param.setBytes(new uint8_t[param.size], param.size);
-                    for(int i = 0; i < param.size; ++i) {
-                        param.getBytes()[i] = *(scriptPointer++);
-                    }
-                }
-            }
+        // How many bytes the instruction needs, and how many were left.
+        size_t length = 0;
+        size_t available = 0;
 
-            return foundCommand;
-        }
+        std::string message() const {
+            char text[128];
+            std::snprintf(text, sizeof(text), "instruction %04x at offset %zu needs %zu bytes but only %zu remain",
+                          opcode, offset, length, available);
 
-        static void registerOpcode(uint16_t opcode, const Command &cmd) {
-            knownCommands[opcode] = cmd;
+            return text;
         }
     };
-
-    Command Command::nullCommand {};
-    std::map<uint16_t, Command> Command::knownCommands {};
 }
 
 #endif //GTASM_CONSTRUCTS_HPP
@@ -10,7 +10,7 @@
 #include <vector>
 #include "constructs.hpp"
 #include "opcodes.hpp"
-#include "../game/gtasa.hpp"
+#include "../game/ids.hpp"
 //#include "script.hpp"
 
 namespace miss2 {
@@ -93,6 +93,12 @@ namespace miss2 {
             return opcode == Opcode::Jump or opcode == Opcode::JumpIfFalse or opcode == Opcode::Call;
         }
 
+        // Whether the command is a jump that can be followed. Bytes that couldn't be decoded (see resync.hpp)
+        //  can start with a jump opcode but have no target.
+        static bool isJump(const Command &command) {
+            return isJumpOpcode(command.opcode) and not command.parameters.empty() and command.parameters[0].type == S32;
+        }
+
         Goto(Command jumpCommand) {
             if(not isJumpOpcode(jumpCommand.opcode)) {
                 std::cerr << "error: cannnot create Goto from non-jump instruction\n";
@@ -112,13 +118,15 @@ namespace miss2 {
         // Final return.
         size_t endOffset;
 
-        std::string name;
+        // "proc_<offset>", interned in the script's symbols.
+        SymbolID name = no_symbol;
     };
 
     struct Label {
         int32_t offset;
 
-        std::string name;
+        // "label_<offset>", interned in the script's symbols.
+        SymbolID name = no_symbol;
     };
 
     struct GlobalVar {
@@ -128,6 +136,9 @@ namespace miss2 {
         DataType valueType;
 
         uint16_t offset;
+
+        // "g<type>_<offset>", interned in the script's symbols once the value type is known.
+        SymbolID name = no_symbol;
     };
 
     struct OffsetRange {
@@ -191,15 +202,18 @@ namespace miss2 {
         OffsetRange setupRange, checkRange, incRange, jumpRange;
     };
 
-    // Compilation
-    static bool optimize_jumps = false;
-
-    // Decompilation
-    static int indent_size = 4;
-    static bool optimize_decompile = false; // Perform *some* optimisation to decompiled code (may decrease readability).
-    static bool clean_decompile = false; // Remove dead code.
-    static bool show_if_jumps = false; // Show jump_if_false calls for decompiled if statements.
-    static int error_limit = 10; // Number of consecutive errors required for decompilation to stop.
+    // Decompilation. Each script has its own copy, so scripts decompiled at the same time can use different
+    //  options.
+    struct DecompileOptions {
+        int indentSize = 4;
+        bool optimize = false; // Perform *some* optimisation to decompiled code (may decrease readability).
+        bool clean = false; // Remove dead code.
+        bool showIfJumps = false; // Show jump_if_false calls for decompiled if statements.
+        int errorLimit = 10; // Number of consecutive errors required for decompilation to stop.
+
+        // Compilation
+        bool optimizeJumps = false; // Bypass chains of jumps.
+    };
 }
 
 #endif //GTASM_CONTEXT_HPP
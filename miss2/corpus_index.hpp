@@ -0,0 +1,645 @@
+/*
+ * A persistent inverted index over a corpus of scripts. For every opcode, global variable, model ID
+ *  and String8 label, the index holds the list of places (script and offset) where it is used.
+ *
+ * File layout (all integers little-endian, every section 8-byte aligned):
+ *
+ *   IndexHeader
+ *   IndexScriptEntry[scriptCount]   path, modification time and size of each indexed script
+ *   IndexKeyEntry[keyCount]         sorted by (kind, value), so a key is found with a binary search
+ *   posting lists                   one per key, delta-encoded as LEB128 varints
+ *   script paths
+ *
+ * The file is memory-mapped and used in place; only the posting list that is asked for is decoded.
+ *
+ * Updating an index only decodes scripts that are new or whose size or modification time has changed. The
+ *  postings for the other scripts are copied from the old index.
+ */
+
+#ifndef GTASM_CORPUS_INDEX_HPP
+#define GTASM_CORPUS_INDEX_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <charconv>
+#include <cctype>
+#include <unordered_map>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <mutex>
+#include "opcode_table.hpp"
+#include "ir.hpp"
+#include "../work_stealing.hpp"
+#include "../util.hpp"
+
+namespace miss2 {
+    enum class IndexKind : uint8_t {
+        Opcode = 0,
+        Global = 1,
+        Model = 2,
+        Label = 3,
+    };
+
+    struct IndexKey {
+        IndexKind kind;
+        uint64_t value;
+
+        auto operator<=>(const IndexKey &) const = default;
+
+        // Negated opcodes are indexed under the plain opcode.
+        static IndexKey opcode(uint16_t op) {
+            return { IndexKind::Opcode, uint64_t(op & 0x7FFF) };
+        }
+
+        static IndexKey global(uint64_t offset) {
+            return { IndexKind::Global, offset };
+        }
+
+        static IndexKey model(int64_t id) {
+            return { IndexKind::Model, uint64_t(id) };
+        }
+
+        // Labels are packed into the value (up to eight characters, uppercased), so they need no string table.
+        static IndexKey label(std::string_view text) {
+            uint64_t packed = 0;
+
+            for(size_t i = 0; i < std::min<size_t>(text.size(), 8); ++i) {
+                packed |= uint64_t(uint8_t(std::toupper((unsigned char)text[i]))) << (i * 8);
+            }
+
+            return { IndexKind::Label, packed };
+        }
+
+        std::string labelText() const {
+            std::string text;
+
+            for(size_t i = 0; i < 8 and (value >> (i * 8)) & 0xFF; ++i) {
+                text += char((value >> (i * 8)) & 0xFF);
+            }
+
+            return text;
+        }
+    };
+
+    struct IndexPosting {
+        uint32_t script;
+        uint32_t offset;
+
+        auto operator<=>(const IndexPosting &) const = default;
+    };
+
+    struct IndexHeader {
+        char magic[4];
+        uint32_t version;
+
+        // Postings depend on the parameter counts in the opcode database, so an index built with a different
+        //  database is rebuilt from scratch.
+        uint64_t opcodeFingerprint;
+
+        uint32_t scriptCount;
+        uint32_t keyCount;
+
+        uint64_t scriptTableOffset;
+        uint64_t keyTableOffset;
+        uint64_t postingsOffset;
+        uint64_t pathsOffset;
+        uint64_t fileSize;
+    };
+
+    struct IndexScriptEntry {
+        uint64_t pathOffset;
+        uint32_t pathLength;
+        uint32_t reserved;
+        int64_t modifiedTime;
+        uint64_t size;
+    };
+
+    struct IndexKeyEntry {
+        uint64_t value;
+        uint8_t kind;
+        uint8_t reserved[3];
+        uint32_t count;
+        uint64_t postingsOffset;
+        uint64_t postingsSize;
+    };
+
+    static_assert(sizeof(IndexHeader) == 64);
+    static_assert(sizeof(IndexScriptEntry) == 32);
+    static_assert(sizeof(IndexKeyEntry) == 32);
+
+    static const char index_magic[4] = { 'G', 'T', 'I', 'X' };
+    static const uint32_t index_version = 1;
+
+    // Identifies the opcode database that an index was built with.
+    inline uint64_t opcodeFingerprint(const OpcodeTable &table) {
+        uint64_t hash = 0xcbf29ce484222325ull;
+
+        for(const OpcodeShape &shape : table.shapes) {
+            uint8_t bits = (shape.known ? 1 : 0) | (shape.variadic ? 2 : 0);
+
+            hash = (hash ^ bits) * 0x100000001b3ull;
+            hash = (hash ^ shape.paramCount) * 0x100000001b3ull;
+        }
+
+        // Which parameters are models decides what is indexed too.
+        for(uint32_t mask : table.modelMasks) {
+            hash = (hash ^ mask) * 0x100000001b3ull;
+        }
+
+        return hash;
+    }
+
+    // Modification time of a file, or 0 if it can't be read.
+    inline int64_t fileModifiedTime(const std::string &path) {
+        std::error_code error;
+        auto time = std::filesystem::last_write_time(path, error);
+
+        return error ? 0 : int64_t(time.time_since_epoch().count());
+    }
+
+    // Appends (key, offset) pairs for everything in one script that the index records.
+    inline void collectIndexEntries(const OpcodeTable &table, const uint8_t *bytes, size_t size,
+                                    std::vector<std::pair<IndexKey, uint32_t>> &entries) {
+        FlatDecoder decoder(table, bytes, size);
+        FlatInstruction instruction;
+
+        while(decoder.next(instruction)) {
+            uint32_t offset = instruction.offset;
+            entries.push_back({ IndexKey::opcode(instruction.opcode), offset });
+
+            uint32_t modelMask = table.modelMasks[instruction.opcode];
+
+            for(int i = 0; i < instruction.paramCount; ++i) {
+                const FlatParam &param = instruction.params[i];
+
+                if(isGlobalVarType(param.type)) {
+                    entries.push_back({ IndexKey::global(param.integer()), offset });
+                } else if(param.type == String8) {
+                    auto text = param.text();
+                    if(not text.empty()) entries.push_back({ IndexKey::label(text), offset });
+                } else if(i < 32 and (modelMask >> i) & 1 and param.isInteger()) {
+                    entries.push_back({ IndexKey::model(param.integer()), offset });
+                }
+            }
+        }
+    }
+
+    class CorpusIndex {
+        MappedFile file;
+
+        const IndexHeader *header = nullptr;
+        const IndexScriptEntry *scripts = nullptr;
+        const IndexKeyEntry *keys = nullptr;
+
+        template <typename T>
+        bool sectionFits(uint64_t offset, uint64_t count) const {
+            return offset % 8 == 0 and offset <= file.size and count <= (file.size - offset) / sizeof(T);
+        }
+
+    public:
+        // Maps an index file and checks that its sections are in bounds. Returns false (and writes a message
+        //  to 'log') if the file is missing, damaged or from a different version.
+        bool open(const std::string &path, std::ostream &log = std::cerr) {
+            file = MappedFile(path.c_str());
+            header = nullptr;
+
+            if(not file) {
+                log << "error: could not read index " << path << '\n';
+                return false;
+            }
+
+            auto candidate = (const IndexHeader *)file.data;
+
+            if(file.size < sizeof(IndexHeader) or std::memcmp(candidate->magic, index_magic, 4) != 0) {
+                log << "error: " << path << " is not an index file\n";
+                return false;
+            }
+
+            if(candidate->version != index_version) {
+                log << "error: " << path << " is index version " << candidate->version << " (expected "
+                    << index_version << ")\n";
+                return false;
+            }
+
+            if(candidate->fileSize != file.size
+                or not sectionFits<IndexScriptEntry>(candidate->scriptTableOffset, candidate->scriptCount)
+                or not sectionFits<IndexKeyEntry>(candidate->keyTableOffset, candidate->keyCount)
+                or candidate->postingsOffset > file.size
+                or candidate->pathsOffset > file.size) {
+                log << "error: index " << path << " is damaged\n";
+                return false;
+            }
+
+            header = candidate;
+            scripts = (const IndexScriptEntry *)(file.data + header->scriptTableOffset);
+            keys = (const IndexKeyEntry *)(file.data + header->keyTableOffset);
+
+            return true;
+        }
+
+        operator bool() const {
+            return header != nullptr;
+        }
+
+        uint64_t fingerprint() const {
+            return header->opcodeFingerprint;
+        }
+
+        size_t scriptCount() const {
+            return header->scriptCount;
+        }
+
+        size_t keyCount() const {
+            return header->keyCount;
+        }
+
+        const IndexScriptEntry &script(size_t id) const {
+            return scripts[id];
+        }
+
+        std::string_view scriptPath(size_t id) const {
+            const IndexScriptEntry &entry = scripts[id];
+
+            uint64_t begin = header->pathsOffset + entry.pathOffset;
+            if(begin > file.size or entry.pathLength > file.size - begin) return {};
+
+            return { (const char *)file.data + begin, entry.pathLength };
+        }
+
+        const IndexKeyEntry *keyBegin() const {
+            return keys;
+        }
+
+        const IndexKeyEntry *keyEnd() const {
+            return keys + header->keyCount;
+        }
+
+        // The directory entry for a key, or null if nothing uses it.
+        const IndexKeyEntry *find(IndexKey key) const {
+            auto entry = std::lower_bound(keyBegin(), keyEnd(), key, [](const IndexKeyEntry &entry, IndexKey key) {
+                return IndexKey { IndexKind(entry.kind), entry.value } < key;
+            });
+
+            if(entry == keyEnd() or entry->kind != uint8_t(key.kind) or entry->value != key.value) {
+                return nullptr;
+            }
+
+            return entry;
+        }
+
+        // Decodes the posting list of a directory entry, in (script, offset) order.
+        bool postings(const IndexKeyEntry &entry, std::vector<IndexPosting> &out) const {
+            uint64_t begin = header->postingsOffset + entry.postingsOffset;
+            if(begin > file.size or entry.postingsSize > file.size - begin) return false;
+
+            const uint8_t *p = file.data + begin;
+            const uint8_t *end = p + entry.postingsSize;
+
+            uint64_t script = 0, offset = 0;
+            out.reserve(out.size() + entry.count);
+
+            for(uint32_t i = 0; i < entry.count; ++i) {
+                uint64_t scriptDelta, offsetValue;
+
+                if(not readVarint(p, end, scriptDelta) or not readVarint(p, end, offsetValue)) {
+                    return false;
+                }
+
+                // The offset is relative to the previous posting only when it is in the same script.
+                script += scriptDelta;
+                offset = (scriptDelta == 0 and i != 0) ? offset + offsetValue : offsetValue;
+
+                if(script >= header->scriptCount) return false;
+                out.push_back({ uint32_t(script), uint32_t(offset) });
+            }
+
+            return true;
+        }
+
+        bool lookup(IndexKey key, std::vector<IndexPosting> &out) const {
+            const IndexKeyEntry *entry = find(key);
+            return not entry or postings(*entry, out);
+        }
+    };
+
+    struct IndexUpdateSummary {
+        size_t scripts = 0;
+        size_t scanned = 0;
+        size_t reused = 0;
+        size_t removed = 0;
+        size_t keys = 0;
+        size_t postings = 0;
+    };
+
+    namespace index_detail {
+        struct FlatPosting {
+            IndexKey key;
+            IndexPosting posting;
+
+            auto operator<=>(const FlatPosting &) const = default;
+        };
+
+        inline void align(std::vector<uint8_t> &out) {
+            out.resize((out.size() + 7) & ~size_t(7), 0);
+        }
+    }
+
+    // Builds or updates the index at 'indexPath' so it covers exactly 'scriptPaths'. Scripts that haven't
+    //  changed since the existing index was written aren't decoded again. The new index is written to a
+    //  temporary file and renamed over the old one, so readers never see a partial index.
+    inline bool updateCorpusIndex(const std::string &indexPath, const std::vector<std::string> &scriptPaths,
+                                  const OpcodeTable &table, IndexUpdateSummary &summary, WorkStealingPool &pool,
+                                  std::ostream &log = std::cerr) {
+        using index_detail::FlatPosting;
+
+        summary = {};
+        summary.scripts = scriptPaths.size();
+
+        uint64_t fingerprint = opcodeFingerprint(table);
+
+        struct ScriptInfo {
+            int64_t modifiedTime = 0;
+            uint64_t size = 0;
+
+            // The script's id in the old index, if it can be reused.
+            int64_t oldId = -1;
+        };
+
+        std::vector<ScriptInfo> infos(scriptPaths.size());
+
+        for(size_t i = 0; i < scriptPaths.size(); ++i) {
+            std::error_code error;
+            auto size = std::filesystem::file_size(scriptPaths[i], error);
+
+            infos[i].modifiedTime = fileModifiedTime(scriptPaths[i]);
+            infos[i].size = error ? 0 : size;
+        }
+
+        std::vector<FlatPosting> postings;
+
+        // Carry over the postings of unchanged scripts. A missing or unusable old index just means that
+        //  everything is scanned.
+        CorpusIndex old;
+        std::error_code existsError;
+
+        if(std::filesystem::exists(indexPath, existsError) and old.open(indexPath, log) and old.fingerprint() == fingerprint) {
+            std::unordered_map<std::string_view, size_t> newIds;
+            for(size_t i = 0; i < scriptPaths.size(); ++i) newIds[scriptPaths[i]] = i;
+
+            std::vector<int64_t> oldToNew(old.scriptCount(), -1);
+
+            for(size_t id = 0; id < old.scriptCount(); ++id) {
+                auto found = newIds.find(old.scriptPath(id));
+
+                if(found == newIds.end()) {
+                    ++summary.removed;
+                    continue;
+                }
+
+                const IndexScriptEntry &entry = old.script(id);
+                ScriptInfo &info = infos[found->second];
+
+                if(info.oldId < 0 and entry.modifiedTime == info.modifiedTime and entry.size == info.size) {
+                    info.oldId = int64_t(id);
+                    oldToNew[id] = int64_t(found->second);
+                }
+            }
+
+            std::vector<IndexPosting> list;
+
+            for(auto entry = old.keyBegin(); entry != old.keyEnd(); ++entry) {
+                list.clear();
+
+                if(not old.postings(*entry, list)) {
+                    log << "error: index " << indexPath << " is damaged; rebuilding it\n";
+
+                    postings.clear();
+                    for(ScriptInfo &info : infos) info.oldId = -1;
+
+                    break;
+                }
+
+                IndexKey key { IndexKind(entry->kind), entry->value };
+
+                for(const IndexPosting &posting : list) {
+                    int64_t newId = oldToNew[posting.script];
+                    if(newId >= 0) postings.push_back({ key, { uint32_t(newId), posting.offset } });
+                }
+            }
+        }
+
+        // Decode the new and changed scripts in parallel, biggest first.
+        std::vector<std::vector<std::pair<IndexKey, uint32_t>>> scanned(scriptPaths.size());
+        std::vector<size_t> toScan;
+        std::vector<std::string> toScanPaths;
+
+        for(size_t i = 0; i < scriptPaths.size(); ++i) {
+            if(infos[i].oldId >= 0) {
+                ++summary.reused;
+                continue;
+            }
+
+            ++summary.scanned;
+
+            toScan.push_back(i);
+            toScanPaths.push_back(scriptPaths[i]);
+        }
+
+        // The log is shared by the workers.
+        std::mutex logLock;
+
+        forEachFileLargestFirst(pool, toScanPaths, [&](size_t j) {
+            size_t i = toScan[j];
+            MappedFile file(scriptPaths[i].c_str());
+
+            if(not file) {
+                if(infos[i].size != 0) {
+                    std::lock_guard<std::mutex> guard(logLock);
+                    log << "error: could not read " << scriptPaths[i] << '\n';
+                }
+
+                return;
+            }
+
+            collectIndexEntries(table, file.data, file.size, scanned[i]);
+        });
+
+        for(size_t i = 0; i < scanned.size(); ++i) {
+            for(auto &[key, offset] : scanned[i]) {
+                postings.push_back({ key, { uint32_t(i), offset } });
+            }
+        }
+
+        scanned.clear();
+
+        // An instruction that uses the same global (for example) twice is only listed once.
+        std::sort(postings.begin(), postings.end());
+        postings.erase(std::unique(postings.begin(), postings.end()), postings.end());
+
+        // Encode the posting lists and the key directory.
+        std::vector<uint8_t> encoded;
+        std::vector<IndexKeyEntry> keyEntries;
+
+        for(size_t start = 0; start < postings.size();) {
+            size_t end = start;
+            while(end < postings.size() and postings[end].key == postings[start].key) ++end;
+
+            IndexKeyEntry entry {};
+            entry.kind = uint8_t(postings[start].key.kind);
+            entry.value = postings[start].key.value;
+            entry.count = uint32_t(end - start);
+            entry.postingsOffset = encoded.size();
+
+            IndexPosting previous { 0, 0 };
+
+            for(size_t i = start; i < end; ++i) {
+                const IndexPosting &posting = postings[i].posting;
+                uint32_t scriptDelta = posting.script - previous.script;
+
+                appendVarint(encoded, scriptDelta);
+                appendVarint(encoded, (scriptDelta == 0 and i != start) ? posting.offset - previous.offset : posting.offset);
+
+                previous = posting;
+            }
+
+            entry.postingsSize = encoded.size() - entry.postingsOffset;
+            keyEntries.push_back(entry);
+
+            start = end;
+        }
+
+        summary.keys = keyEntries.size();
+        summary.postings = postings.size();
+
+        std::string paths;
+        std::vector<IndexScriptEntry> scriptEntries;
+
+        for(size_t i = 0; i < scriptPaths.size(); ++i) {
+            IndexScriptEntry entry {};
+            entry.pathOffset = paths.size();
+            entry.pathLength = uint32_t(scriptPaths[i].size());
+            entry.modifiedTime = infos[i].modifiedTime;
+            entry.size = infos[i].size;
+
+            scriptEntries.push_back(entry);
+            paths += scriptPaths[i];
+        }
+
+        IndexHeader header {};
+        std::memcpy(header.magic, index_magic, 4);
+        header.version = index_version;
+        header.opcodeFingerprint = fingerprint;
+        header.scriptCount = uint32_t(scriptEntries.size());
+        header.keyCount = uint32_t(keyEntries.size());
+
+        std::vector<uint8_t> out;
+        appendLE(out, header);
+
+        header.scriptTableOffset = out.size();
+        for(auto &entry : scriptEntries) appendLE(out, entry);
+
+        header.keyTableOffset = out.size();
+        for(auto &entry : keyEntries) appendLE(out, entry);
+
+        header.postingsOffset = out.size();
+        out.insert(out.end(), encoded.begin(), encoded.end());
+        index_detail::align(out);
+
+        header.pathsOffset = out.size();
+        out.insert(out.end(), paths.begin(), paths.end());
+        index_detail::align(out);
+
+        header.fileSize = out.size();
+        std::memcpy(out.data(), &header, sizeof(header));
+
+        // The old mapping must go before the file it maps is replaced.
+        old = CorpusIndex();
+
+        std::string temporaryPath = indexPath + ".tmp";
+
+        {
+            std::ofstream stream(temporaryPath, std::ios::binary | std::ios::trunc);
+            stream.write((const char *)out.data(), std::streamsize(out.size()));
+
+            if(not stream) {
+                log << "error: failed to write " << temporaryPath << '\n';
+                return false;
+            }
+        }
+
+        if(std::rename(temporaryPath.c_str(), indexPath.c_str()) != 0) {
+            log << "error: failed to replace " << indexPath << '\n';
+            std::remove(temporaryPath.c_str());
+
+            return false;
+        }
+
+        return true;
+    }
+
+    // Parses a query of the form "kind:value", where kind is opcode (hex), global, model or label.
+    inline bool parseIndexQuery(std::string_view text, IndexKey &key, std::string &error) {
+        size_t colon = text.find(':');
+
+        if(colon == std::string_view::npos) {
+            error = "expected <kind>:<value>";
+            return false;
+        }
+
+        std::string_view kind = text.substr(0, colon);
+        std::string_view value = text.substr(colon + 1);
+
+        if(value.empty()) {
+            error = "missing value";
+            return false;
+        }
+
+        if(kind == "label") {
+            if(value.size() > 8) {
+                error = "labels are at most 8 characters";
+                return false;
+            }
+
+            key = IndexKey::label(value);
+            return true;
+        }
+
+        int base = kind == "opcode" ? 16 : 10;
+        if(value.starts_with("0x")) {
+            value.remove_prefix(2);
+            base = 16;
+        }
+
+        int64_t number = 0;
+        auto result = std::from_chars(value.data(), value.data() + value.size(), number, base);
+
+        if(result.ec != std::errc() or result.ptr != value.data() + value.size()) {
+            error = "bad number '" + std::string(value) + "'";
+            return false;
+        }
+
+        if(kind == "opcode") {
+            if(number < 0 or number > 0xFFFF) {
+                error = "opcode out of range";
+                return false;
+            }
+
+            key = IndexKey::opcode(uint16_t(number));
+        } else if(kind == "global") {
+            key = IndexKey::global(uint64_t(number));
+        } else if(kind == "model") {
+            key = IndexKey::model(number);
+        } else {
+            error = "unknown kind '" + std::string(kind) + "' (expected opcode, global, model or label)";
+            return false;
+        }
+
+        return true;
+    }
+}
+
+#endif //GTASM_CORPUS_INDEX_HPP
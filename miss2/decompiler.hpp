@@ -9,64 +9,285 @@
 #include <fstream>
 #include "constructs.hpp"
 #include "context.hpp"
+#include "decompiler_context.hpp"
 #include "../util.hpp"
+#include "../simd.hpp"
 #include "script.hpp"
+#include "resync.hpp"
+#include "../work_stealing.hpp"
 #include <cmath>
 
 namespace miss2 {
     class Decompiler {
+        // Decodes the instructions that start before 'stop', passing each one (with 'baseOffset' added to its
+        //  offset) to 'handler'. DecompilerContext::read() doesn't check bounds, so the bytes from 'stop' to 'limit' must
+        //  cover at least one instruction. Only the end of each instruction is checked against 'end'. Bytes that
+        //  can't be decoded are passed on as one command with the bad opcode and a RawBytes parameter. Returns
+        //  where decoding stopped.
+        template <typename Handler>
+        static uint8_t *decodeSpan(uint8_t *begin, uint8_t *stop, uint8_t *end, size_t baseOffset,
+                                   const DecompilerContext &context, DecodeResult &result, Handler &handler) {
+            uint8_t *scriptPointer = begin;
+
+            while(scriptPointer < stop) {
+                // Skip runs of NOPs (mostly the zero padding at the end of the file) in one go. Only whole pairs
+                //  are skipped, so an odd zero byte still becomes the low byte of the next opcode.
+                if(*scriptPointer == 0) {
+                    size_t zeros = simd::zeroRun(scriptPointer, end - scriptPointer);
+                    scriptPointer += zeros & ~size_t(1);
+
+                    if(zeros >= 2) continue;
+                }
+
+                uint8_t *instructionStart = scriptPointer;
+
+                // Read a miss2 command.
+                miss2::Command command;
+                bool decoded = context.read(scriptPointer, command);
+
+                if(decoded and command.opcode == 0) {
+                    // NOP (or a single zero byte of padding at the very end)
+                    continue;
+                }
+
+                if(scriptPointer > end) {
+                    result.truncated = true;
+                    result.offset = baseOffset + (instructionStart - begin);
+                    result.opcode = command.opcode;
+                    result.length = scriptPointer - instructionStart;
+                    result.available = end - instructionStart;
+
+                    return end;
+                }
+
+                if(not decoded) {
+                    // Keep the bytes up to the most likely start of the next instruction as they are, so the
+                    //  script still assembles to the same bytes.
+                    size_t skip = Resync::fromContext(context).skipLength(instructionStart, end);
+                    scriptPointer = instructionStart + skip;
+
+                    if(skip > 2) {
+                        command.parameters.emplace_back(RawBytes, instructionStart + 2, skip - 2);
+                    }
+                }
+
+                command.offset = int32_t(baseOffset + (instructionStart - begin));
+                handler(command);
+            }
+
+            return scriptPointer;
+        }
+
+        // Instructions that start at least this far from the end can't run past it, so most of the input is
+        //  decoded in place, up to this offset.
+        static size_t tailStart(size_t size, const DecompilerContext &context) {
+            size_t guard = context.maxInstructionLength();
+            return size > guard ? size - guard : 0;
+        }
+
+        // Decodes the rest of the input from 'stopped' (where decoding in place stopped). It is copied into a
+        //  buffer followed by enough zero bytes that the last instruction can be read before finding out that
+        //  it is too long.
+        template <typename Handler>
+        static void decodeTail(uint8_t *bytes, size_t size, uint8_t *stopped, const DecompilerContext &context,
+                               DecodeResult &result, Handler &handler) {
+            size_t tailOffset = std::min(size_t(stopped - bytes), size);
+            size_t tailSize = size - tailOffset;
+
+            std::vector<uint8_t> tail(tailSize + context.maxInstructionLength(), 0);
+            if(tailSize) std::memcpy(tail.data(), bytes + tailOffset, tailSize);
+
+            decodeSpan(tail.data(), tail.data() + tailSize, tail.data() + tailSize, tailOffset, context, result, handler);
+        }
+
     public:
-        static Script decompile(string_ref filename) {
-            Script script;
+        // Roughly how many bytes apart the chunks that forEachCommandParallel() decodes at once start.
+        static constexpr size_t checkpoint_spacing = 32 * 1024;
+
+        // Decodes the commands in the buffer one at a time, passing each one (with its offset set) to 'handler'.
+        // Nothing is kept after the handler returns. NOPs are skipped. An instruction that runs past the end of
+        //  the buffer is reported in the result rather than passed on, and decoding stops there.
+        template <typename Handler>
+        static DecodeResult forEachCommand(uint8_t *bytes, size_t size, Handler &&handler,
+                                           const DecompilerContext &context = DecompilerContext::shared()) {
+            DecodeResult result;
+
+            uint8_t *stopped = decodeSpan(bytes, bytes + tailStart(size, context), bytes + size, 0, context, result, handler);
+            if(result.truncated) return result;
+
+            decodeTail(bytes, size, stopped, context, result, handler);
+            return result;
+        }
+
+        // The offsets of instructions about 'spacing' bytes apart, starting with 0, that forEachCommand() would
+        //  decode. Instruction boundaries can only be found by going through the code in order, so this only
+        //  works out the length of each instruction (see DecompilerContext::length()), which is much faster
+        //  than decoding it. Each chunk between two checkpoints can then be decoded on its own. Checkpoints
+        //  stop short of the end (see tailStart()), which is decoded separately.
+        static std::vector<size_t> findCheckpoints(const uint8_t *bytes, size_t size, size_t spacing = checkpoint_spacing,
+                                                   const DecompilerContext &context = DecompilerContext::shared()) {
+            std::vector<size_t> checkpoints { 0 };
+
+            const uint8_t *scriptPointer = bytes;
+            const uint8_t *stop = bytes + tailStart(size, context);
+            const uint8_t *end = bytes + size;
+
+            Resync resync = Resync::fromContext(context);
+            size_t nextCheckpoint = spacing;
+
+            // The same steps as decodeSpan(), so that every checkpoint is somewhere it would start an instruction.
+            while(scriptPointer < stop) {
+                if(*scriptPointer == 0) {
+                    size_t zeros = simd::zeroRun(scriptPointer, end - scriptPointer);
+                    scriptPointer += zeros & ~size_t(1);
+
+                    if(zeros >= 2) continue;
+                }
+
+                auto offset = size_t(scriptPointer - bytes);
+
+                if(offset >= nextCheckpoint) {
+                    checkpoints.push_back(offset);
+                    nextCheckpoint = offset + spacing;
+                }
+
+                size_t length = context.length(scriptPointer);
+                scriptPointer += length ? length : resync.skipLength(scriptPointer, end);
+            }
+
+            return checkpoints;
+        }
+
+        // Decodes the instructions that start from checkpoint 'index' (see findCheckpoints()) up to the next
+        //  one, or up to tailStart() for the last. Returns where decoding stopped, which is the next checkpoint
+        //  if the checkpoints are right.
+        template <typename Handler>
+        static size_t decodeChunk(uint8_t *bytes, size_t size, const std::vector<size_t> &checkpoints, size_t index,
+                                  Handler &&handler, const DecompilerContext &context = DecompilerContext::shared()) {
+            size_t from = checkpoints[index];
+            size_t to = index + 1 < checkpoints.size() ? checkpoints[index + 1] : std::max(from, tailStart(size, context));
+
+            DecodeResult unused;
+            return decodeSpan(bytes + from, bytes + to, bytes + size, from, context, unused, handler) - bytes;
+        }
+
+        // The same as forEachCommand(), but the chunks between checkpoints are decoded as jobs on 'pool' at
+        //  the same time. The commands are then passed to 'handler' in order, on the calling thread. If a chunk
+        //  doesn't end at the next checkpoint, the whole buffer is decoded again one command at a time.
+        template <typename Handler>
+        static DecodeResult forEachCommandParallel(uint8_t *bytes, size_t size, WorkStealingPool &pool, Handler &&handler,
+                                                   const DecompilerContext &context = DecompilerContext::shared(),
+                                                   size_t spacing = checkpoint_spacing) {
+            std::vector<size_t> checkpoints = findCheckpoints(bytes, size, spacing, context);
+
+            std::vector<std::vector<Command>> chunks(checkpoints.size());
+            std::vector<size_t> stoppedAt(checkpoints.size());
 
-            std::cout << "loading file... ";
+            WorkStealingPool::TaskGroup group;
 
-            auto bytesVector = readFileBytes(filename.c_str());
+            for(size_t c = 0; c < checkpoints.size(); ++c) {
+                pool.submit([&, c] {
+                    stoppedAt[c] = decodeChunk(bytes, size, checkpoints, c, [&](Command &command) {
+                        chunks[c].push_back(std::move(command));
+                    }, context);
+                }, &group);
+            }
+
+            pool.wait(group);
+
+            for(size_t c = 0; c + 1 < checkpoints.size(); ++c) {
+                if(stoppedAt[c] != checkpoints[c + 1]) {
+                    return forEachCommand(bytes, size, handler, context);
+                }
+            }
 
-            uint8_t *bytes = new uint8_t[bytesVector.size()];
-            std::copy(bytesVector.begin(), bytesVector.end(), bytes);
-            uint8_t *scriptPointer = bytes;
+            for(auto &chunk : chunks) {
+                for(Command &command : chunk) handler(command);
 
-            std::cout << "done.\n";
-            std::cout << "decompiling 0%... ";
+                chunk.clear();
+                chunk.shrink_to_fit();
+            }
+
+            DecodeResult result;
+            decodeTail(bytes, size, bytes + stoppedAt.back(), context, result, handler);
+
+            return result;
+        }
+
+        // Decompiles a script that is already in memory. Progress messages are written to 'log'. If 'stats' is
+        //  given, the decode phase is recorded there, as are the later phases of the returned script. The script
+        //  keeps a pointer to 'context', which must outlive it. Given a pool, a script big enough to have more
+        //  than one checkpoint is decoded in chunks on it (see forEachCommandParallel()).
+        static Script decompile(uint8_t *bytes, size_t size, std::ostream &log = std::cerr, Stats *stats = nullptr,
+                                const DecompilerContext &context = DecompilerContext::shared(),
+                                WorkStealingPool *pool = nullptr) {
+            Script script;
+            script.context = &context;
+            script.log = &log;
+            script.stats = stats;
+            script.sourceSize = size;
+
+            Stats::Timer timer(stats, "decode");
+
+            log << "decompiling 0%... ";
 
             float lastProgress = 0.f;
-            for(size_t scriptOffset = 0; scriptPointer < bytes + bytesVector.size(); ++scriptOffset) {
-                size_t opcodeOffset = scriptPointer - bytes;
 
-                float progress = ((float)size_t(opcodeOffset) / (float)size_t(bytesVector.size())) * 100.f;
+            auto handler = [&](Command &command) {
+                float progress = ((float)size_t(command.offset) / (float)size) * 100.f;
 
                 if(progress - lastProgress >= 10.f) {
-                    std::cout << int(progress) << "%... ";
+                    log << int(progress) << "%... ";
                     lastProgress = int(progress);
-                    std::cout.flush();
-                }
-
-                // Read a miss2 command.
-                miss2::Command command = miss2::Command::read(scriptPointer);
-                if(command.opcode == 0) {
-                    // NOP
-                    continue;
+                    log.flush();
                 }
 
-                command.offset = opcodeOffset;
                 command.scriptIndex = script.commands.size();
 
-                script.offsetsToIndices[command.offset] = command.scriptIndex;
-
-                script.commands.push_back(command);
+                // Commands come in offset order, so each one goes at the end of the map.
+                script.offsetsToIndices.emplace_hint(script.offsetsToIndices.end(), command.offset, command.scriptIndex);
 
                 // Register a jump if there is one.
-                if(Goto::isJumpOpcode(command.opcode)) {
+                if(Goto::isJump(command)) {
                     script.addJump(Goto(command));
                 }
+
+                // Nothing else uses the command once it has been handled.
+                script.commands.push_back(std::move(command));
+            };
+
+            if(pool and size >= 2 * checkpoint_spacing) {
+                script.decodeResult = forEachCommandParallel(bytes, size, *pool, handler, context);
+            } else {
+                script.decodeResult = forEachCommand(bytes, size, handler, context);
             }
 
-            std::cout << "100%\n";
+            log << "100%\n";
+
+            if(script.decodeResult.truncated) {
+                log << "warning: " << script.decodeResult.message() << '\n';
+            }
+            timer.instructions = script.commands.size();
 
-            delete[] bytes;
             return script;
         }
+
+        static Script decompile(string_ref filename, std::ostream &log = std::cerr, Stats *stats = nullptr,
+                                const DecompilerContext &context = DecompilerContext::shared(),
+                                WorkStealingPool *pool = nullptr) {
+            log << "loading file... ";
+
+            std::vector<char> bytesVector;
+
+            {
+                Stats::Timer timer(stats, "load");
+                bytesVector = readFileBytes(filename.c_str());
+            }
+
+            log << "done.\n";
+
+            return decompile((uint8_t *)bytesVector.data(), bytesVector.size(), log, stats, context, pool);
+        }
     };
 }
 
@@ -0,0 +1,206 @@
+//
+// The opcodes that scripts are decoded with. Loading an opcode file (see parseOpcodeFile()) fills a context,
+//  and after that decoding only reads it, so any number of threads can decode with one context at the same
+//  time. Nothing the decoder learns from one script is kept in the context for the next. Decoded commands
+//  point to opcode names stored in the context, so it must outlive them.
+//
+
+#ifndef GTASM_DECOMPILER_CONTEXT_HPP
+#define GTASM_DECOMPILER_CONTEXT_HPP
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstring>
+#include <map>
+#include <vector>
+#include "constructs.hpp"
+
+namespace miss2 {
+    class DecompilerContext {
+        // The names of the registered opcodes, which the commands decoded with this context point into. A
+        //  name that is registered again (when the opcode file is reloaded, for example) is stored only once.
+        StringInterner opcodeNames;
+
+        std::map<uint16_t, Command> knownCommands;
+        Command nullCommand;
+        size_t longestInstruction = 2;
+
+        std::vector<OpcodeShape> opcodeShapes = std::vector<OpcodeShape>(0x10000);
+        std::bitset<0x10000> registeredOpcodes;
+
+    public:
+        DecompilerContext() = default;
+        DecompilerContext(const DecompilerContext &) = delete;
+        DecompilerContext &operator=(const DecompilerContext &) = delete;
+
+        // The context the command-line tools load their opcode file into, and the one used when no other is
+        //  given.
+        static DecompilerContext &shared() {
+            static DecompilerContext context;
+            return context;
+        }
+
+        void registerOpcode(uint16_t opcode, const Command &cmd) {
+            Command &known = knownCommands[opcode];
+            known = cmd;
+            known.name = opcodeNames.internView(cmd.name);
+
+            OpcodeShape &opcodeShape = opcodeShapes[opcode];
+            opcodeShape.known = true;
+            opcodeShape.variadic = cmd.variadic;
+            opcodeShape.paramCount = uint8_t(std::min<size_t>(cmd.parameters.size(), 0xFF));
+
+            registeredOpcodes.set(opcode);
+
+            // Each parameter is a type byte and at most 256 more (a StringVar length byte and up to 255
+            //  characters). Replacing a definition never lowers the limit, which only has to be big enough.
+            size_t paramCount = cmd.parameters.size() + (cmd.variadic ? Command::max_variadic_params + 1 : 0);
+            longestInstruction = std::max(longestInstruction, 2 + paramCount * 257);
+        }
+
+        // The registered command for an opcode, or one with no name (which converts to false) if there isn't
+        //  one.
+        const Command &get(uint16_t op) const {
+            auto iter = knownCommands.find(op);
+
+            if(iter != knownCommands.end()) {
+                return iter->second;
+            }
+
+            return nullCommand;
+        }
+
+        const StringInterner &names() const {
+            return opcodeNames;
+        }
+
+        // The most bytes that read() can consume for one instruction, given the opcodes registered so far.
+        size_t maxInstructionLength() const {
+            return longestInstruction;
+        }
+
+        // One entry per opcode, so the shape of an instruction can be found without a map lookup.
+        const std::vector<OpcodeShape> &shapes() const {
+            return opcodeShapes;
+        }
+
+        // One bit per opcode, set for the registered ones. Small enough to stay in cache while scanning.
+        const std::bitset<0x10000> &validOpcodes() const {
+            return registeredOpcodes;
+        }
+
+        // The number of bytes read() would consume for the instruction at 'scriptPointer', or 0 if read() would
+        //  return false. Nothing is decoded: each type tag is looked up in a table of value sizes, so this is
+        //  much faster than read() and only good for finding where instructions start. Like read(), it doesn't
+        //  check for the end of the buffer.
+        size_t length(const uint8_t *scriptPointer) const {
+            // The size of the value after each byte that can be a type tag. StringVar has its size in the next
+            //  byte, and bytes that aren't type tags are marked as well.
+            static constexpr uint8_t variable_size = 0xFE, not_a_tag = 0xFF;
+
+            static const std::array<uint8_t, 256> tagSizes = [] {
+                std::array<uint8_t, 256> sizes {};
+                sizes.fill(not_a_tag);
+
+                for(size_t tag = 0; tag < 256; ++tag) {
+                    if(not isValidTypeTag(uint8_t(tag))) continue;
+                    sizes[tag] = tag == StringVar ? variable_size : uint8_t(dataTypeSize(DataType(tag)));
+                }
+
+                return sizes;
+            }();
+
+            uint16_t opcode;
+            std::memcpy(&opcode, scriptPointer, 2);
+
+            const OpcodeShape &opcodeShape = opcodeShapes[opcode];
+            if(not opcodeShape.known) return 0;
+
+            const uint8_t *cursor = scriptPointer + 2;
+            size_t maxCount = opcodeShape.paramCount + (opcodeShape.variadic ? Command::max_variadic_params + 1 : 0);
+
+            for(size_t i = 0; i < maxCount; ++i) {
+                uint8_t tag = *(cursor++);
+                uint8_t size = tagSizes[tag];
+
+                if(size == not_a_tag or (tag == EOAL and i < opcodeShape.paramCount)) return 0;
+                if(size == variable_size) size = *(cursor++);
+
+                cursor += size;
+
+                if(tag == EOAL) return cursor - scriptPointer;
+            }
+
+            // No EOAL within max_variadic_params.
+            if(opcodeShape.variadic) return 0;
+
+            return cursor - scriptPointer;
+        }
+
+        // Reads one instruction into 'command' without checking for the end of the buffer, so there must be
+        //  at least maxInstructionLength() readable bytes at 'scriptPointer' (see Decompiler::forEachCommand()).
+        // Returns false if the opcode isn't registered or a parameter has a type tag that can't be there, which
+        //  means the decoder has lost its place. 'command' then only has its opcode set, and 'scriptPointer' is
+        //  left just after the bad opcode or tag.
+        bool read(uint8_t *&scriptPointer, Command &command) const {
+            uint16_t opcode;
+            std::memcpy(&opcode, scriptPointer, 2);
+            scriptPointer += 2;
+
+            const OpcodeShape &opcodeShape = opcodeShapes[opcode];
+
+            if(not opcodeShape.known) {
+                command = Command();
+                command.opcode = opcode;
+
+                return false;
+            }
+
+            // The registered command gives the name and masks. Each parameter's type comes from the script.
+            command = get(opcode);
+
+            size_t fixedCount = command.parameters.size();
+            size_t maxCount = fixedCount + (opcodeShape.variadic ? Command::max_variadic_params + 1 : 0);
+
+            for(size_t i = 0; i < maxCount; ++i) {
+                auto type = DataType(*(scriptPointer++));
+
+                // EOAL only ends the extra parameters of a variadic opcode.
+                if(not isValidTypeTag(type) or (type == EOAL and i < fixedCount)) {
+                    command = Command();
+                    command.opcode = opcode;
+
+                    return false;
+                }
+
+                if(i >= fixedCount) {
+                    command.parameters.emplace_back(type);
+                }
+
+                Value &param = command.parameters[i];
+                param.type = type;
+                param.size = type == StringVar ? *(scriptPointer++) : dataTypeSize(type);
+
+                if(param.size) {
+                    param.setBytes(scriptPointer, param.size);
+                    scriptPointer += param.size;
+                }
+
+                if(type == EOAL) return true;
+            }
+
+            if(opcodeShape.variadic) {
+                // No EOAL within max_variadic_params.
+                command = Command();
+                command.opcode = opcode;
+
+                return false;
+            }
+
+            return true;
+        }
+    };
+}
+
+#endif //GTASM_DECOMPILER_CONTEXT_HPP
@@ -0,0 +1,147 @@
+//
+// Stores each distinct string once and hands out a small ID for it. The characters live in fixed-size
+//  chunks that are never moved or freed while the interner exists, so the string_view for an ID stays
+//  valid and two strings are equal exactly when their IDs are. Each DecompilerContext keeps the names of its
+//  opcodes in one of these, and each script keeps the names the decompiler generates for its labels,
+//  procedures and globals in another.
+//
+// Adding a string takes a lock, but looking one up by ID doesn't: the views are kept in blocks that are
+//  never moved either, and an ID is only published once its view has been written.
+//
+
+#ifndef GTASM_INTERNER_HPP
+#define GTASM_INTERNER_HPP
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace miss2 {
+    using SymbolID = uint32_t;
+
+    constexpr SymbolID no_symbol = 0xffffffff;
+
+    class StringInterner {
+        static constexpr size_t chunk_size = 64 * 1024;
+
+        std::vector<std::unique_ptr<char[]>> chunks;
+
+        // The chunk small strings are being added to, and how much of it is used.
+        char *current = nullptr;
+        size_t chunkUsed = 0;
+
+        size_t byteCount = 0;
+
+        // The view for each ID. Block b holds first_block_size << b views, so 32 blocks cover every 32-bit ID,
+        //  and blocks never have to move to make room for more.
+        static constexpr size_t first_block_size = 256;
+        static constexpr size_t block_count = 32;
+
+        std::array<std::unique_ptr<std::string_view[]>, block_count> viewBlocks;
+
+        // How many IDs have been handed out. Everything an ID refers to is written before this is raised past
+        //  it, so a reader that sees the ID in range sees its view too.
+        std::atomic<size_t> stringCount = 0;
+
+        std::unordered_map<std::string_view, SymbolID> ids;
+
+        // Taken to add strings, not to look them up.
+        mutable std::mutex mutex;
+
+        // The block that holds an ID's view, and the view's position in it.
+        static std::pair<size_t, size_t> locate(size_t id) {
+            size_t shifted = id + first_block_size;
+            size_t block = std::bit_width(shifted) - std::bit_width(first_block_size);
+
+            return { block, shifted - (first_block_size << block) };
+        }
+
+        // Copies 'text' into the arena. Strings longer than a quarter of a chunk get a chunk of their own.
+        std::string_view store(std::string_view text) {
+            if(text.empty()) return {};
+
+            char *destination;
+
+            if(text.size() > chunk_size / 4) {
+                chunks.push_back(std::make_unique<char[]>(text.size()));
+                destination = chunks.back().get();
+            } else {
+                if(not current or chunk_size - chunkUsed < text.size()) {
+                    chunks.push_back(std::make_unique<char[]>(chunk_size));
+                    current = chunks.back().get();
+                    chunkUsed = 0;
+                }
+
+                destination = current + chunkUsed;
+                chunkUsed += text.size();
+            }
+
+            std::memcpy(destination, text.data(), text.size());
+            byteCount += text.size();
+
+            return { destination, text.size() };
+        }
+
+    public:
+        StringInterner() = default;
+        StringInterner(const StringInterner &) = delete;
+        StringInterner &operator=(const StringInterner &) = delete;
+
+        // The ID of 'text', adding it if it hasn't been seen before.
+        SymbolID intern(std::string_view text) {
+            std::lock_guard lock(mutex);
+
+            auto found = ids.find(text);
+            if(found != ids.end()) return found->second;
+
+            std::string_view stored = store(text);
+            size_t id = stringCount.load(std::memory_order_relaxed);
+
+            auto [block, index] = locate(id);
+
+            if(not viewBlocks[block]) {
+                viewBlocks[block] = std::make_unique<std::string_view[]>(first_block_size << block);
+            }
+
+            viewBlocks[block][index] = stored;
+            ids.emplace(stored, SymbolID(id));
+
+            stringCount.store(id + 1, std::memory_order_release);
+
+            return SymbolID(id);
+        }
+
+        // The stored copy of 'text'. It lives as long as the interner does.
+        std::string_view internView(std::string_view text) {
+            return view(intern(text));
+        }
+
+        // Safe to call while another thread is adding strings.
+        std::string_view view(SymbolID id) const {
+            if(id >= stringCount.load(std::memory_order_acquire)) return {};
+
+            auto [block, index] = locate(id);
+            return viewBlocks[block][index];
+        }
+
+        // Number of distinct strings.
+        size_t size() const {
+            return stringCount.load(std::memory_order_acquire);
+        }
+
+        // Characters stored, not counting the unused end of each chunk.
+        size_t bytes() const {
+            std::lock_guard lock(mutex);
+            return byteCount;
+        }
+    };
+}
+
+#endif //GTASM_INTERNER_HPP
@@ -0,0 +1,521 @@
+/*
+ * Intermediate representation (IR) of decompiled commands, as consumed by the Java side.
+ *
+ * There are two formats. The text format is the original one, with one command per line:
+ *
+ *   offset:opcode[param,param,...]
+ *
+ * where each parameter is formatted by primitiveVtoS(). It is lossy (floats are printed with six decimal
+ *  places and strings are truncated at the first NUL) and every number has to be parsed again by the reader.
+ *  Bytes that couldn't be decoded (see resync.hpp) follow the bad opcode as one RawBytes parameter, written
+ *  as 'H' and two hex digits per byte.
+ *
+ * The binary format is lossless and is laid out so that a reader can walk it in place from a mapped file
+ *  without copying anything. All integers are little-endian.
+ *
+ *   Header (32 bytes):
+ *     0   char[4]   magic "GTIR"
+ *     4   u16       version (ir_version)
+ *     6   u16       flags (ir_inline_strings or 0)
+ *     8   u32       number of records
+ *     12  u32       size of the source script in bytes
+ *     16  u32       offset of the record section
+ *     20  u32       size of the record section in bytes
+ *     24  u32       offset of the string table (4-byte aligned)
+ *     28  u32       size of the string table in bytes
+ *
+ *   Record (one per command, in script order):
+ *     varint    offset delta (this command's offset minus the previous record's offset, or 0 for the first)
+ *     u16       opcode
+ *     u8        parameter count
+ *     params    each is a u8 type tag (miss2::DataType) followed by its payload
+ *
+ *   Parameter payloads:
+ *     S8                                         1 byte
+ *     S16, non-array global/local references     2 bytes
+ *     S32, F32                                   4 bytes (F32 is the raw IEEE-754 value)
+ *     Arrays                                     6 bytes (raw ArrayObject)
+ *     String8, String16, StringVar and any       varint index into the string table. The string holds the
+ *      type without a fixed size (RawBytes)       exact bytes read from the script (not truncated).
+ *
+ *   When the ir_inline_strings flag is set (streamed output), there is no string table: the offset and size
+ *    of the table are 0 and string payloads are instead stored inline as a varint length followed by the bytes.
+ *    If the output could not be seeked back to once the stream was finished, the record count and record
+ *    section size are 0xFFFFFFFF and the records run to the end of the file.
+ *
+ *   String table:
+ *     u32       string count (n)
+ *     u32[n+1]  start of each string relative to the end of this array; string i is [start[i], start[i + 1])
+ *     bytes     string data
+ *
+ * Varints are unsigned LEB128: seven bits per byte, least significant group first, with the high bit set
+ *  on every byte except the last.
+ */
+
+#ifndef GTASM_IR_HPP
+#define GTASM_IR_HPP
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <ostream>
+#include <cstring>
+#include <unistd.h>
+#include "constructs.hpp"
+
+namespace miss2 {
+    static const uint16_t ir_version = 1;
+
+    // Header flags.
+    static const uint16_t ir_inline_strings = 0x1;
+
+    // Record count/size placeholder for streamed output whose header could not be patched.
+    static const uint32_t ir_size_unknown = 0xFFFFFFFF;
+
+    struct BinaryIRHeader {
+        char magic[4];
+        uint16_t version;
+        uint16_t flags;
+        uint32_t recordCount;
+        uint32_t sourceSize;
+        uint32_t recordsOffset;
+        uint32_t recordsSize;
+        uint32_t stringTableOffset;
+        uint32_t stringTableSize;
+    } __attribute__((packed));
+
+    static_assert(sizeof(BinaryIRHeader) == 32, "the IR header is fixed at 32 bytes");
+
+    // Parameters of these types have their bytes stored in the string table rather than inline.
+    inline bool irPayloadIsString(DataType type) {
+        return type == String8 or type == String16 or dataTypeSize(type) == 0;
+    }
+
+    inline void appendVarint(std::vector<uint8_t> &out, uint64_t value) {
+        while(value >= 0x80) {
+            out.push_back(uint8_t(value) | 0x80);
+            value >>= 7;
+        }
+
+        out.push_back(uint8_t(value));
+    }
+
+    template <typename T>
+    inline void appendLE(std::vector<uint8_t> &out, T value) {
+        // The decoder already assumes a little-endian host, so the bytes can be copied directly.
+        auto oldSize = out.size();
+        out.resize(oldSize + sizeof(T));
+        std::memcpy(out.data() + oldSize, &value, sizeof(T));
+    }
+
+    // Reads a varint without going past 'end'. Returns false if the varint is truncated or too long.
+    inline bool readVarint(const uint8_t *&cursor, const uint8_t *end, uint64_t &value) {
+        value = 0;
+
+        for(int shift = 0; shift < 64 and cursor < end; shift += 7) {
+            uint8_t byte = *(cursor++);
+            value |= uint64_t(byte & 0x7F) << shift;
+
+            if(not (byte & 0x80)) return true;
+        }
+
+        return false;
+    }
+
+    // Appends one record to 'out'. 'writeString' is called to store each string payload.
+    template <typename StringWriter>
+    inline void encodeIRRecord(std::vector<uint8_t> &out, const Command &command, int32_t &lastOffset, StringWriter &&writeString) {
+        appendVarint(out, uint32_t(command.offset - lastOffset));
+        lastOffset = command.offset;
+
+        appendLE<uint16_t>(out, command.opcode);
+        out.push_back(uint8_t(command.parameters.size()));
+
+        for(const Value &param : command.parameters) {
+            out.push_back(param.type);
+
+            if(irPayloadIsString(param.type)) {
+                writeString(param.getBytes(), param.byteCount());
+                continue;
+            }
+
+            // Fixed-size payload. Pad with zeroes if the value was somehow read short.
+            size_t size = dataTypeSize(param.type);
+            size_t copied = std::min(size, param.byteCount());
+
+            out.insert(out.end(), param.getBytes(), param.getBytes() + copied);
+            out.insert(out.end(), size - copied, 0);
+        }
+    }
+
+    class BinaryIRWriter {
+        std::vector<uint8_t> records;
+
+        std::vector<std::string_view> strings;
+        std::unordered_map<std::string, uint32_t> stringIndices;
+
+        uint32_t recordCount = 0;
+        int32_t lastOffset = 0;
+
+        uint32_t internString(const uint8_t *bytes, size_t length) {
+            auto inserted = stringIndices.emplace(std::string(bytes, bytes + length), strings.size());
+
+            if(inserted.second) {
+                strings.push_back(inserted.first->first);
+            }
+
+            return inserted.first->second;
+        }
+
+    public:
+        void add(const Command &command) {
+            encodeIRRecord(records, command, lastOffset, [&](const uint8_t *bytes, size_t length) {
+                appendVarint(records, internString(bytes, length));
+            });
+
+            ++recordCount;
+        }
+
+        // Builds the complete file contents.
+        std::vector<uint8_t> finish(size_t sourceSize) {
+            size_t stringBytes = 0;
+            for(auto &s : strings) stringBytes += s.size();
+
+            size_t recordsOffset = sizeof(BinaryIRHeader);
+            size_t stringTableOffset = (recordsOffset + records.size() + 3) & ~size_t(3);
+            size_t stringTableSize = 4 + 4 * (strings.size() + 1) + stringBytes;
+
+            BinaryIRHeader header {
+                .magic = {'G', 'T', 'I', 'R'},
+                .version = ir_version,
+                .flags = 0,
+                .recordCount = recordCount,
+                .sourceSize = uint32_t(sourceSize),
+                .recordsOffset = uint32_t(recordsOffset),
+                .recordsSize = uint32_t(records.size()),
+                .stringTableOffset = uint32_t(stringTableOffset),
+                .stringTableSize = uint32_t(stringTableSize),
+            };
+
+            std::vector<uint8_t> out;
+            out.reserve(stringTableOffset + stringTableSize);
+            out.resize(stringTableOffset, 0);
+
+            std::memcpy(out.data(), &header, sizeof(header));
+            if(not records.empty()) std::memcpy(out.data() + recordsOffset, records.data(), records.size());
+
+            appendLE<uint32_t>(out, strings.size());
+
+            uint32_t start = 0;
+            for(auto &s : strings) {
+                appendLE<uint32_t>(out, start);
+                start += s.size();
+            }
+
+            appendLE<uint32_t>(out, start);
+
+            size_t dataStart = out.size();
+            out.resize(dataStart + stringBytes);
+
+            for(auto &s : strings) {
+                std::memcpy(out.data() + dataStart, s.data(), s.size());
+                dataStart += s.size();
+            }
+
+            return out;
+        }
+    };
+
+    inline std::vector<uint8_t> encodeBinaryIR(const std::vector<Command> &commands, size_t sourceSize) {
+        BinaryIRWriter writer;
+
+        for(const Command &command : commands) {
+            writer.add(command);
+        }
+
+        return writer.finish(sourceSize);
+    }
+
+    // Writes binary IR straight to a file descriptor through a fixed-size buffer, so memory use does not grow
+    //  with the size of the script. Strings are stored inline (ir_inline_strings) instead of in a table.
+    class StreamingIRWriter {
+        static const size_t flush_threshold = 64 * 1024;
+
+        int fd;
+        std::vector<uint8_t> buffer;
+        bool failed = false;
+
+        uint32_t recordCount = 0;
+        uint64_t recordsSize = 0;
+        int32_t lastOffset = 0;
+
+        void flush() {
+            const uint8_t *p = buffer.data();
+            size_t remaining = buffer.size();
+
+            while(remaining and not failed) {
+                ssize_t written = ::write(fd, p, remaining);
+
+                if(written < 0) {
+                    failed = true;
+                    break;
+                }
+
+                p += written;
+                remaining -= written;
+            }
+
+            recordsSize += buffer.size();
+            buffer.clear();
+        }
+
+        BinaryIRHeader header(size_t sourceSize, uint32_t count, uint32_t size) const {
+            return {
+                .magic = {'G', 'T', 'I', 'R'},
+                .version = ir_version,
+                .flags = ir_inline_strings,
+                .recordCount = count,
+                .sourceSize = uint32_t(sourceSize),
+                .recordsOffset = sizeof(BinaryIRHeader),
+                .recordsSize = size,
+                .stringTableOffset = 0,
+                .stringTableSize = 0,
+            };
+        }
+
+    public:
+        explicit StreamingIRWriter(int outputFD) : fd { outputFD } {
+            buffer.reserve(flush_threshold + 4096);
+
+            // Placeholder header. It is rewritten by finish() if the output is seekable.
+            BinaryIRHeader placeholder = header(0, ir_size_unknown, ir_size_unknown);
+            buffer.insert(buffer.end(), (uint8_t *)&placeholder, (uint8_t *)&placeholder + sizeof(placeholder));
+            flush();
+
+            recordsSize = 0;
+        }
+
+        void add(const Command &command) {
+            encodeIRRecord(buffer, command, lastOffset, [&](const uint8_t *bytes, size_t length) {
+                appendVarint(buffer, length);
+                buffer.insert(buffer.end(), bytes, bytes + length);
+            });
+
+            ++recordCount;
+
+            if(buffer.size() >= flush_threshold) {
+                flush();
+            }
+        }
+
+        // Flushes the remaining records and fills in the header. Returns false if anything failed to write.
+        bool finish(size_t sourceSize) {
+            flush();
+
+            BinaryIRHeader finalHeader = header(sourceSize, recordCount, uint32_t(recordsSize));
+
+            if(lseek(fd, 0, SEEK_CUR) >= 0) {
+                if(pwrite(fd, &finalHeader, sizeof(finalHeader), 0) != sizeof(finalHeader)) {
+                    failed = true;
+                }
+            }
+
+            return not failed;
+        }
+
+        uint32_t count() const {
+            return recordCount;
+        }
+
+        uint64_t bytesWritten() const {
+            return sizeof(BinaryIRHeader) + recordsSize;
+        }
+    };
+
+    inline void writeTextIR(std::ostream &out, Command &command) {
+        out << command.offset << ':' << command.opcode << '[';
+
+        for(size_t i = 0; i < command.parameters.size(); ++i) {
+            if(i) out << ',';
+            out << primitiveVtoS(command.parameters[i]);
+        }
+
+        out << ']';
+    }
+
+    inline void writeTextIR(std::ostream &out, std::vector<Command> &commands) {
+        bool first = true;
+        for(Command &command : commands) {
+            if(not first) {
+                out << '\n';
+            }
+
+            first = false;
+            writeTextIR(out, command);
+        }
+    }
+
+    // A parameter as stored in the binary IR. 'data' points into the IR buffer.
+    struct BinaryIRParam {
+        DataType type;
+        const uint8_t *data;
+        size_t size;
+    };
+
+    struct BinaryIRRecord {
+        int32_t offset;
+        uint16_t opcode;
+
+        // Valid until the next call to BinaryIRReader::next().
+        const BinaryIRParam *params;
+        size_t paramCount;
+    };
+
+    // Walks a binary IR buffer in place. Nothing is copied out of the buffer.
+    class BinaryIRReader {
+        const uint8_t *base = nullptr;
+        size_t length = 0;
+
+        BinaryIRHeader headerCopy {};
+        bool isValid = false;
+        bool inlineStrings = false;
+
+        const uint8_t *cursor = nullptr;
+        const uint8_t *recordsEnd = nullptr;
+        int32_t offset = 0;
+
+        uint32_t stringCount = 0;
+        const uint8_t *stringStarts = nullptr;
+        const uint8_t *stringData = nullptr;
+        size_t stringDataSize = 0;
+
+        std::vector<BinaryIRParam> paramScratch;
+
+        static uint32_t loadU32(const uint8_t *p) {
+            uint32_t v;
+            std::memcpy(&v, p, 4);
+            return v;
+        }
+
+    public:
+        BinaryIRReader(const uint8_t *data, size_t size) : base { data }, length { size } {
+            if(size < sizeof(BinaryIRHeader)) return;
+
+            std::memcpy(&headerCopy, data, sizeof(BinaryIRHeader));
+            if(std::memcmp(headerCopy.magic, "GTIR", 4) != 0 or headerCopy.version != ir_version) return;
+
+            auto inBounds = [&](uint64_t off, uint64_t len) {
+                return off + len <= size;
+            };
+
+            inlineStrings = headerCopy.flags & ir_inline_strings;
+
+            uint64_t recordsSize = headerCopy.recordsSize;
+            if(inlineStrings and recordsSize == ir_size_unknown and headerCopy.recordsOffset <= size) {
+                // Unpatched streamed output: the records run to the end of the buffer.
+                recordsSize = size - headerCopy.recordsOffset;
+            }
+
+            if(not inBounds(headerCopy.recordsOffset, recordsSize)) return;
+
+            cursor = data + headerCopy.recordsOffset;
+            recordsEnd = cursor + recordsSize;
+
+            if(inlineStrings) {
+                isValid = true;
+                return;
+            }
+
+            if(not inBounds(headerCopy.stringTableOffset, headerCopy.stringTableSize)) return;
+            if(headerCopy.stringTableSize < 8) return;
+
+            const uint8_t *table = data + headerCopy.stringTableOffset;
+            stringCount = loadU32(table);
+
+            uint64_t startsSize = 4 * (uint64_t(stringCount) + 1);
+            if(4 + startsSize > headerCopy.stringTableSize) return;
+
+            stringStarts = table + 4;
+            stringData = stringStarts + startsSize;
+            stringDataSize = headerCopy.stringTableSize - 4 - startsSize;
+
+            isValid = true;
+        }
+
+        bool valid() const {
+            return isValid;
+        }
+
+        const BinaryIRHeader &header() const {
+            return headerCopy;
+        }
+
+        // Returns an empty view if the index is out of range.
+        std::string_view string(uint64_t index) const {
+            if(index >= stringCount) return {};
+
+            uint32_t start = loadU32(stringStarts + 4 * index);
+            uint32_t end = loadU32(stringStarts + 4 * (index + 1));
+
+            if(start > end or end > stringDataSize) return {};
+            return {(const char *)stringData + start, end - start};
+        }
+
+        // Reads the next record. Returns false at the end of the records or if the data is malformed.
+        bool next(BinaryIRRecord &record) {
+            if(not isValid or cursor >= recordsEnd) return false;
+
+            uint64_t delta;
+            if(not readVarint(cursor, recordsEnd, delta)) return false;
+            if(recordsEnd - cursor < 3) return false;
+
+            offset += int32_t(delta);
+            record.offset = offset;
+
+            std::memcpy(&record.opcode, cursor, 2);
+            uint8_t paramCount = cursor[2];
+            cursor += 3;
+
+            paramScratch.resize(paramCount);
+
+            for(BinaryIRParam &param : paramScratch) {
+                if(cursor >= recordsEnd) return false;
+                param.type = DataType(*(cursor++));
+
+                if(irPayloadIsString(param.type)) {
+                    uint64_t value;
+                    if(not readVarint(cursor, recordsEnd, value)) return false;
+
+                    if(inlineStrings) {
+                        // 'value' is the length of the string that follows.
+                        if(uint64_t(recordsEnd - cursor) < value) return false;
+
+                        param.data = cursor;
+                        param.size = value;
+                        cursor += value;
+                        continue;
+                    }
+
+                    std::string_view s = string(value);
+                    param.data = (const uint8_t *)s.data();
+                    param.size = s.size();
+                    continue;
+                }
+
+                param.size = dataTypeSize(param.type);
+                if(size_t(recordsEnd - cursor) < param.size) return false;
+
+                param.data = cursor;
+                cursor += param.size;
+            }
+
+            record.params = paramScratch.data();
+            record.paramCount = paramCount;
+
+            return true;
+        }
+    };
+}
+
+#endif //GTASM_IR_HPP
@@ -0,0 +1,311 @@
+//
+// A flat, read-only snapshot of a DecompilerContext's opcodes and a decoder that uses it. Unlike
+//  DecompilerContext::read, the decoder doesn't allocate, so any number of threads can decode at once cheaply.
+//
+
+#ifndef GTASM_OPCODE_TABLE_HPP
+#define GTASM_OPCODE_TABLE_HPP
+
+#include <bitset>
+#include <vector>
+#include <cstring>
+#include <cctype>
+#include <string_view>
+#include "constructs.hpp"
+#include "decompiler_context.hpp"
+#include "resync.hpp"
+#include "../simd.hpp"
+
+namespace miss2 {
+    // Bit i of 'writes' is set if an opcode stores a result in parameter i. Bit i of 'updates' is also set if
+    //  the old value is read first (as with +=).
+    struct ParameterAccess {
+        uint64_t writes = 0;
+        uint64_t updates = 0;
+    };
+
+    // Works out which parameters a command writes from the wording of its name (with the parameters already
+    //  replaced by $0, $1 etc.). The opcode database has no direction information, so this recognises the
+    //  conventions it uses:
+    //
+    //   $0 = $1, $0 += $1          assignments write the left-hand side
+    //   create_car ... store: $4   a "store:" parameter is written
+    //   get_car $0 speed_to $1     in get/store commands, parameters after a word ending in "to" are written,
+    //                               along with any that follow directly after it ("store_to $3 $4 $5")
+    //   storeCarPosition(car: $0, x: $1, ...)
+    //                              in call-style store commands, all parameters but the first are written
+    inline ParameterAccess parameterAccess(std::string_view name) {
+        auto trimmed = [](std::string_view text) {
+            while(not text.empty() and std::isspace((unsigned char)text.front())) text.remove_prefix(1);
+            while(not text.empty() and std::isspace((unsigned char)text.back())) text.remove_suffix(1);
+
+            return text;
+        };
+
+        std::string lower;
+        for(char c : trimmed(name)) lower += char(std::tolower((unsigned char)c));
+
+        bool getter = lower.starts_with("get") or lower.starts_with("store");
+        bool callStyle = lower.starts_with("store") and lower.find('(') != std::string::npos;
+
+        // Each token, with the text between it and the previous one.
+        struct Token {
+            int index;
+            std::string_view before, after;
+        };
+
+        std::vector<Token> tokens;
+        size_t textStart = 0;
+
+        for(size_t i = 0; i < name.size(); ++i) {
+            if(name[i] != '$' or i + 1 >= name.size() or not std::isdigit((unsigned char)name[i + 1])) continue;
+
+            size_t end = i + 1;
+            while(end < name.size() and std::isdigit((unsigned char)name[end])) ++end;
+
+            if(not tokens.empty()) tokens.back().after = name.substr(textStart, i - textStart);
+
+            tokens.push_back({ std::stoi(std::string(name.substr(i + 1, end - i - 1))), name.substr(textStart, i - textStart), {} });
+            textStart = end;
+            i = end - 1;
+        }
+
+        if(not tokens.empty()) tokens.back().after = name.substr(textStart);
+
+        ParameterAccess access;
+        bool chained = false;
+
+        for(size_t t = 0; t < tokens.size(); ++t) {
+            const Token &token = tokens[t];
+            if(token.index < 0 or token.index >= 64) continue;
+
+            uint64_t bit = uint64_t(1) << token.index;
+
+            std::string_view before = trimmed(token.before);
+            std::string_view after = trimmed(token.after);
+
+            if(after.starts_with('=') and not after.starts_with("==")) {
+                access.writes |= bit;
+                continue;
+            }
+
+            if(after.size() >= 2 and after[1] == '=' and std::strchr("+-*/", after[0])) {
+                access.writes |= bit;
+                access.updates |= bit;
+                continue;
+            }
+
+            if(before.ends_with("store:") or (callStyle and t != 0)) {
+                access.writes |= bit;
+                continue;
+            }
+
+            if(not getter) continue;
+
+            size_t wordStart = before.find_last_of(" \t(,");
+            std::string_view word = before.substr(wordStart == std::string_view::npos ? 0 : wordStart + 1);
+
+            // "closest_to" introduces the point that is searched from, not a result.
+            if(word == "to" or (word.ends_with("_to") and not word.ends_with("closest_to"))) {
+                chained = true;
+            } else if(not before.empty()) {
+                chained = false;
+            }
+
+            if(chained) access.writes |= bit;
+        }
+
+        return access;
+    }
+
+    struct OpcodeTable {
+        // DecompilerContext::shapes() and DecompilerContext::validOpcodes() at the time of the snapshot.
+        std::vector<OpcodeShape> shapes = std::vector<OpcodeShape>(0x10000);
+        std::bitset<0x10000> valid;
+
+        // Command::labelMask and Command::modelMask for each opcode.
+        std::vector<uint32_t> labelMasks = std::vector<uint32_t>(0x10000, 0);
+        std::vector<uint32_t> modelMasks = std::vector<uint32_t>(0x10000, 0);
+
+        // The parameters each opcode writes to (see parameterAccess()).
+        std::vector<ParameterAccess> access = std::vector<ParameterAccess>(0x10000);
+
+        // Takes a copy of everything registered in 'context' so far (normally by parseOpcodeFile()).
+        static OpcodeTable fromContext(const DecompilerContext &context = DecompilerContext::shared()) {
+            OpcodeTable table;
+            table.shapes = context.shapes();
+            table.valid = context.validOpcodes();
+
+            for(uint32_t opcode = 0; opcode < 0x10000; ++opcode) {
+                const Command &command = context.get(uint16_t(opcode));
+                if(not command) continue;
+
+                table.labelMasks[opcode] = command.labelMask;
+                table.modelMasks[opcode] = command.modelMask;
+                table.access[opcode] = parameterAccess(command.name);
+            }
+
+            return table;
+        }
+
+        bool known(uint16_t opcode) const {
+            return valid[opcode];
+        }
+    };
+
+    struct FlatParam {
+        DataType type;
+        const uint8_t *data;
+        uint32_t size;
+
+        bool isInteger() const {
+            return type == S8 or type == S16 or type == S32;
+        }
+
+        bool isString() const {
+            return type == String8 or type == String16 or type == StringVar;
+        }
+
+        bool isGlobalVariable() const {
+            return type == GlobalIntFloat or type == GlobalString8 or type == GlobalString16
+                or type == GlobalIntFloatArr or type == GlobalString8Arr or type == GlobalString16Arr;
+        }
+
+        bool isLocalVariable() const {
+            return type == LocalIntFloat or type == LocalString8 or type == LocalString16
+                or type == LocalIntFloatArr or type == LocalString8Arr or type == LocalString16Arr;
+        }
+
+        // The value of an integer immediate, or the offset of a variable.
+        int64_t integer() const {
+            switch(type) {
+                case S8:
+                    return int8_t(data[0]);
+                case S16: {
+                    int16_t value;
+                    std::memcpy(&value, data, 2);
+                    return value;
+                }
+                case S32: {
+                    int32_t value;
+                    std::memcpy(&value, data, 4);
+                    return value;
+                }
+                default: {
+                    if(size < 2) return 0;
+
+                    uint16_t value;
+                    std::memcpy(&value, data, 2);
+                    return value;
+                }
+            }
+        }
+
+        float floatValue() const {
+            float value = 0;
+            if(type == F32) std::memcpy(&value, data, 4);
+
+            return value;
+        }
+
+        // The text of a string immediate, up to its terminator.
+        std::string_view text() const {
+            return { (const char *)data, simd::nulLength(data, size) };
+        }
+    };
+
+    struct FlatInstruction {
+        // Parameters past this are decoded (to find the next instruction) but not stored.
+        static constexpr size_t max_params = 48;
+
+        uint32_t offset;
+        uint16_t opcode;
+        bool known;
+        uint8_t paramCount;
+        FlatParam params[max_params];
+    };
+
+    class FlatDecoder {
+        const OpcodeTable &table;
+        const uint8_t *begin, *cursor, *end;
+
+    public:
+        FlatDecoder(const OpcodeTable &table, const uint8_t *bytes, size_t size)
+            : table { table }, begin { bytes }, cursor { bytes }, end { bytes + size } {}
+
+        // Decodes the next instruction, skipping NOPs as Decompiler::forEachCommand() does. Returns false at
+        //  the end of the input, or if the last instruction is cut off. Bytes that can't be decoded are skipped
+        //  up to the likely start of the next instruction (see Resync) and returned as one instruction that
+        //  isn't 'known' and has no parameters.
+        bool next(FlatInstruction &instruction) {
+            while(cursor < end and *cursor == 0) {
+                size_t zeros = simd::zeroRun(cursor, end - cursor);
+                cursor += zeros & ~size_t(1);
+
+                if(zeros < 2) break;
+            }
+
+            if(end - cursor < 2) {
+                cursor = end;
+                return false;
+            }
+
+            const uint8_t *start = cursor;
+
+            instruction.offset = uint32_t(cursor - begin);
+            std::memcpy(&instruction.opcode, cursor, 2);
+            cursor += 2;
+
+            const OpcodeShape &shape = table.shapes[instruction.opcode];
+            instruction.known = shape.known;
+            instruction.paramCount = 0;
+
+            if(instruction.known) {
+                size_t maxCount = shape.paramCount + (shape.variadic ? Command::max_variadic_params + 1 : 0);
+
+                for(size_t i = 0; i < maxCount; ++i) {
+                    if(cursor >= end) return false;
+
+                    auto type = DataType(*cursor++);
+
+                    if(not isValidTypeTag(type) or (type == EOAL and i < shape.paramCount)) {
+                        instruction.known = false;
+                        break;
+                    }
+
+                    size_t size = dataTypeSize(type);
+
+                    if(type == StringVar) {
+                        if(cursor >= end) return false;
+                        size = *cursor++;
+                    }
+
+                    if(size_t(end - cursor) < size) {
+                        cursor = end;
+                        return false;
+                    }
+
+                    if(type != EOAL and instruction.paramCount < FlatInstruction::max_params) {
+                        instruction.params[instruction.paramCount++] = { type, cursor, uint32_t(size) };
+                    }
+
+                    cursor += size;
+
+                    if(type == EOAL) break;
+
+                    // A variadic opcode with no EOAL.
+                    if(i + 1 == maxCount and shape.variadic) instruction.known = false;
+                }
+
+                if(instruction.known) return true;
+            }
+
+            instruction.paramCount = 0;
+            cursor = start + Resync(table.shapes, table.valid).skipLength(start, end);
+
+            return true;
+        }
+    };
+}
+
+#endif //GTASM_OPCODE_TABLE_HPP
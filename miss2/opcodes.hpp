@@ -14,11 +14,9 @@ namespace miss2 {
         Call = 0x50,
         Return = 0x51,
         If = 0xD6,
-        DrivingCarWithModel = 0xDD, // Model ID is params[1]
-        RandomCarWithModel = 0x327, // Model ID is params[0]
     };
 
-    bool opcodeIsAssignment(uint16_t op) {
+    inline bool opcodeIsAssignment(uint16_t op) {
         return 0x4 <= op and op <= 0x7;
     }
 }
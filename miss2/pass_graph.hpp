@@ -0,0 +1,152 @@
+//
+// Runs a list of passes over shared data, overlapping the ones that don't touch the same data. Each pass
+//  names the parts of the data it reads and writes as bits. A pass waits for every earlier pass that writes
+//  something it reads or writes, and for every earlier pass that reads something it writes, so each part
+//  of the data sees the same reads and writes in the same order as when the passes run one after another.
+//  The results are therefore the same however the passes are scheduled.
+//
+
+#ifndef GTASM_PASS_GRAPH_HPP
+#define GTASM_PASS_GRAPH_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "stats.hpp"
+#include "../thread_pool.hpp"
+#include "../work_stealing.hpp"
+
+namespace miss2 {
+    class PassGraph {
+    public:
+        // A set of parts of the data, one bit each.
+        using Resources = uint32_t;
+
+        struct Pass {
+            std::string name;
+            Resources reads = 0;
+            Resources writes = 0;
+            std::function<void()> run;
+
+            // Indices of the earlier passes this one waits for, and of the later passes that wait for it.
+            std::vector<size_t> dependencies;
+            std::vector<size_t> dependents;
+
+            // Set once the pass has run.
+            double milliseconds = 0;
+            long peakRSSKilobytes = 0;
+        };
+
+    private:
+        std::vector<Pass> passes;
+
+        void runPass(Pass &pass) {
+            auto start = std::chrono::steady_clock::now();
+            pass.run();
+
+            pass.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            pass.peakRSSKilobytes = Stats::peakRSSKilobytes();
+        }
+
+    public:
+        // Adds a pass that comes after the ones already added.
+        size_t add(std::string name, Resources reads, Resources writes, std::function<void()> run) {
+            size_t index = passes.size();
+
+            Pass pass { std::move(name), reads, writes, std::move(run) };
+
+            for(size_t earlier = 0; earlier < index; ++earlier) {
+                Pass &other = passes[earlier];
+
+                if((other.writes & (reads | writes)) or (other.reads & writes)) {
+                    pass.dependencies.push_back(earlier);
+                    other.dependents.push_back(index);
+                }
+            }
+
+            passes.push_back(std::move(pass));
+            return index;
+        }
+
+        const std::vector<Pass> &all() const {
+            return passes;
+        }
+
+        // How many passes can run at once, for choosing a thread count. Passes are grouped by how long a
+        //  chain of dependencies leads to them. The passes in a group never wait for each other, so the size of
+        //  the largest group is the answer.
+        size_t width() const {
+            // Passes are added in order, so a pass's level is one more than the highest level it waits for.
+            std::vector<size_t> levels(passes.size(), 0);
+            std::vector<size_t> levelSizes;
+
+            for(size_t i = 0; i < passes.size(); ++i) {
+                for(size_t dependency : passes[i].dependencies) {
+                    levels[i] = std::max(levels[i], levels[dependency] + 1);
+                }
+
+                if(levels[i] >= levelSizes.size()) levelSizes.resize(levels[i] + 1, 0);
+                ++levelSizes[levels[i]];
+            }
+
+            size_t widest = 0;
+            for(size_t size : levelSizes) widest = std::max(widest, size);
+
+            return widest;
+        }
+
+        // Runs every pass on the calling thread, in the order they were added.
+        void runSerially() {
+            for(Pass &pass : passes) {
+                runPass(pass);
+            }
+        }
+
+        // Runs each pass as a job on 'pool' once the passes it waits for have finished. Returns when every
+        //  pass has run.
+        void run(ThreadPool &pool) {
+            runJobs([&](std::function<void()> job) { pool.submit(std::move(job)); }, [&] { pool.wait(); });
+        }
+
+        // The same, but on a work-stealing pool, which may already be running other jobs. Called from one
+        //  of its jobs, the worker keeps running jobs until the passes are done.
+        void run(WorkStealingPool &pool) {
+            WorkStealingPool::TaskGroup group;
+            runJobs([&](std::function<void()> job) { pool.submit(std::move(job), &group); }, [&] { pool.wait(group); });
+        }
+
+    private:
+        template <typename Submit, typename Wait>
+        void runJobs(Submit submit, Wait wait) {
+            auto waitingOn = std::make_unique<std::atomic<size_t>[]>(passes.size());
+
+            for(size_t i = 0; i < passes.size(); ++i) {
+                waitingOn[i] = passes[i].dependencies.size();
+            }
+
+            std::function<void(size_t)> start = [&](size_t i) {
+                submit([&, i] {
+                    runPass(passes[i]);
+
+                    // Whoever finishes last of a pass's dependencies starts it.
+                    for(size_t dependent : passes[i].dependents) {
+                        if(--waitingOn[dependent] == 0) start(dependent);
+                    }
+                });
+            };
+
+            for(size_t i = 0; i < passes.size(); ++i) {
+                if(passes[i].dependencies.empty()) start(i);
+            }
+
+            wait();
+        }
+    };
+}
+
+#endif //GTASM_PASS_GRAPH_HPP
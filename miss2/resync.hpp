@@ -0,0 +1,141 @@
+//
+// Finding the next instruction after one that can't be decoded. Modded scripts use opcodes that aren't in the
+//  opcode database, and some scripts keep data in the code (the 128-byte tables after 05B6, for example), so
+//  stepping over just the opcode leaves the decoder reading parameters as opcodes until it happens to line up
+//  again. Instead, each offset after the bad instruction is tried as the start of the next one. Offsets that
+//  don't start with a registered opcode are rejected by a bitset lookup, and the rest are scored by how many
+//  instructions decode cleanly from them in a row.
+//
+
+#ifndef GTASM_RESYNC_HPP
+#define GTASM_RESYNC_HPP
+
+#include <bitset>
+#include <vector>
+#include <cstring>
+#include "constructs.hpp"
+#include "decompiler_context.hpp"
+#include "../simd.hpp"
+
+namespace miss2 {
+    // Length of the instruction at 'p' if it decodes cleanly (a registered opcode, valid type tags, and no
+    //  further than 'end'), or 0 if it doesn't.
+    inline size_t cleanInstructionLength(const uint8_t *p, const uint8_t *end, const std::vector<OpcodeShape> &shapes) {
+        if(end - p < 2) return 0;
+
+        uint16_t opcode;
+        std::memcpy(&opcode, p, 2);
+
+        const OpcodeShape &shape = shapes[opcode];
+        if(not shape.known) return 0;
+
+        const uint8_t *cursor = p + 2;
+        size_t maxCount = shape.paramCount + (shape.variadic ? Command::max_variadic_params + 1 : 0);
+
+        for(size_t i = 0; i < maxCount; ++i) {
+            if(cursor >= end) return 0;
+
+            uint8_t tag = *(cursor++);
+            if(not isValidTypeTag(tag) or (tag == EOAL and i < shape.paramCount)) return 0;
+
+            size_t size = dataTypeSize(DataType(tag));
+
+            if(tag == StringVar) {
+                if(cursor >= end) return 0;
+                size = *(cursor++);
+            }
+
+            if(size_t(end - cursor) < size) return 0;
+            cursor += size;
+
+            if(tag == EOAL) return cursor - p;
+        }
+
+        // A variadic opcode with no EOAL.
+        if(shape.variadic) return 0;
+
+        return cursor - p;
+    }
+
+    class Resync {
+        const std::vector<OpcodeShape> &shapes;
+        const std::bitset<0x10000> &valid;
+
+        // How many instructions decode cleanly from 'p', up to 'confirmations'. Reaching the end of the code
+        //  counts as a full score. Pairs of zero bytes are skipped without counting, as the decoder skips them.
+        int score(const uint8_t *p, const uint8_t *end) const {
+            int count = 0;
+
+            while(count < confirmations) {
+                if(p < end and *p == 0) {
+                    size_t zeros = simd::zeroRun(p, end - p);
+                    p += zeros & ~size_t(1);
+
+                    if(zeros >= 2) continue;
+                }
+
+                if(p >= end) return confirmations;
+
+                size_t length = cleanInstructionLength(p, end, shapes);
+                if(not length) break;
+
+                p += length;
+                ++count;
+            }
+
+            return count;
+        }
+
+    public:
+        // How far past a bad instruction to look for the next one.
+        static constexpr size_t window = 1024;
+
+        // A candidate that decodes this many instructions in a row is taken without looking further.
+        static constexpr int confirmations = 4;
+
+        Resync(const std::vector<OpcodeShape> &shapes, const std::bitset<0x10000> &valid)
+            : shapes { shapes }, valid { valid } {}
+
+        // Uses the opcodes registered in a context.
+        static Resync fromContext(const DecompilerContext &context) {
+            return Resync(context.shapes(), context.validOpcodes());
+        }
+
+        // Given an instruction at 'start' that couldn't be decoded, returns the number of bytes to skip to reach
+        //  the most likely start of the next one: the first candidate with a full score, or failing that the
+        //  earliest with the highest score. The result is at least 2 (the opcode) unless there are fewer bytes
+        //  left, and never past 'end'.
+        size_t skipLength(const uint8_t *start, const uint8_t *end) const {
+            size_t available = end - start;
+            if(available <= 2) return available;
+
+            size_t limit = std::min(window, available);
+
+            int bestScore = 0;
+            size_t bestSkip = 2;
+
+            for(size_t skip = 2; skip <= limit; ++skip) {
+                const uint8_t *candidate = start + skip;
+
+                if(skip + 2 <= available) {
+                    uint16_t opcode;
+                    std::memcpy(&opcode, candidate, 2);
+
+                    if(not valid[opcode]) continue;
+                }
+
+                int candidateScore = score(candidate, end);
+                if(candidateScore == confirmations) return skip;
+
+                if(candidateScore > bestScore) {
+                    bestScore = candidateScore;
+                    bestSkip = skip;
+                }
+            }
+
+            return bestSkip;
+        }
+    };
+}
+
+#endif //GTASM_RESYNC_HPP
@@ -6,10 +6,17 @@
 #define GTASM_SCRIPT_HPP
 
 #include <set>
+#include <memory>
+#include <mutex>
 #include <iostream>
 #include <sstream>
+#include <charconv>
 #include "context.hpp"
+#include "decompiler_context.hpp"
+#include "stats.hpp"
+#include "pass_graph.hpp"
 #include "../util.hpp"
+#include "../gxt.hpp"
 
 
 
@@ -51,6 +58,97 @@ namespace miss2 {
 
         std::set<int16_t> knownLocals;
 
+        // Size of the file the script was decompiled from.
+        size_t sourceSize {};
+
+        // Whether the input ended part way through an instruction.
+        DecodeResult decodeResult;
+
+        // Indices of all 'if' commands, built on the first createIfStatements() pass.
+        std::set<size_t> ifCommandIndices;
+
+        // Where progress messages are written. Decompiled code goes to the stream given to prettyPrint().
+        std::ostream *log = &std::cerr;
+
+        // Where phase timings and counters are recorded, if anywhere.
+        Stats *stats = nullptr;
+
+        // Game text for annotating text label parameters, if any.
+        const GXT *gxt = nullptr;
+
+        // The opcodes the script was decoded with.
+        const DecompilerContext *context = &DecompilerContext::shared();
+
+        DecompileOptions options;
+
+        // Names for annotating model ID parameters.
+        const game::ModelTable *models = &game::ModelTable::builtIn();
+
+        // Names generated for labels, procedures and globals, and the text printed for unknown commands. Each
+        //  name is built once and referred to by ID. Copies of the script share the interner.
+        std::shared_ptr<StringInterner> symbols = std::make_shared<StringInterner>();
+
+        // The most threads to run the analysis passes on (see analyse()). No more are started than there are
+        //  passes that can run at once, and 1 runs every pass on the calling thread. 0 allows one per core for
+        //  scripts of at least parallel_analysis_threshold commands and runs smaller ones on the calling thread.
+        size_t analysisThreads = 0;
+
+        // If set, the analysis passes run as jobs on this pool instead, alongside whatever else it is running
+        //  (other scripts, for example). No threads are started for them, so this is worth it at any size.
+        WorkStealingPool *scheduler = nullptr;
+
+        // Below this many commands the passes are too quick to be worth starting threads for.
+        static constexpr size_t parallel_analysis_threshold = 20000;
+
+        // With a scheduler, render() splits the script into runs of at least this many printed commands and
+        //  renders them as separate jobs.
+        static constexpr size_t render_chunk_commands = 512;
+
+        // What rendering carries from one command to the next.
+        struct RenderState {
+            // Locals that have appeared so far. The first assignment to a local also declares it.
+            std::set<int16_t> knownLocals;
+
+            // Set when a run of commands is rendered on its own. Whether a local is new then depends on the
+            //  runs before, so each declaration is left as a marker for renderChunks() to fill in.
+            bool deferDeclarations = false;
+
+            // The local and the text for each marker.
+            std::vector<std::pair<int16_t, std::string>> declarations;
+
+            std::string declare(int16_t local, std::string declaration) {
+                if(not deferDeclarations) return declaration;
+
+                declarations.emplace_back(local, std::move(declaration));
+                return declaration_marker + std::to_string(declarations.size() - 1) + declaration_marker_end;
+            }
+        };
+
+        // Around the index of a deferred declaration. Scripts practically never print these bytes, and
+        //  renderChunks() renders a run of commands again without markers if one does.
+        static constexpr char declaration_marker = '\x01';
+        static constexpr char declaration_marker_end = '\x02';
+
+        // The data that the analysis passes read and write, for ordering them (see PassGraph).
+        enum AnalysisData : PassGraph::Resources {
+            CommandData = 1 << 0,
+            JumpData = 1 << 1,
+            IfData = 1 << 2,
+            ForLoopData = 1 << 3,
+            ProcedureData = 1 << 4,
+            LabelData = 1 << 5,
+            GlobalData = 1 << 6,
+            HiddenData = 1 << 7,
+            SymbolData = 1 << 8,
+        };
+
+        // Index of the command at 'offset', or 0 if no command starts there. Unlike offsetsToIndices[offset],
+        //  this never adds an entry, so passes running at the same time can all use it.
+        size_t indexAtOffset(int32_t offset) const {
+            auto found = offsetsToIndices.find(offset);
+            return found == offsetsToIndices.end() ? 0 : found->second;
+        }
+
         void addJump(Goto jump) {
             jumpSources[jump.source].insert(jump);
             jumpDestinations[jump.dest].insert(jump);
@@ -73,10 +171,10 @@ namespace miss2 {
                 return jumpCommand;
             }
 
-            Command &firstCommand = commands[offsetsToIndices[jump.source]];
-            Command &secondCommand = commands[offsetsToIndices[jump.dest]];
+            Command &firstCommand = commands[indexAtOffset(jump.source)];
+            Command &secondCommand = commands[indexAtOffset(jump.dest)];
 
-            if(not Goto::isJumpOpcode(firstCommand.opcode) or not Goto::isJumpOpcode(secondCommand.opcode)) {
+            if(not Goto::isJump(firstCommand) or not Goto::isJump(secondCommand)) {
                 // Can't do anything if either command is not a jump.
                 // This should happen when jumps have been optimised as much as possible, and we have
                 //  reached the stage where the jumped-to instruction is not itself a jump.
@@ -103,7 +201,7 @@ namespace miss2 {
             jumpDestinations.clear();
 
             for(Command &cmd : commands) {
-                if(Goto::isJumpOpcode(cmd.opcode)) {
+                if(Goto::isJump(cmd)) {
                     addJump(Goto(cmd));
                 }
             }
@@ -112,10 +210,10 @@ namespace miss2 {
         // Only use on compilation: there is no need to optimise decompiled code,
         //  and doing so only makes it harder to read.
         void optimizeScript() {
-            if(optimize_jumps) {
+            if(options.optimizeJumps) {
                 for(auto &jumpSet : jumpDestinations) {
                     for(auto &jump : jumpSet.second) {
-                        Command &originalJump = commands[offsetsToIndices[jump.source]];
+                        Command &originalJump = commands[indexAtOffset(jump.source)];
                         originalJump = optimizeJump(jump, originalJump);
                     }
                 }
@@ -145,7 +243,7 @@ namespace miss2 {
                     .combination = FullIf::Invalid
             };
 
-            if(commands[i].opcode == Opcode::If and not ifStatements.count(commands[i].offset)) {
+            if(commands[i] and commands[i].opcode == Opcode::If and not ifStatements.count(commands[i].offset)) {
                 FullIf fullIf;
                 auto info = FullIf::ifInfo(commands[i]);
                 fullIf.conditionCount = info.first;
@@ -155,6 +253,11 @@ namespace miss2 {
 
                 size_t maxConditionIndex = i + info.first;
 
+                // The conditions, the jump and at least one command of the body must all be there.
+                if(maxConditionIndex + 2 >= commands.size()) {
+                    return defaultReturn;
+                }
+
                 fullIf.conditionStartOffset = commands[i].offset;
 
                 bool cancel = false;
@@ -173,7 +276,7 @@ namespace miss2 {
 
                 fullIf.conditionEndOffset = commands[i].offset;
 
-                if(commands[++i].opcode != Opcode::JumpIfFalse) {
+                if(not Goto::isJump(commands[++i]) or commands[i].opcode != Opcode::JumpIfFalse) {
                     //size_t iBackup = i;
                     //size_t maxI = std::min(i + 5, commands.size());
                     //while(i <= maxI and commands[i].opcode != Opcode::JumpIfFalse) ++i;
@@ -212,19 +315,17 @@ namespace miss2 {
         }
 
         void createIfStatements() {
-            static std::set<size_t> ifCommandIndices;
-
             if(ifCommandIndices.empty()) {
-                std::cout << "discovering if commands...\n";
+                *log << "discovering if commands...\n";
 
                 // Find all the if commands.
                 for(size_t i = 0; i < commands.size(); ++i) {
-                    if(commands[i].opcode == Opcode::If) {
+                    if(commands[i] and commands[i].opcode == Opcode::If) {
                         ifCommandIndices.insert(i);
                     }
                 }
 
-                std::cout << "cache built\n";
+                *log << "cache built\n";
             }
 
             for(size_t i : ifCommandIndices) {
@@ -236,11 +337,11 @@ namespace miss2 {
         }
 
         inline Command &commandAtOffset(size_t offset) {
-            return commands[offsetsToIndices[offset]];
+            return commands[indexAtOffset(offset)];
         }
 
         inline Command &commandBefore(Command &cmd) {
-            return commands[offsetsToIndices[cmd.offset] - 1];
+            return commands[indexAtOffset(cmd.offset) - 1];
         }
 
         inline int32_t offsetBefore(int32_t offset) {
@@ -258,11 +359,18 @@ namespace miss2 {
                 FullIf &statement = ifPair.second;
 
                 Goto falseJump = Goto(commandAtOffset(statement.jifOffset));
-                auto jifTargetIndex = offsetsToIndices[falseJump.dest] - 1;
+
+                // The jump may not land on a command we decoded (or may land on the very first one).
+                auto targetIter = offsetsToIndices.find(falseJump.dest);
+                if(targetIter == offsetsToIndices.end() or targetIter->second == 0) {
+                    continue;
+                }
+
+                auto jifTargetIndex = targetIter->second - 1;
 
                 Command &loopJump = commands[jifTargetIndex];
 
-                bool notJump = not Goto::isJumpOpcode(loopJump.opcode);
+                bool notJump = not Goto::isJump(loopJump);
                 if(notJump or Goto(loopJump).dest != ifPair.first) {
                     continue;
                 }
@@ -299,24 +407,24 @@ namespace miss2 {
 
 
 
-        std::string forString(ForLoop &loop) {
+        std::string forString(ForLoop &loop, RenderState &state) {
             static std::string fmt = "for($0; $1; $2)";
 
-            std::string setupStr = commandToString(commandAtOffset(loop.setupRange.start), paramStringsForCommand(commandAtOffset(loop.setupRange.start)));
+            std::string setupStr = commandToString(commandAtOffset(loop.setupRange.start), paramStringsForCommand(commandAtOffset(loop.setupRange.start), state));
 
-            std::string conditionStr = ifStatementString(ifStatements[loop.checkRange.start]);
+            std::string conditionStr = ifStatementString(ifStatements.at(loop.checkRange.start), state);
             replaceAll(conditionStr, "while", "");
             replaceAll(conditionStr, "if_", "");
             replaceAll(conditionStr, "if", "");
 
-            std::string incDecStr = commandToString(commandAtOffset(loop.incRange.start), paramStringsForCommand(commandAtOffset(loop.incRange.start)));
+            std::string incDecStr = commandToString(commandAtOffset(loop.incRange.start), paramStringsForCommand(commandAtOffset(loop.incRange.start), state));
 
             return replaceTokens(fmt, {setupStr, conditionStr, incDecStr});
         }
 
         void createProcedures() {
             for(Command &cmd : commands) {
-                if(cmd.opcode == Opcode::Call) {
+                if(Goto::isJump(cmd) and cmd.opcode == Opcode::Call) {
                     // Found a call, so there must be a procedure here.
                     Goto call(cmd);
 
@@ -328,9 +436,9 @@ namespace miss2 {
 
                     Procedure procedure;
                     procedure.beginOffset = procOffset;
-                    procedure.name = replaceTokens("proc_$0", {std::to_string(procOffset)});
+                    procedure.name = symbols->intern("proc_" + std::to_string(procOffset));
 
-                    size_t procedureStartIndex = offsetsToIndices[procOffset];
+                    size_t procedureStartIndex = indexAtOffset(procOffset);
 
                     // The final return's level should match the start level.
                     // It is possible for there to be two reachable returns on the same level,
@@ -340,7 +448,7 @@ namespace miss2 {
                     for(size_t i = procedureStartIndex; i < commands.size(); ++i) {
                         procedure.endOffset = commands[i].offset;
 
-                        auto effectiveOpcode = commands[offsetsToIndices[commands[i].effectiveOffset()]].opcode;
+                        auto effectiveOpcode = commands[indexAtOffset(commands[i].effectiveOffset())].opcode;
                         if(effectiveOpcode == Opcode::Return) {
                             int level = ifLevelForOffset(commands[i].offset);
 
@@ -355,9 +463,9 @@ namespace miss2 {
 
         void createWhileLoops(std::set<int32_t> &hiddenOffsets) {
             for(Command &cmd : commands) {
-                if(Goto::isJumpOpcode(cmd.opcode)) {
+                if(Goto::isJump(cmd)) {
                     Goto jump(cmd);
-                    if(jump.dest < jump.source and commands[offsetsToIndices[jump.dest]].opcode == Opcode::If) {
+                    if(jump.dest < jump.source and commands[indexAtOffset(jump.dest)].opcode == Opcode::If) {
                         // This is a while loop (effectively, even if it wasn't originally written as one).
                         FullIf &theIf = ifStatements[jump.dest];
                         theIf.flowType = FullIf::FlowWhile;
@@ -371,15 +479,15 @@ namespace miss2 {
         void createLabels(std::set<int32_t> &hiddenOffsets) {
             for(Command &cmd : commands) {
                 if(hiddenOffsets.count(cmd.offset)) continue;
-                if(Goto::isJumpOpcode(cmd.opcode) and cmd.opcode != Opcode::Call and not ifStatements.count(cmd.offset)) {
+                if(Goto::isJump(cmd) and cmd.opcode != Opcode::Call and not ifStatements.count(cmd.offset)) {
                     Goto jump(cmd);
 
-                    Label label {
-                            jump.dest,
-                            replaceTokens("label_$0", {std::to_string(jump.dest)})
-                    };
+                    // Many jumps can share a destination, but the label only needs naming once.
+                    Label &label = labelLocations[jump.dest];
+                    if(label.name != no_symbol) continue;
 
-                    labelLocations[jump.dest] = label;
+                    label.offset = jump.dest;
+                    label.name = symbols->intern("label_" + std::to_string(jump.dest));
                 }
             }
         }
@@ -389,15 +497,16 @@ namespace miss2 {
                 for(int i = 0; i < cmd.parameters.size(); ++i) {
                     auto &obj = cmd.parameters[i];
 
-                    auto typeName = dataTypeName(obj.type);
-
-                    if(typeName.starts_with('G') and not typeName.ends_with("Arr")) {
+                    if(isGlobalVarType(obj.type)) {
                         uint16_t globalOffset = obj.cast<uint16_t>();
 
                         GlobalVar &var = globals[globalOffset];
                         var.referenceType = obj.type;
                         var.offset = globalOffset;
 
+                        // The type may change here, so the name is built again when it's next printed.
+                        var.name = no_symbol;
+
                         // If this is an assignment, we need to add the assigned type to the global var.
                         if(cmd.parameters.size() == 2 and std::count(cmd.name.begin(), cmd.name.end(), '=') == 1) {
                             // Probably an assignment.
@@ -435,7 +544,7 @@ namespace miss2 {
         }
 
         int32_t nextJumpedTo(int32_t startOffset) {
-            size_t cmdIndex = offsetsToIndices[startOffset];
+            size_t cmdIndex = indexAtOffset(startOffset);
 
             for(size_t i = cmdIndex; i < commands.size(); ++i) {
                 if(jumpDestinations.count(commands[i].offset)) {
@@ -452,7 +561,7 @@ namespace miss2 {
                 for(Goto jump : jumpPair.second) {
                     if(jump.jumpOpcode == Opcode::Jump) {
                         // Find the next jumped-to offset.
-                        size_t cmdIndex = offsetsToIndices[jump.source] + 1;
+                        size_t cmdIndex = indexAtOffset(jump.source) + 1;
 
                         bool needsBreak = false;
                         for(size_t i = cmdIndex; i < commands.size(); ++i) {
@@ -522,32 +631,120 @@ namespace miss2 {
             return lvl;
         }
 
-        void printInfo(string_ref padStr, string_ref info) {
-            std::cout << asComment(padStr + "// " + info) << codeColor << '\n';
+        void printInfo(std::ostream &out, string_ref padStr, string_ref info) {
+            out << asComment(padStr + "// " + info) << codeColor << '\n';
         }
 
-        inline std::string vehicleModelComment(int16_t id) {
-            return asComment(replaceTokens("/* Car $0 = '$1' */ ", {
-                    std::to_string(id),
-                    vehicleNameForID(id)
-            }));
+        // The name of each model ID parameter (see Command::modelMask) that the model table has, as comments.
+        std::string modelComment(const Command &cmd) {
+            uint32_t mask = context->get(cmd.opcode).modelMask;
+            if(not mask or not models) return "";
+
+            std::string comment;
+
+            for(size_t i = 0; i < cmd.parameters.size() and i < 32; ++i) {
+                const Value &param = cmd.parameters[i];
+                if(not ((mask >> i) & 1) or (param.type != S8 and param.type != S16 and param.type != S32)) continue;
+
+                auto id = int32_t(param.type == S8 ? param.cast<int8_t>() : param.type == S16 ? param.cast<int16_t>()
+                                                                                              : param.cast<int32_t>());
+                std::string_view name = models->name(id);
+                if(name.empty()) continue;
+
+                comment += asComment(replaceTokens("/* $0 $1 = '$2' */ ", {
+                        game::modelKindName(models->kind(id)),
+                        std::to_string(id),
+                        std::string(name)
+                }));
+            }
+
+            return comment;
+        }
+
+        // Makes text from a GXT file or a script safe to put between quotes in a /* */ comment: control
+        //  characters (including the newlines GXT text can have) become escapes, and so does the slash in
+        //  "*/", which would otherwise end the comment.
+        static std::string commentSafe(std::string_view text) {
+            static const char hexDigits[] = "0123456789ABCDEF";
+
+            std::string safe;
+            safe.reserve(text.size());
+
+            for(size_t i = 0; i < text.size(); ++i) {
+                auto c = (unsigned char)text[i];
+
+                switch(c) {
+                    case '\\':
+                        safe += "\\\\";
+                        break;
+                    case '"':
+                        safe += "\\\"";
+                        break;
+                    case '\n':
+                        safe += "\\n";
+                        break;
+                    case '\r':
+                        safe += "\\r";
+                        break;
+                    case '\t':
+                        safe += "\\t";
+                        break;
+                    case '/':
+                        safe += i > 0 and text[i - 1] == '*' ? "\\/" : "/";
+                        break;
+                    default:
+                        if(c < 0x20 or c == 0x7F) {
+                            safe += "\\x";
+                            safe += hexDigits[c >> 4];
+                            safe += hexDigits[c & 0xF];
+                        } else {
+                            safe += char(c);
+                        }
+                }
+            }
+
+            return safe;
+        }
+
+        // The in-game text of each text label parameter that the GXT file has, as comments.
+        std::string textLabelComment(const Command &cmd) {
+            if(not gxt) return "";
+
+            std::string comment, text;
+
+            for(const Value &param : cmd.parameters) {
+                if(param.type != String8 and param.type != String16) continue;
+
+                std::string_view key((const char *)param.getBytes(), simd::nulLength(param.getBytes(), param.byteCount()));
+                if(key.empty() or not gxt->lookup(key, text)) continue;
+
+                comment += asComment("/* " + commentSafe(key) + " = \"" + commentSafe(text) + "\" */ ");
+            }
+
+            return comment;
         }
 
         std::string globStr(GlobalVar &global) {
-            static std::string format = orange + "g$0_$1" + codeColor;
+            if(global.name == no_symbol) {
+                global.name = symbols->intern("g" + miss2::dataTypeName(global.valueType) + "_"
+                                              + std::to_string(global.offset));
+            }
 
-            return replaceTokens(format, {miss2::dataTypeName(global.valueType), std::to_string(global.offset)});
+            return orange + std::string(symbols->view(global.name)) + codeColor;
         }
 
         std::string globalToString(const Command &cmd, Value &p) {
-            if(p.size == 2 and globals.count(p.cast<uint16_t>()) and globals[p.cast<uint16_t>()].valueType) {
-                return globStr(globals[p.cast<uint16_t>()]);
+            if(p.size != 2) return "";
+
+            auto global = globals.find(p.cast<uint16_t>());
+            if(global != globals.end() and global->second.valueType) {
+                return globStr(global->second);
             }
 
             return "";
         }
 
-        std::string valueParamToString(const Command &cmd, Value p) {
+        std::string valueParamToString(const Command &cmd, Value p, RenderState &state) {
             std::string globalStr = globalToString(cmd, p);
             if(not globalStr.empty()) return globalStr;
 
@@ -576,11 +773,11 @@ namespace miss2 {
                 printType = false;
                 valueStr = varColor + "local" + typeName.substr(1) + "_" + std::to_string(p.cast<int16_t>());
 
-                if(p == cmd.parameters.front() and not knownLocals.count(p.cast<int16_t>()) and opcodeIsAssignment(cmd.opcode)) {
-                    valueStr = blue + typeName + codeColor + ' ' + valueStr;
+                if(p == cmd.parameters.front() and not state.knownLocals.count(p.cast<int16_t>()) and opcodeIsAssignment(cmd.opcode)) {
+                    valueStr = state.declare(p.cast<int16_t>(), blue + typeName + codeColor + ' ') + valueStr;
                 }
 
-                knownLocals.insert(p.cast<int16_t>());
+                state.knownLocals.insert(p.cast<int16_t>());
             }
 
             std::string highlightedParam = (printType ? ("("
@@ -595,11 +792,11 @@ namespace miss2 {
             return highlightedParam;
         }
 
-        std::vector<std::string> paramStringsForCommand(Command &cmd) {
-            if(cmd.opcode == Opcode::Call) {
+        std::vector<std::string> paramStringsForCommand(Command &cmd, RenderState &state) {
+            if(Goto::isJump(cmd) and cmd.opcode == Opcode::Call) {
                 int32_t offset = std::abs(cmd.parameters.front().cast<int32_t>());
                 if(allProcedures.count(offset)) {
-                    return {callColor + allProcedures[offset].name + "()" + codeColor};
+                    return {callColor + std::string(symbols->view(allProcedures.at(offset).name)) + "()" + codeColor};
                 }
             }
 
@@ -610,8 +807,8 @@ namespace miss2 {
                     static std::string format = orange + "l$0Arr_$1" + codeColor + "[$2]" + codeColor;
 
                     std::string indexString = arr.properties.isIndexGlobalVar
-                                              ? globStr(globals[arr.arrayIndex])
-                                              : valueParamToString(cmd, Value(LocalIntFloat, (uint8_t *)&arr.arrayIndex, sizeof(arr.arrayIndex)));
+                                              ? globStr(globals.at(arr.arrayIndex))
+                                              : valueParamToString(cmd, Value(LocalIntFloat, (uint8_t *)&arr.arrayIndex, sizeof(arr.arrayIndex)), state);
                     std::string s = replaceTokens(format, {arr.properties.elementTypeStr(), std::to_string(arr.offset), indexString});
 
 
@@ -625,13 +822,13 @@ namespace miss2 {
                     continue;
                 }
 
-                paramStrs.push_back(valueParamToString(cmd, p));
+                paramStrs.push_back(valueParamToString(cmd, p, state));
             }
 
             return paramStrs;
         }
 
-        std::string ifStatementString(FullIf &statement) {
+        std::string ifStatementString(FullIf &statement, RenderState &state) {
             std::stringstream stream;
 
             stream << pink << (statement.flowType == FullIf::FlowIf ? "if" : "while");
@@ -652,8 +849,8 @@ namespace miss2 {
             stream << codeColor;
 
             stream << "(";
-            size_t conditionStartIndex = offsetsToIndices[statement.conditionStartOffset] + 1;
-            size_t conditionEndIndex = offsetsToIndices[statement.conditionEndOffset];
+            size_t conditionStartIndex = indexAtOffset(statement.conditionStartOffset) + 1;
+            size_t conditionEndIndex = indexAtOffset(statement.conditionEndOffset);
 
             for(size_t i = conditionStartIndex; i <= conditionEndIndex; ++i) {
                 auto cmd = commands[i];
@@ -662,16 +859,11 @@ namespace miss2 {
                     cmd.name = "unknown condition";
                 }
 
-                if(cmd.opcode == Opcode::DrivingCarWithModel) {
-                    auto id = cmd.parameters[1].cast<int16_t>();
-                    stream << vehicleModelComment(id);
-                } else if(cmd.opcode == Opcode::RandomCarWithModel) {
-                    auto id = cmd.parameters[0].cast<int16_t>();
-                    stream << vehicleModelComment(id);
-                }
+                stream << modelComment(cmd);
+                stream << textLabelComment(cmd);
 
 
-                stream << codeColor << replaceTokens(cmd.name, paramStringsForCommand(cmd));
+                stream << codeColor << replaceTokens(std::string(cmd.name), paramStringsForCommand(cmd, state));
 
                 if(i != conditionEndIndex) {
                     stream << ", ";
@@ -684,76 +876,146 @@ namespace miss2 {
         }
 
         std::string commandToString(Command &cmd, std::vector<std::string> paramStrs) {
-            if(cmd.opcode == Opcode::Call) {
+            if(Goto::isJump(cmd) and cmd.opcode == Opcode::Call) {
                 return paramStrs[0];
             }
 
-            return replaceTokens(cmd.name, paramStrs);;
+            return replaceTokens(std::string(cmd.name), paramStrs);
         }
 
-        void prettyPrint() {
-            // Offsets of commands that shouldn't be printed.
-            std::set<int32_t> hiddenOffsets;
-
+        // Runs every analysis pass. The output is the same whether or not passes run at the same time. Offsets
+        //  of commands that shouldn't be printed are added to 'hiddenOffsets'.
+        void analyse(std::set<int32_t> &hiddenOffsets) {
             // !!
-            if(optimize_decompile) {
-                std::cout << "optimising...\n";
+            if(options.optimize) {
+                *log << "optimising...\n";
+                Stats::Timer timer(stats, "optimize", commands.size());
                 optimizeScript();
             }
 
-            std::cout << "creating conditionals...\n";
-            auto lastIfSize = ifStatements.size();
+            {
+                *log << "creating conditionals...\n";
+                Stats::Timer timer(stats, "if_statements", commands.size());
+                auto lastIfSize = ifStatements.size();
+
+                // Keep creating if statements until no more can be generated.
+                int ifPass = 1;
+                while(true) {
+                    *log << "pass " << ifPass++ << '\n';
+                    createIfStatements();
+                    auto sizeNow = ifStatements.size();
+
+                    // If the number of ifs doesn't change, we've finished.
+                    if(sizeNow == lastIfSize) break;
+                    lastIfSize = sizeNow;
+                }
+            }
 
-            // Keep creating if statements until no more can be generated.
-            int ifPass = 1;
-            while(true) {
-                std::cout << "pass " << ifPass++ << '\n';
-                createIfStatements();
-                auto sizeNow = ifStatements.size();
+            // The passes that build the structures used for rendering. They are declared in the order they
+            //  would run one after another, and passes that use different data run at the same time.
+            PassGraph graph;
+            std::mutex logLock;
+
+            auto addPass = [&](std::string name, const char *message, PassGraph::Resources reads,
+                               PassGraph::Resources writes, std::function<void()> run) {
+                graph.add(std::move(name), reads, writes, [&, message, run = std::move(run)] {
+                    {
+                        std::lock_guard guard(logLock);
+                        *log << message << '\n';
+                    }
 
-                // If the number of ifs doesn't change, we've finished.
-                if(sizeNow == lastIfSize) break;
-                lastIfSize = sizeNow;
+                    run();
+                });
+            };
+
+            addPass("for_loops", "creating for-loops...", CommandData | IfData, ForLoopData, [&] {
+                createForLoops(hiddenOffsets);
+            });
+
+            addPass("procedures", "creating procedures...", CommandData | IfData, ProcedureData | SymbolData, [&] {
+                createProcedures();
+            });
+
+            addPass("while_loops", "creating while-loops...", CommandData, IfData | HiddenData, [&] {
+                createWhileLoops(hiddenOffsets);
+            });
+
+            if(options.clean) {
+                addPass("dead_code", "removing dead code...", CommandData | JumpData, HiddenData, [&] {
+                    removeDeadCode(hiddenOffsets);
+                });
             }
 
-            std::cout << "creating for-loops...\n";
-            createForLoops(hiddenOffsets);
+            addPass("labels", "creating labels...", CommandData | IfData | HiddenData, LabelData | SymbolData, [&] {
+                createLabels(hiddenOffsets);
+            });
+
+            addPass("globals", "creating globals...", CommandData, GlobalData, [&] {
+                createGlobals();
+            });
 
-            std::cout << "creating procedures...\n";
-            createProcedures();
+            size_t threads = analysisThreads;
 
-            std::cout << "creating while-loops...\n";
-            createWhileLoops(hiddenOffsets);
+            if(not threads) {
+                threads = commands.size() >= parallel_analysis_threshold ? ThreadPool::defaultThreadCount() : 1;
+            }
 
+            threads = std::min(threads, graph.width());
 
-            if(clean_decompile) {
-                std::cout << "removing dead code...\n";
-                removeDeadCode(hiddenOffsets);
+            if(scheduler and analysisThreads != 1) {
+                graph.run(*scheduler);
+            } else if(threads <= 1) {
+                graph.runSerially();
+            } else {
+                ThreadPool pool(threads);
+                graph.run(pool);
             }
 
-            std::cout << "creating labels...\n";
-            createLabels(hiddenOffsets);
+            if(stats) {
+                for(auto &pass : graph.all()) {
+                    stats->phases.push_back({ pass.name, pass.milliseconds, commands.size(), pass.peakRSSKilobytes });
+                }
+            }
 
-            std::cout << "creating globals...\n";
-            createGlobals();
+            *log << labelLocations.size() << " labels\n";
+            *log << globals.size() << " globals\n";
+
+            if(stats) {
+                // For loops are also while loops (they jump back to their condition).
+                size_t loops = std::count_if(ifStatements.begin(), ifStatements.end(), [](auto &ifPair) {
+                    return ifPair.second.flowType == FullIf::FlowWhile;
+                });
+
+                stats->count("instructions", commands.size());
+                stats->count("ifs", ifStatements.size() - loops);
+                stats->count("loops", loops);
+                stats->count("for_loops", forLoops.size());
+                stats->count("procedures", allProcedures.size());
+                stats->count("labels", labelLocations.size());
+                stats->count("globals", globals.size());
+            }
+        }
 
-            std::cout << labelLocations.size() << " labels\n";
-            std::cout << globals.size() << " globals\n";
+        // A command that render() prints.
+        struct RenderStep {
+            size_t index;
 
-            //for(auto &ifPair : ifStatements) {
-            // Hide 'if' jumps.
-            //hiddenOffsets.insert(ifPair.second.jifOffset);
-            //}
+            // Whether the command printed before this one was an if statement.
+            bool afterIf;
 
-            std::string topCommentFormat = "/*\n  Decompiled by miss3 on $0.\n*/\n";
-            std::string dateTime = currentDateString();
+            // Set on the command that makes options.errorLimit unknown commands in a row. Printing stops part way
+            //  through it.
+            bool stops = false;
+        };
 
-            std::cout << asComment(replaceTokens(topCommentFormat, {dateTime})) << '\n';
+        // The commands render() prints, in order. If statements print their conditions themselves, so the
+        //  commands up to their bodies are skipped.
+        std::vector<RenderStep> renderSteps(const std::set<int32_t> &hiddenOffsets) {
+            std::vector<RenderStep> steps;
 
             int consecErrors = 0;
-
             bool lastWasIf = false;
-            int lastIfLevel = 0;
+
             for(size_t commandIndex = 0; commandIndex < commands.size(); ++commandIndex) {
                 auto &cmd = commands[commandIndex];
 
@@ -761,106 +1023,286 @@ namespace miss2 {
                     continue;
                 }
 
-                int ifLevel = fullIndentLevelForOffset(cmd.offset);
+                steps.push_back({ commandIndex, lastWasIf });
 
-                std::string lineOffsetFormat = "/* $0 */ ";//labelLocations.count(cmd.offset) ? ("/* " + blueGreen + "$0 " + gray + "*/ ") : "/* $0 */ ";
+                auto statement = ifStatements.find(cmd.offset);
 
-                std::string linePadStr = replaceTokens("/* $0 */ ", {std::string(countDigits(cmd.offset), ' ')});
-                linePadStr = gray + linePadStr + std::string(ifLevel * indent_size, ' ');
+                if(statement != ifStatements.end()) {
+                    //options.showIfJumps = true;
+                    size_t bodyIndex = indexAtOffset(statement->second.bodyStartOffset) - (options.showIfJumps ? 2 : 1);
 
-                if(ifLevel != lastIfLevel) {
-                    //std::cout << linePadStr << '\n';
-                    //std::cout << linePadStr << "{\n";
+                    // Never go backwards, even if the if statement was made from badly decoded bytes.
+                    if(bodyIndex > commandIndex and bodyIndex < commands.size()) {
+                        commandIndex = bodyIndex;
+                    }
+
+                    lastWasIf = true;
+                    continue;
                 }
 
-                std::string lineOffsetStr = replaceTokens(lineOffsetFormat, {std::to_string(cmd.offset)});
-                lineOffsetStr = gray + lineOffsetStr + std::string(ifLevel * indent_size, ' ');
+                lastWasIf = false;
+
+                // Jumps to labels are printed with the label's name, so they never count as errors.
+                if(Goto::isJump(cmd)) {
+                    Goto jump(cmd);
 
-                if(labelLocations.count(cmd.offset)) {
-                    std::cout << linePadStr << '\n';
-                    std::cout << linePadStr << blueGreen << labelLocations[cmd.offset].name << ':' << codeColor << '\n';
+                    if(jump.jumpOpcode != Opcode::Call and labelLocations.count(jump.dest)) {
+                        continue;
+                    }
                 }
 
-                if(allProcedures.count(cmd.offset)) {
-                    lastWasIf = true;
-                    std::string declPad = replaceTokens("/* $0 */ ", {std::string(countDigits(cmd.offset), ' ')});
-                    declPad = gray + declPad + std::string(std::max(0, ifLevel - 1) * indent_size, ' ');
+                if(cmd.name.empty()) {
+                    if(++consecErrors >= options.errorLimit) {
+                        std::cerr << "Too many errors, stopping now.\n";
+                        steps.back().stops = true;
+                        break;
+                    }
+                } else {
+                    consecErrors = 0;
+                }
+            }
+
+            return steps;
+        }
+
+        void renderStep(std::ostream &out, const RenderStep &step, RenderState &state) {
+            auto &cmd = commands[step.index];
+            bool lastWasIf = step.afterIf;
+
+            int ifLevel = fullIndentLevelForOffset(cmd.offset);
+
+            std::string lineOffsetFormat = "/* $0 */ ";//labelLocations.count(cmd.offset) ? ("/* " + blueGreen + "$0 " + gray + "*/ ") : "/* $0 */ ";
+
+            std::string linePadStr = replaceTokens("/* $0 */ ", {std::string(countDigits(cmd.offset), ' ')});
+            linePadStr = gray + linePadStr + std::string(ifLevel * options.indentSize, ' ');
 
-                    std::cout << declPad << pink << "proc " << codeColor << allProcedures[cmd.offset].name << codeColor << "()\n";
+            std::string lineOffsetStr = replaceTokens(lineOffsetFormat, {std::to_string(cmd.offset)});
+            lineOffsetStr = gray + lineOffsetStr + std::string(ifLevel * options.indentSize, ' ');
+
+            if(labelLocations.count(cmd.offset)) {
+                out << linePadStr << '\n';
+                out << linePadStr << blueGreen << symbols->view(labelLocations.at(cmd.offset).name) << ':' << codeColor << '\n';
+            }
+
+            if(allProcedures.count(cmd.offset)) {
+                lastWasIf = true;
+                std::string declPad = replaceTokens("/* $0 */ ", {std::string(countDigits(cmd.offset), ' ')});
+                declPad = gray + declPad + std::string(std::max(0, ifLevel - 1) * options.indentSize, ' ');
+
+                out << declPad << pink << "proc " << codeColor << symbols->view(allProcedures.at(cmd.offset).name) << codeColor << "()\n";
+            }
+
+            if(ifStatements.count(cmd.offset)) {
+                FullIf &statement = ifStatements.at(cmd.offset);
+
+                // Add a new line before an if statement only when the last thing we printed was not an if.
+                if(not lastWasIf) {
+                    out << linePadStr << '\n';
                 }
 
-                if(ifStatements.count(cmd.offset)) {
-                    FullIf &statement = ifStatements[cmd.offset];
+                if(forLoops.count(cmd.offset)) {
+                    printInfo(out, linePadStr, forString(forLoops.at(cmd.offset), state));
+                }
 
-                    // Add a new line before an if statement only when the last thing we printed was not an if.
-                    if(not lastWasIf) {
-                        std::cout << linePadStr << '\n';
-                    }
+                out << lineOffsetStr << ifStatementString(statement, state) << '\n';
+                return;
+            }
 
-                    if(forLoops.count(cmd.offset)) {
-                        printInfo(linePadStr, forString(forLoops[cmd.offset]));
-                    }
+            std::string modelNames = modelComment(cmd);
+            if(not modelNames.empty()) {
+                out << linePadStr << modelNames << '\n';
+            }
 
-                    std::cout << lineOffsetStr << ifStatementString(statement) << '\n';
+            std::string labelComment = textLabelComment(cmd);
+            if(not labelComment.empty()) {
+                out << linePadStr << labelComment << '\n';
+            }
 
-                    //show_if_jumps = true;
-                    commandIndex = offsetsToIndices[statement.bodyStartOffset] - (show_if_jumps ? 2 : 1);
-                    lastWasIf = true;
-                    continue;
+            if(Goto::isJump(cmd)) {
+                Goto jump(cmd);
+                if(jump.dest < jump.source) {//} and commands[offsetsToIndices[jump.dest]].opcode == Opcode::If) {
+                    printInfo(out, linePadStr, "Backwards jump");
                 }
 
-                lastWasIf = false;
+                if(jump.jumpOpcode != Opcode::Call and labelLocations.count(jump.dest)) {
+                    out << lineOffsetStr << codeColor << replaceTokens(std::string(cmd.name), {blueGreen + std::string(symbols->view(labelLocations.at(jump.dest).name)) + codeColor}) << '\n';
+                    return;
+                }
+            }
+
+            //if(allProcedures.count(cmd.offset)) {
+            //    out << linePadStr << asComment("// " + allProcedures[cmd.offset].name) << codeColor << '\n';
+            //}
 
-                if(cmd.opcode == Opcode::DrivingCarWithModel) {
-                    auto id = cmd.parameters[1].cast<int16_t>();
-                    std::cout << linePadStr << vehicleModelComment(id) << '\n';
-                } else if(cmd.opcode == Opcode::RandomCarWithModel) {
-                    auto id = cmd.parameters[0].cast<int16_t>();
-                    std::cout << linePadStr << vehicleModelComment(id) << '\n';
+            std::vector<std::string> paramStrs = paramStringsForCommand(cmd, state);
+
+            if(cmd.name.empty()) {
+                cmd.name = symbols->internView(asComment("/* Unknown: 0x" + to_string_hex(cmd.opcode) + " */"));
+            }
+
+            // Checked apart from the name, which is already set if this run of commands is rendered again.
+            if(step.stops) return;
+
+            std::string commandString = commandToString(cmd, paramStrs);
+            out << lineOffsetStr << codeColor << commandString << ";\n";
+
+            if(cmd.opcode == Opcode::Return) out << linePadStr << '\n';
+        }
+
+        // Replaces the declaration markers in 'text' (see RenderState), declaring each local that isn't in
+        //  'known', and appends the result to 'out'. Returns false if 'text' has anything that looks like a
+        //  marker but isn't one of 'declarations', or is missing any of them.
+        static bool fillDeclarations(const std::string &text, const std::vector<std::pair<int16_t, std::string>> &declarations,
+                                     const std::set<int16_t> &known, std::string &out) {
+            std::vector<bool> filled(declarations.size(), false);
+            size_t filledCount = 0;
+
+            size_t position = 0;
+
+            while(true) {
+                size_t marker = text.find(declaration_marker, position);
+                out.append(text, position, marker == std::string::npos ? std::string::npos : marker - position);
+
+                if(marker == std::string::npos) break;
+
+                size_t markerEnd = text.find(declaration_marker_end, marker);
+                if(markerEnd == std::string::npos) return false;
+
+                size_t index;
+                auto result = std::from_chars(text.data() + marker + 1, text.data() + markerEnd, index);
+
+                if(result.ec != std::errc() or result.ptr != text.data() + markerEnd
+                   or index >= declarations.size() or filled[index]) {
+                    return false;
                 }
 
-                if(Goto::isJumpOpcode(cmd.opcode)) {
-                    Goto jump(cmd);
-                    if(jump.dest < jump.source) {//} and commands[offsetsToIndices[jump.dest]].opcode == Opcode::If) {
-                        printInfo(linePadStr, "Backwards jump");
-                    }
+                filled[index] = true;
+                ++filledCount;
 
-                    if(jump.jumpOpcode != Opcode::Call and labelLocations.count(jump.dest)) {
-                        std::cout << lineOffsetStr << codeColor << replaceTokens(cmd.name, {blueGreen + labelLocations[jump.dest].name + codeColor}) << '\n';
-                        continue;
+                auto &[local, declaration] = declarations[index];
+                if(not known.count(local)) out += declaration;
+
+                position = markerEnd + 1;
+            }
+
+            return filledCount == declarations.size();
+        }
+
+        // Renders runs of 'steps' as separate jobs on the scheduler and writes them out in order. Only a few
+        //  runs per worker are rendered at a time, and each is written out as soon as the runs before it have
+        //  been, so the whole text is never held in memory. A run whose text got in the way of the declaration
+        //  markers is rendered again on this thread, knowing which locals the runs before it declared.
+        void renderChunks(std::ostream &out, const std::vector<RenderStep> &steps) {
+            size_t chunkCount = steps.size() / render_chunk_commands;
+            size_t window = scheduler->size() * 4;
+
+            struct Chunk {
+                std::string text;
+                RenderState state;
+            };
+
+            auto firstStep = [&](size_t c) {
+                return steps.size() * c / chunkCount;
+            };
+
+            for(size_t windowStart = 0; windowStart < chunkCount; windowStart += window) {
+                size_t windowEnd = std::min(windowStart + window, chunkCount);
+
+                std::vector<Chunk> chunks(windowEnd - windowStart);
+                WorkStealingPool::TaskGroup group;
+
+                for(size_t c = windowStart; c < windowEnd; ++c) {
+                    scheduler->submit([&, c] {
+                        Chunk &chunk = chunks[c - windowStart];
+
+                        std::ostringstream stream;
+                        chunk.state.deferDeclarations = true;
+
+                        for(size_t i = firstStep(c); i < firstStep(c + 1); ++i) {
+                            renderStep(stream, steps[i], chunk.state);
+                        }
+
+                        chunk.text = std::move(stream).str();
+                    }, &group);
+                }
+
+                scheduler->wait(group);
+
+                // A run declares a local only if no earlier run used it.
+                for(size_t c = windowStart; c < windowEnd; ++c) {
+                    Chunk &chunk = chunks[c - windowStart];
+                    std::string text;
+
+                    if(fillDeclarations(chunk.text, chunk.state.declarations, knownLocals, text)) {
+                        knownLocals.insert(chunk.state.knownLocals.begin(), chunk.state.knownLocals.end());
+                        out << text;
+                    } else {
+                        RenderState state;
+                        state.knownLocals = std::move(knownLocals);
+
+                        for(size_t i = firstStep(c); i < firstStep(c + 1); ++i) {
+                            renderStep(out, steps[i], state);
+                        }
+
+                        knownLocals = std::move(state.knownLocals);
                     }
+
+                    chunk = Chunk();
                 }
+            }
+        }
 
-                //if(allProcedures.count(cmd.offset)) {
-                //    std::cout << linePadStr << asComment("// " + allProcedures[cmd.offset].name) << codeColor << '\n';
-                //}
+        // Writes the code for an analysed script to 'out'.
+        void render(std::ostream &out, const std::set<int32_t> &hiddenOffsets) {
+            Stats::Timer timer(stats, "render", commands.size());
 
-                std::vector<std::string> paramStrs = paramStringsForCommand(cmd);
+            //for(auto &ifPair : ifStatements) {
+            // Hide 'if' jumps.
+            //hiddenOffsets.insert(ifPair.second.jifOffset);
+            //}
 
-                if(cmd.name.empty()) {
-                    cmd.name = asComment("/* Unknown: 0x" + to_string_hex(cmd.opcode) + " */");
-                    if(++consecErrors >= error_limit) {
-                        std::cerr << "Too many errors, stopping now.\n";
-                        return;
+            std::string topCommentFormat = "/*\n  Decompiled by miss3 on $0.\n*/\n";
+            std::string dateTime = currentDateString();
+
+            out << asComment(replaceTokens(topCommentFormat, {dateTime})) << '\n';
+
+            // Array indices can be globals that nothing else uses. Add and name them all now, so that printing
+            //  only ever looks the globals up.
+            for(Command &cmd : commands) {
+                for(Value &p : cmd.parameters) {
+                    if(isArrayType(p.type) and p.cast<ArrayObject>().properties.isIndexGlobalVar) {
+                        globals[p.cast<ArrayObject>().arrayIndex];
                     }
-                } else {
-                    consecErrors = 0;
                 }
+            }
+
+            for(auto &globalPair : globals) {
+                globStr(globalPair.second);
+            }
+
+            std::vector<RenderStep> steps = renderSteps(hiddenOffsets);
 
-                std::string commandString = commandToString(cmd, paramStrs);
-                std::cout << lineOffsetStr << codeColor << commandString << ";\n";
+            if(scheduler and steps.size() >= 2 * render_chunk_commands) {
+                renderChunks(out, steps);
+                return;
+            }
 
-                //if(lastIfLevel > ifLevel) {
-                //    std::cout << linePadStr << "}\n";
-                //}
-                //size_t nextIndex = commandIndex + 1;
-                //if(nextIndex == commands.size()) {
-                //
-                //}
+            RenderState state;
+            state.knownLocals = std::move(knownLocals);
 
-                lastIfLevel = ifLevel;
-                if(cmd.opcode == Opcode::Return) std::cout << linePadStr << '\n';
+            for(const RenderStep &step : steps) {
+                renderStep(out, step, state);
             }
+
+            knownLocals = std::move(state.knownLocals);
+        }
+
+        void prettyPrint(std::ostream &out = std::cout) {
+            // Offsets of commands that shouldn't be printed.
+            std::set<int32_t> hiddenOffsets;
+
+            analyse(hiddenOffsets);
+            render(out, hiddenOffsets);
         }
     };
 }
@@ -0,0 +1,511 @@
+/*
+ * Pattern search over decoded instruction streams.
+ *
+ * A pattern is a sequence of steps separated by spaces. Each step matches one instruction:
+ *
+ *   00DD               opcode 0x00DD, negated or not (0x80DD also matches)
+ *   80DD               only the negated form
+ *   0327(_, 400)       opcode 0x0327 whose second parameter is 400 (the first can be anything)
+ *   ?(_, 'BCESAR')     any opcode whose second parameter is the string BCESAR
+ *   *                  any one instruction
+ *   ...                any number of instructions (including none) before the next step. Once the step
+ *                       before the gap has matched, every later match of the step after it can continue
+ *                       from its most recent match.
+ *
+ * Parameter predicates are positional. Parameters without a predicate, and any after the last one, can
+ *  be anything.
+ *
+ *   _                  anything
+ *   400, -1, 0x10      an integer immediate with this value
+ *   1.5                a float immediate with this value
+ *   !400, <400, >400   an integer or float immediate that is not equal to, less than or greater than 400
+ *   'TEXT'             a string immediate with this text (not case-sensitive)
+ *   $12                global variable 12 (scalar, string or array)
+ *   @3                 local variable 3
+ *
+ * The steps are compiled into a bit-parallel (shift-and) automaton with one bit per step. For each opcode,
+ *  a precomputed mask gives the steps that can accept it, so parameters only need to be examined for steps
+ *  that have predicates. Scripts are decoded with the flat decoder, so many files can be searched at once.
+ */
+
+#ifndef GTASM_SEARCH_HPP
+#define GTASM_SEARCH_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <charconv>
+#include <algorithm>
+#include <mutex>
+#include <cmath>
+#include <iostream>
+#include "opcode_table.hpp"
+#include "../work_stealing.hpp"
+#include "../util.hpp"
+
+namespace miss2 {
+    struct ParamPredicate {
+        enum Kind {
+            Any,
+            Equal,
+            NotEqual,
+            Less,
+            Greater,
+            Text,
+            Global,
+            Local
+        } kind = Any;
+
+        // Compared as a float if the pattern had a decimal point.
+        bool isFloat = false;
+        double number = 0;
+        std::string text;
+
+        bool matches(const FlatParam &param) const {
+            switch(kind) {
+                case Any:
+                    return true;
+
+                case Global:
+                    return param.isGlobalVariable() and param.integer() == int64_t(number);
+
+                case Local:
+                    return param.isLocalVariable() and param.integer() == int64_t(number);
+
+                case Text: {
+                    if(not param.isString()) return false;
+
+                    std::string_view value = param.text();
+                    return value.size() == text.size() and std::equal(value.begin(), value.end(), text.begin(), [](char a, char b) {
+                        return std::toupper((unsigned char)a) == std::toupper((unsigned char)b);
+                    });
+                }
+
+                default:
+                    break;
+            }
+
+            double value;
+            if(param.isInteger()) {
+                value = double(param.integer());
+            } else if(param.type == F32) {
+                value = param.floatValue();
+            } else {
+                return false;
+            }
+
+            if(isFloat and param.type == F32) {
+                // Floats in scripts are rarely exact, so allow for rounding in the pattern.
+                double difference = std::abs(value - number);
+                bool equal = difference <= 1e-4 * std::max(1.0, std::abs(number));
+
+                if(kind == Equal) return equal;
+                if(kind == NotEqual) return not equal;
+            }
+
+            switch(kind) {
+                case Equal:
+                    return value == number;
+                case NotEqual:
+                    return value != number;
+                case Less:
+                    return value < number;
+                case Greater:
+                    return value > number;
+                default:
+                    return false;
+            }
+        }
+    };
+
+    struct PatternStep {
+        // -1 for any opcode.
+        int32_t opcode = -1;
+
+        // If false, the negation bit (0x8000) is ignored when comparing opcodes.
+        bool exactOpcode = false;
+
+        // True for '*', which accepts any instruction without looking at it.
+        bool anyInstruction = false;
+
+        // Any number of instructions may come between the previous step and this one.
+        bool gapBefore = false;
+
+        std::vector<ParamPredicate> predicates;
+
+        bool acceptsOpcode(uint16_t candidate) const {
+            if(opcode < 0) return true;
+            return exactOpcode ? candidate == opcode : (candidate & 0x7FFF) == (opcode & 0x7FFF);
+        }
+
+        bool acceptsParams(const FlatInstruction &instruction) const {
+            if(predicates.size() > instruction.paramCount) {
+                // Only a problem if one of the missing parameters needed to match something.
+                for(size_t i = instruction.paramCount; i < predicates.size(); ++i) {
+                    if(predicates[i].kind != ParamPredicate::Any) return false;
+                }
+            }
+
+            size_t count = std::min<size_t>(predicates.size(), instruction.paramCount);
+            for(size_t i = 0; i < count; ++i) {
+                if(not predicates[i].matches(instruction.params[i])) return false;
+            }
+
+            return true;
+        }
+    };
+
+    struct SearchMatch {
+        std::string file;
+
+        // Offsets of the first and last instructions in the match.
+        uint32_t offset;
+        uint32_t endOffset;
+
+        bool operator<(const SearchMatch &other) const {
+            return std::tie(file, offset, endOffset) < std::tie(other.file, other.offset, other.endOffset);
+        }
+    };
+
+    class SearchPattern {
+        std::vector<PatternStep> steps;
+
+        // Bit i is set in opcodeMasks[op] if step i can accept opcode op.
+        std::vector<uint64_t> opcodeMasks;
+
+        // Steps that need their parameters checked.
+        uint64_t predicateMask = 0;
+
+        // Steps which are followed by a '...' gap. Once one of these is reached, it stays reached.
+        uint64_t gapSourceMask = 0;
+
+        uint64_t finalBit = 0;
+
+        static void skipSpaces(std::string_view text, size_t &i) {
+            while(i < text.size() and std::isspace((unsigned char)text[i])) ++i;
+        }
+
+        static bool parseNumber(std::string_view text, ParamPredicate &predicate) {
+            bool negative = text.starts_with('-');
+            std::string_view digits = negative ? text.substr(1) : text;
+
+            if(digits.starts_with("0x") or digits.starts_with("0X")) {
+                int64_t value;
+                auto result = std::from_chars(digits.data() + 2, digits.data() + digits.size(), value, 16);
+                if(result.ec != std::errc() or result.ptr != digits.data() + digits.size()) return false;
+
+                predicate.number = double(negative ? -value : value);
+                return true;
+            }
+
+            // from_chars for floating point isn't available everywhere, so use strtod on a copy.
+            std::string copy(text);
+            char *parseEnd = nullptr;
+            predicate.number = std::strtod(copy.c_str(), &parseEnd);
+            predicate.isFloat = copy.find('.') != std::string::npos;
+
+            return not copy.empty() and parseEnd == copy.c_str() + copy.size();
+        }
+
+        static bool parsePredicate(std::string_view text, ParamPredicate &predicate, std::string &error) {
+            if(text == "_" or text == "*") {
+                predicate.kind = ParamPredicate::Any;
+                return true;
+            }
+
+            if(text.size() >= 2 and (text.front() == '\'' or text.front() == '"') and text.back() == text.front()) {
+                predicate.kind = ParamPredicate::Text;
+                predicate.text = text.substr(1, text.size() - 2);
+                return true;
+            }
+
+            ParamPredicate::Kind kind = ParamPredicate::Equal;
+
+            switch(text.front()) {
+                case '!':
+                    kind = ParamPredicate::NotEqual;
+                    break;
+                case '<':
+                    kind = ParamPredicate::Less;
+                    break;
+                case '>':
+                    kind = ParamPredicate::Greater;
+                    break;
+                case '$':
+                    kind = ParamPredicate::Global;
+                    break;
+                case '@':
+                    kind = ParamPredicate::Local;
+                    break;
+                default:
+                    break;
+            }
+
+            std::string_view numberText = kind == ParamPredicate::Equal ? text : text.substr(1);
+            predicate.kind = kind;
+
+            if(not parseNumber(numberText, predicate)) {
+                error = "bad parameter predicate '" + std::string(text) + "'";
+                return false;
+            }
+
+            return true;
+        }
+
+        void build() {
+            opcodeMasks.assign(0x10000, 0);
+            predicateMask = gapSourceMask = 0;
+
+            for(size_t i = 0; i < steps.size(); ++i) {
+                uint64_t bit = uint64_t(1) << i;
+                const PatternStep &step = steps[i];
+
+                for(uint32_t opcode = 0; opcode < 0x10000; ++opcode) {
+                    if(step.anyInstruction or step.acceptsOpcode(uint16_t(opcode))) {
+                        opcodeMasks[opcode] |= bit;
+                    }
+                }
+
+                bool hasPredicates = std::any_of(step.predicates.begin(), step.predicates.end(), [](const ParamPredicate &p) {
+                    return p.kind != ParamPredicate::Any;
+                });
+
+                if(hasPredicates) predicateMask |= bit;
+                if(step.gapBefore and i > 0) gapSourceMask |= bit >> 1;
+            }
+
+            finalBit = uint64_t(1) << (steps.size() - 1);
+        }
+
+    public:
+        // Parses and compiles a pattern. On failure, 'error' says what was wrong.
+        static bool compile(std::string_view text, SearchPattern &pattern, std::string &error) {
+            pattern = {};
+            bool gapPending = false;
+
+            size_t i = 0;
+            while(true) {
+                skipSpaces(text, i);
+                if(i >= text.size()) break;
+
+                if(text.substr(i).starts_with("...")) {
+                    gapPending = true;
+                    i += 3;
+                    continue;
+                }
+
+                PatternStep step;
+                step.gapBefore = gapPending and not pattern.steps.empty();
+                gapPending = false;
+
+                if(text[i] == '*') {
+                    step.anyInstruction = true;
+                    ++i;
+                } else if(text[i] == '?') {
+                    ++i;
+                } else {
+                    size_t start = i;
+                    if(text.substr(i).starts_with("0x") or text.substr(i).starts_with("0X")) i += 2;
+
+                    size_t digitsStart = i;
+                    while(i < text.size() and std::isxdigit((unsigned char)text[i])) ++i;
+
+                    uint32_t opcode = 0;
+                    auto result = std::from_chars(text.data() + digitsStart, text.data() + i, opcode, 16);
+                    if(result.ec != std::errc() or i == digitsStart or opcode > 0xFFFF) {
+                        error = "expected an opcode at '" + std::string(text.substr(start, 12)) + "'";
+                        return false;
+                    }
+
+                    step.opcode = int32_t(opcode);
+                    step.exactOpcode = opcode & 0x8000;
+                }
+
+                if(i < text.size() and text[i] == '(') {
+                    if(step.anyInstruction) {
+                        error = "'*' can't have parameter predicates (use '?' instead)";
+                        return false;
+                    }
+
+                    size_t close = i + 1;
+                    char quote = 0;
+
+                    for(; close < text.size(); ++close) {
+                        char c = text[close];
+
+                        if(quote) {
+                            if(c == quote) quote = 0;
+                        } else if(c == '\'' or c == '"') {
+                            quote = c;
+                        } else if(c == ')') {
+                            break;
+                        }
+                    }
+
+                    if(close >= text.size()) {
+                        error = "missing ')'";
+                        return false;
+                    }
+
+                    std::string_view inside = text.substr(i + 1, close - i - 1);
+
+                    // Split on commas that aren't inside quotes.
+                    size_t partStart = 0;
+                    quote = 0;
+
+                    for(size_t j = 0; j <= inside.size(); ++j) {
+                        char c = j < inside.size() ? inside[j] : ',';
+
+                        if(quote) {
+                            if(c == quote) quote = 0;
+                            continue;
+                        }
+
+                        if(c == '\'' or c == '"') {
+                            quote = c;
+                            continue;
+                        }
+
+                        if(c != ',') continue;
+
+                        std::string part(inside.substr(partStart, j - partStart));
+                        trim(part);
+                        partStart = j + 1;
+
+                        if(part.empty()) {
+                            if(inside.empty()) break;
+
+                            error = "empty parameter predicate";
+                            return false;
+                        }
+
+                        ParamPredicate predicate;
+                        if(not parsePredicate(part, predicate, error)) return false;
+
+                        step.predicates.push_back(predicate);
+                    }
+
+                    i = close + 1;
+                }
+
+                if(i < text.size() and not std::isspace((unsigned char)text[i])) {
+                    error = "unexpected '" + std::string(1, text[i]) + "'";
+                    return false;
+                }
+
+                pattern.steps.push_back(step);
+            }
+
+            if(pattern.steps.empty()) {
+                error = "empty pattern";
+                return false;
+            }
+
+            if(gapPending) {
+                error = "'...' must be followed by another step";
+                return false;
+            }
+
+            if(pattern.steps.size() > 64) {
+                error = "patterns are limited to 64 steps";
+                return false;
+            }
+
+            pattern.build();
+            return true;
+        }
+
+        size_t size() const {
+            return steps.size();
+        }
+
+        // Calls handler(startOffset, endOffset) for each match in a script, in order of where they end.
+        template <typename Handler>
+        void scan(const OpcodeTable &table, const uint8_t *bytes, size_t size, Handler &&handler) const {
+            FlatDecoder decoder(table, bytes, size);
+            FlatInstruction instruction;
+
+            // Bit i of 'active' is set when steps 0 to i match, ending at the last instruction.
+            uint64_t active = 0, waiting = 0;
+
+            // Offset of the first instruction of the partial match for each active or waiting step.
+            uint32_t starts[64];
+
+            while(decoder.next(instruction)) {
+                uint64_t candidates = opcodeMasks[instruction.opcode];
+
+                // Step i can follow on from step i - 1 (or start a match if i is 0).
+                uint64_t reachable = ((active | waiting) << 1) | 1;
+                uint64_t next = reachable & candidates;
+
+                for(uint64_t check = next & predicateMask; check; check &= check - 1) {
+                    int step = __builtin_ctzll(check);
+
+                    if(not steps[step].acceptsParams(instruction)) {
+                        next &= ~(uint64_t(1) << step);
+                    }
+                }
+
+                if(next) {
+                    // The new starts must all come from the previous instruction's state.
+                    uint32_t newStarts[64];
+
+                    for(uint64_t bits = next; bits; bits &= bits - 1) {
+                        int step = __builtin_ctzll(bits);
+
+                        // starts[step - 1] is the most recent start for the previous step, so the shortest
+                        //  match is reported when there is a choice.
+                        newStarts[step] = step == 0 ? instruction.offset : starts[step - 1];
+                    }
+
+                    for(uint64_t bits = next; bits; bits &= bits - 1) {
+                        int step = __builtin_ctzll(bits);
+                        starts[step] = newStarts[step];
+                    }
+                }
+
+                if(next & finalBit) {
+                    handler(starts[steps.size() - 1], instruction.offset);
+                }
+
+                // A step before a gap stays reached for the rest of the script, because any later match of
+                //  the step after the gap can continue from it (the first one might not lead to a match).
+                waiting = (waiting | next) & gapSourceMask;
+                active = next;
+            }
+        }
+    };
+
+    // Searches every file on 'pool', biggest first. Matches are sorted by file and offset. Files that can't be
+    //  read are reported to 'log'.
+    inline std::vector<SearchMatch> searchFiles(const std::vector<std::string> &paths, const SearchPattern &pattern,
+                                                const OpcodeTable &table, WorkStealingPool &pool,
+                                                std::ostream &log = std::cerr) {
+        std::vector<SearchMatch> matches;
+        std::mutex matchesLock;
+
+        forEachFileLargestFirst(pool, paths, [&](size_t i) {
+            const std::string &path = paths[i];
+
+            MappedFile file(path.c_str());
+            if(not file) {
+                std::lock_guard<std::mutex> guard(matchesLock);
+                log << "error: could not read " << path << '\n';
+                return;
+            }
+
+            std::vector<SearchMatch> found;
+            pattern.scan(table, file.data, file.size, [&](uint32_t start, uint32_t end) {
+                found.push_back({ path, start, end });
+            });
+
+            std::lock_guard<std::mutex> guard(matchesLock);
+            matches.insert(matches.end(), found.begin(), found.end());
+        });
+
+        std::sort(matches.begin(), matches.end());
+        return matches;
+    }
+}
+
+#endif //GTASM_SEARCH_HPP
@@ -0,0 +1,417 @@
+/*
+ * Parameter signatures learned from a corpus of scripts. The opcode database only says how many parameters
+ *  an opcode takes, not what types they are, so this decodes many scripts at once and counts, for every
+ *  opcode, how often each type tag appears at each parameter position and how many parameters each use had
+ *  (which only varies for variadic opcodes). The counts can be saved and loaded again, so they only have to
+ *  be learned once.
+ *
+ * An instruction whose parameters don't look like the ones the corpus uses is most likely data, or the
+ *  result of the decoder losing its place, so check() flags it.
+ *
+ * File format (little-endian; varints are unsigned LEB128 as in ir.hpp):
+ *
+ *   char[4]  "GSIG"
+ *   u32      version (1)
+ *   u32      number of scripts learned from
+ *   u32      opcode count
+ *   opcodes, in order:
+ *     varint   opcode, as a difference from the previous opcode
+ *     varint   uses
+ *     varint   arity count, then for each: varint parameter count, varint uses
+ *     varint   position count, then for each position:
+ *       u8       number of types seen, then for each: u8 type tag, varint uses
+ */
+
+#ifndef GTASM_SIGNATURES_HPP
+#define GTASM_SIGNATURES_HPP
+
+#include <array>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+#include "opcode_table.hpp"
+#include "ir.hpp"
+#include "../work_stealing.hpp"
+#include "../util.hpp"
+
+namespace miss2 {
+    // Type tags are 0 up to (but not including) Unknown.
+    static const size_t type_tag_count = Unknown;
+
+    struct OpcodeSignature {
+        uint64_t uses = 0;
+
+        // How many uses had each number of parameters, not counting the EOAL.
+        std::map<uint32_t, uint64_t> arities;
+
+        // How many uses had each type tag at each parameter position.
+        std::vector<std::array<uint64_t, type_tag_count>> types;
+
+        void add(const FlatInstruction &instruction) {
+            ++uses;
+            ++arities[instruction.paramCount];
+
+            if(types.size() < instruction.paramCount) types.resize(instruction.paramCount, {});
+
+            for(int i = 0; i < instruction.paramCount; ++i) {
+                ++types[i][instruction.params[i].type];
+            }
+        }
+
+        void merge(const OpcodeSignature &other) {
+            uses += other.uses;
+
+            for(auto &[arity, count] : other.arities) arities[arity] += count;
+
+            if(types.size() < other.types.size()) types.resize(other.types.size(), {});
+
+            for(size_t i = 0; i < other.types.size(); ++i) {
+                for(size_t type = 0; type < type_tag_count; ++type) {
+                    types[i][type] += other.types[i][type];
+                }
+            }
+        }
+
+        // Uses that had a parameter at 'position'.
+        uint64_t usesAt(size_t position) const {
+            if(position >= types.size()) return 0;
+
+            uint64_t total = 0;
+            for(uint64_t count : types[position]) total += count;
+
+            return total;
+        }
+
+        // The only type seen at 'position', or Unknown if there were none or several.
+        DataType onlyType(size_t position) const {
+            if(position >= types.size()) return Unknown;
+
+            DataType found = Unknown;
+
+            for(size_t type = 0; type < type_tag_count; ++type) {
+                if(not types[position][type]) continue;
+                if(found != Unknown) return Unknown;
+
+                found = DataType(type);
+            }
+
+            return found;
+        }
+
+        // Whether every use had the same number of parameters, of the same types.
+        bool fixed() const {
+            if(arities.size() != 1) return false;
+
+            for(size_t i = 0; i < types.size(); ++i) {
+                if(onlyType(i) == Unknown) return false;
+            }
+
+            return true;
+        }
+    };
+
+    enum class SignatureMismatch : uint8_t {
+        None = 0,
+
+        // The opcode is registered but no script in the corpus uses it.
+        UnseenOpcode,
+
+        // The corpus (almost) never uses the opcode with this many parameters.
+        UnusualArity,
+
+        // The corpus (almost) never has a parameter of this type at this position.
+        UnusualType,
+    };
+
+    inline const char *signatureMismatchName(SignatureMismatch mismatch) {
+        switch(mismatch) {
+            case SignatureMismatch::UnseenOpcode:
+                return "opcode not used in the corpus";
+            case SignatureMismatch::UnusualArity:
+                return "unusual parameter count";
+            case SignatureMismatch::UnusualType:
+                return "unusual parameter type";
+            default:
+                return "none";
+        }
+    }
+
+    struct SignatureCheck {
+        SignatureMismatch mismatch = SignatureMismatch::None;
+
+        // The parameter with the unusual type.
+        int parameter = -1;
+
+        explicit operator bool() const {
+            return mismatch != SignatureMismatch::None;
+        }
+    };
+
+    class SignatureDatabase {
+        static constexpr char file_magic[4] = { 'G', 'S', 'I', 'G' };
+        static const uint32_t file_version = 1;
+
+        std::map<uint16_t, OpcodeSignature> signatures;
+        size_t scriptCount = 0;
+
+        // Guards the counts while scripts are added, and the log.
+        std::mutex mergeLock;
+
+    public:
+        // An arity or type is only unusual if the opcode has been seen at least this many times, and it makes
+        //  up less than 1 / outlier_ratio of them. A type that was never seen at all is always unusual.
+        static const uint64_t outlier_min_uses = 50;
+        static const uint64_t outlier_ratio = 500;
+
+        SignatureDatabase() = default;
+        SignatureDatabase(const SignatureDatabase &) = delete;
+        SignatureDatabase &operator=(const SignatureDatabase &) = delete;
+
+        // Counts the parameters of the known instructions in 'bytes'.
+        static void learnScript(const OpcodeTable &table, const uint8_t *bytes, size_t size,
+                                std::unordered_map<uint16_t, OpcodeSignature> &learned) {
+            FlatDecoder decoder(table, bytes, size);
+            FlatInstruction instruction;
+
+            while(decoder.next(instruction)) {
+                if(instruction.known) learned[instruction.opcode].add(instruction);
+            }
+        }
+
+        // Decodes 'paths' on 'pool', biggest first, and adds what they use to the database.
+        void addScripts(const std::vector<std::string> &paths, const OpcodeTable &table,
+                        WorkStealingPool &pool, std::ostream &log = std::cerr) {
+            forEachFileLargestFirst(pool, paths, [&](size_t i) {
+                MappedFile file(paths[i].c_str());
+
+                if(not file) {
+                    std::lock_guard<std::mutex> guard(mergeLock);
+                    log << "error: could not read " << paths[i] << '\n';
+
+                    return;
+                }
+
+                std::unordered_map<uint16_t, OpcodeSignature> learned;
+                learnScript(table, file.data, file.size, learned);
+
+                std::lock_guard<std::mutex> guard(mergeLock);
+
+                for(auto &[opcode, signature] : learned) {
+                    signatures[opcode].merge(signature);
+                }
+
+                ++scriptCount;
+            });
+        }
+
+        size_t scripts() const {
+            return scriptCount;
+        }
+
+        const std::map<uint16_t, OpcodeSignature> &all() const {
+            return signatures;
+        }
+
+        // The signature of an opcode, or null if the corpus never used it.
+        const OpcodeSignature *find(uint16_t opcode) const {
+            auto found = signatures.find(opcode);
+            return found == signatures.end() ? nullptr : &found->second;
+        }
+
+        // Whether an instruction's parameters look like the ones the corpus uses for its opcode. Only the
+        //  first FlatInstruction::max_params parameters are checked.
+        SignatureCheck check(const FlatInstruction &instruction) const {
+            SignatureCheck result;
+            if(not instruction.known) return result;
+
+            const OpcodeSignature *signature = find(instruction.opcode);
+
+            if(not signature) {
+                result.mismatch = SignatureMismatch::UnseenOpcode;
+                return result;
+            }
+
+            auto unusual = [&](uint64_t count, uint64_t total) {
+                return count == 0 or (total >= outlier_min_uses and count * outlier_ratio < total);
+            };
+
+            auto arity = signature->arities.find(instruction.paramCount);
+
+            if(unusual(arity == signature->arities.end() ? 0 : arity->second, signature->uses)) {
+                result.mismatch = SignatureMismatch::UnusualArity;
+                return result;
+            }
+
+            for(int i = 0; i < instruction.paramCount; ++i) {
+                uint64_t count = size_t(i) < signature->types.size() ? signature->types[i][instruction.params[i].type] : 0;
+
+                if(unusual(count, signature->usesAt(i))) {
+                    result.mismatch = SignatureMismatch::UnusualType;
+                    result.parameter = i;
+
+                    return result;
+                }
+            }
+
+            return result;
+        }
+
+        std::vector<uint8_t> encodeBinary() const {
+            std::vector<uint8_t> out(file_magic, file_magic + 4);
+
+            appendLE(out, file_version);
+            appendLE(out, uint32_t(scriptCount));
+            appendLE(out, uint32_t(signatures.size()));
+
+            uint16_t previousOpcode = 0;
+
+            for(auto &[opcode, signature] : signatures) {
+                appendVarint(out, opcode - previousOpcode);
+                appendVarint(out, signature.uses);
+
+                appendVarint(out, signature.arities.size());
+
+                for(auto &[arity, count] : signature.arities) {
+                    appendVarint(out, arity);
+                    appendVarint(out, count);
+                }
+
+                appendVarint(out, signature.types.size());
+
+                for(auto &counts : signature.types) {
+                    uint8_t seen = 0;
+                    for(uint64_t count : counts) seen += count != 0;
+
+                    out.push_back(seen);
+
+                    for(size_t type = 0; type < type_tag_count; ++type) {
+                        if(not counts[type]) continue;
+
+                        out.push_back(uint8_t(type));
+                        appendVarint(out, counts[type]);
+                    }
+                }
+
+                previousOpcode = opcode;
+            }
+
+            return out;
+        }
+
+        // Replaces the contents of the database with the encoded one in 'bytes'. Returns false (leaving the
+        //  database empty) if the data is damaged or from a different version.
+        bool decodeBinary(const uint8_t *bytes, size_t size) {
+            signatures.clear();
+            scriptCount = 0;
+
+            const uint8_t *cursor = bytes, *end = bytes + size;
+
+            if(size < 16 or std::memcmp(bytes, file_magic, 4) != 0) return false;
+
+            uint32_t version, scripts, opcodeCount;
+            std::memcpy(&version, bytes + 4, 4);
+            std::memcpy(&scripts, bytes + 8, 4);
+            std::memcpy(&opcodeCount, bytes + 12, 4);
+            cursor += 16;
+
+            if(version != file_version) return false;
+
+            uint64_t opcode = 0;
+
+            for(uint32_t o = 0; o < opcodeCount; ++o) {
+                uint64_t delta, uses, arityCount, positionCount;
+
+                if(not readVarint(cursor, end, delta) or not readVarint(cursor, end, uses)) break;
+
+                opcode += delta;
+                if(opcode > 0xFFFF or (o and not delta)) break;
+
+                OpcodeSignature &signature = signatures[uint16_t(opcode)];
+                signature.uses = uses;
+
+                if(not readVarint(cursor, end, arityCount)) break;
+
+                bool damaged = false;
+
+                for(uint64_t a = 0; a < arityCount and not damaged; ++a) {
+                    uint64_t arity, count;
+                    damaged = not readVarint(cursor, end, arity) or not readVarint(cursor, end, count)
+                        or arity > FlatInstruction::max_params;
+
+                    if(not damaged) signature.arities[uint32_t(arity)] = count;
+                }
+
+                if(damaged or not readVarint(cursor, end, positionCount) or positionCount > FlatInstruction::max_params) break;
+
+                signature.types.resize(positionCount, {});
+
+                for(uint64_t p = 0; p < positionCount and not damaged; ++p) {
+                    if(cursor >= end) {
+                        damaged = true;
+                        break;
+                    }
+
+                    uint8_t seen = *(cursor++);
+
+                    for(uint8_t t = 0; t < seen and not damaged; ++t) {
+                        uint64_t count;
+                        damaged = cursor >= end or *cursor >= type_tag_count;
+
+                        if(damaged) break;
+
+                        uint8_t type = *(cursor++);
+                        damaged = not readVarint(cursor, end, count);
+
+                        if(not damaged) signature.types[p][type] = count;
+                    }
+                }
+
+                if(damaged) break;
+            }
+
+            if(signatures.size() != opcodeCount or cursor != end) {
+                signatures.clear();
+                return false;
+            }
+
+            scriptCount = scripts;
+            return true;
+        }
+
+        bool writeBinary(const std::string &path, std::ostream &log = std::cerr) const {
+            auto bytes = encodeBinary();
+
+            std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+            stream.write((const char *)bytes.data(), std::streamsize(bytes.size()));
+
+            if(not stream) {
+                log << "error: failed to write " << path << '\n';
+                return false;
+            }
+
+            return true;
+        }
+
+        bool readBinary(const std::string &path, std::ostream &log = std::cerr) {
+            MappedFile file(path.c_str());
+
+            if(not file) {
+                log << "error: could not read " << path << '\n';
+                return false;
+            }
+
+            if(not decodeBinary(file.data, file.size)) {
+                log << "error: " << path << " is not a signature database (or is damaged)\n";
+                return false;
+            }
+
+            return true;
+        }
+    };
+}
+
+#endif //GTASM_SIGNATURES_HPP
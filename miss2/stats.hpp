@@ -0,0 +1,127 @@
+//
+// Per-phase timing, counters and peak memory for a decompilation, written as JSON.
+//
+
+#ifndef GTASM_STATS_HPP
+#define GTASM_STATS_HPP
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace miss2 {
+    struct PhaseStats {
+        std::string name;
+        double milliseconds;
+
+        // Number of commands the phase worked on.
+        size_t instructions;
+
+        // Peak resident set size of the process when the phase finished.
+        long peakRSSKilobytes;
+    };
+
+    struct Stats {
+        std::vector<PhaseStats> phases;
+
+        // Counters in the order they were first set.
+        std::vector<std::pair<std::string, size_t>> counters;
+
+        // Records a phase when it goes out of scope. Does nothing if there is nowhere to record it, so
+        //  callers don't need to check whether stats are wanted.
+        class Timer {
+            Stats *stats;
+            std::string name;
+            std::chrono::steady_clock::time_point start;
+
+        public:
+            size_t instructions;
+
+            Timer(Stats *stats, std::string name, size_t instructions = 0)
+                : stats { stats }, name { std::move(name) }, start { std::chrono::steady_clock::now() }, instructions { instructions } {}
+
+            Timer(const Timer &) = delete;
+            Timer &operator=(const Timer &) = delete;
+
+            ~Timer() {
+                if(not stats) return;
+
+                double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                stats->phases.push_back({ name, elapsed, instructions, peakRSSKilobytes() });
+            }
+        };
+
+        static long peakRSSKilobytes() {
+            rusage usage {};
+            getrusage(RUSAGE_SELF, &usage);
+
+            // Linux reports kilobytes, macOS reports bytes.
+#ifdef __APPLE__
+            return usage.ru_maxrss / 1024;
+#else
+            return usage.ru_maxrss;
+#endif
+        }
+
+        void count(const std::string &name, size_t value) {
+            for(auto &counter : counters) {
+                if(counter.first == name) {
+                    counter.second = value;
+                    return;
+                }
+            }
+
+            counters.emplace_back(name, value);
+        }
+
+        void writeJSON(std::ostream &out) const {
+            double total = 0;
+            for(const PhaseStats &phase : phases) total += phase.milliseconds;
+
+            out << std::fixed << std::setprecision(4);
+            out << "{\n  \"phases\": [\n";
+
+            for(size_t i = 0; i < phases.size(); ++i) {
+                const PhaseStats &phase = phases[i];
+
+                out << "    {\"name\": \"" << phase.name << "\", \"ms\": " << phase.milliseconds
+                    << ", \"instructions\": " << phase.instructions << ", \"peak_rss_kb\": " << phase.peakRSSKilobytes << '}'
+                    << (i + 1 < phases.size() ? ",\n" : "\n");
+            }
+
+            out << "  ],\n  \"counters\": {";
+
+            for(size_t i = 0; i < counters.size(); ++i) {
+                out << (i ? ", " : "") << '"' << counters[i].first << "\": " << counters[i].second;
+            }
+
+            out << "},\n  \"total_ms\": " << total << ",\n  \"peak_rss_kb\": " << peakRSSKilobytes() << "\n}\n";
+        }
+
+        // Writes the JSON report to a file descriptor, which is not closed.
+        bool writeJSON(int fd) const {
+            std::ostringstream stream;
+            writeJSON(stream);
+
+            std::string report = stream.str();
+            const char *p = report.data();
+            size_t remaining = report.size();
+
+            while(remaining) {
+                ssize_t written = ::write(fd, p, remaining);
+                if(written <= 0) return false;
+
+                p += written;
+                remaining -= written;
+            }
+
+            return true;
+        }
+    };
+}
+
+#endif //GTASM_STATS_HPP
@@ -0,0 +1,328 @@
+/*
+ * Cross-references for global variables over many scripts. The main script and the missions share one
+ *  global variable space, so Script::globals (which only sees one file) can't say where else a global is
+ *  used. This decodes any number of scripts at once and merges, for every global offset, the places it is
+ *  read and written and the type of value it seems to hold.
+ *
+ * Whether a parameter is written comes from OpcodeTable::access (see parameterAccess()). Types come from the
+ *  variable type (string globals) and from immediates assigned to the variable.
+ *
+ * Binary export format (little-endian; varints are unsigned LEB128 as in ir.hpp):
+ *
+ *   char[4]  "GXRF"
+ *   u32      version (1)
+ *   u32      script count
+ *   u32      global count
+ *   script paths: varint length, then the UTF-8 bytes
+ *   globals, in offset order:
+ *     varint   offset, as a difference from the previous global's
+ *     u8       XrefType
+ *     varint   read count, varint write count
+ *     sites (reads then writes, each in script/offset order):
+ *       varint   script index, as a difference from the previous site's
+ *       varint   offset (a difference from the previous site's if the script index didn't change)
+ *       varint   opcode
+ */
+
+#ifndef GTASM_XREF_HPP
+#define GTASM_XREF_HPP
+
+#include <array>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+#include "opcode_table.hpp"
+#include "ir.hpp"
+#include "../work_stealing.hpp"
+#include "../util.hpp"
+
+namespace miss2 {
+    enum class XrefType : uint8_t {
+        Unknown = 0,
+        Integer = 1,
+        Float = 2,
+        String8 = 3,
+        String16 = 4,
+
+        // Values of more than one type are assigned.
+        Mixed = 5,
+    };
+
+    inline const char *xrefTypeName(XrefType type) {
+        switch(type) {
+            case XrefType::Integer:
+                return "int";
+            case XrefType::Float:
+                return "float";
+            case XrefType::String8:
+                return "string8";
+            case XrefType::String16:
+                return "string16";
+            case XrefType::Mixed:
+                return "mixed";
+            default:
+                return "unknown";
+        }
+    }
+
+    inline XrefType mergeXrefTypes(XrefType a, XrefType b) {
+        if(a == XrefType::Unknown) return b;
+        if(b == XrefType::Unknown or a == b) return a;
+
+        return XrefType::Mixed;
+    }
+
+    // The type of value that a parameter holds, if it can be told from the parameter alone.
+    inline XrefType xrefTypeOf(DataType type) {
+        switch(type) {
+            case S8:
+            case S16:
+            case S32:
+                return XrefType::Integer;
+            case F32:
+                return XrefType::Float;
+            case String8:
+            case GlobalString8:
+            case LocalString8:
+                return XrefType::String8;
+            case String16:
+            case GlobalString16:
+            case LocalString16:
+                return XrefType::String16;
+            default:
+                return XrefType::Unknown;
+        }
+    }
+
+    struct XrefSite {
+        uint32_t script;
+        uint32_t offset;
+        uint16_t opcode;
+
+        auto operator<=>(const XrefSite &) const = default;
+    };
+
+    struct GlobalXref {
+        XrefType type = XrefType::Unknown;
+        std::vector<XrefSite> reads, writes;
+    };
+
+    class GlobalXrefTable {
+        // Globals are spread over the shards by offset, so workers merging different scripts rarely wait
+        //  for the same lock.
+        static const size_t shard_count = 64;
+
+        struct Shard {
+            mutable std::mutex lock;
+            std::unordered_map<uint32_t, GlobalXref> globals;
+        };
+
+        std::array<Shard, shard_count> shards;
+        std::vector<std::string> scriptPaths;
+
+        static size_t shardIndex(uint32_t offset) {
+            // Globals are 4 bytes apart, so the low bits are always the same.
+            return (offset >> 2) % shard_count;
+        }
+
+        struct Access {
+            uint32_t global;
+            XrefSite site;
+            bool write;
+            XrefType type;
+        };
+
+        static void collectAccesses(const OpcodeTable &table, uint32_t script, const uint8_t *bytes, size_t size,
+                                    std::vector<Access> &accesses) {
+            FlatDecoder decoder(table, bytes, size);
+            FlatInstruction instruction;
+
+            while(decoder.next(instruction)) {
+                const ParameterAccess &access = table.access[instruction.opcode];
+                XrefSite site { script, instruction.offset, instruction.opcode };
+
+                for(int i = 0; i < instruction.paramCount; ++i) {
+                    const FlatParam &param = instruction.params[i];
+                    if(not isGlobalVarType(param.type)) continue;
+
+                    auto global = uint32_t(param.integer());
+                    uint64_t bit = i < 64 ? uint64_t(1) << i : 0;
+
+                    XrefType type = xrefTypeOf(param.type);
+
+                    if(not (access.writes & bit)) {
+                        accesses.push_back({ global, site, false, type });
+                        continue;
+                    }
+
+                    // "$0 = 1.5" says what the global holds.
+                    if(instruction.paramCount == 2) {
+                        type = mergeXrefTypes(type, xrefTypeOf(instruction.params[1 - i].type));
+                    }
+
+                    accesses.push_back({ global, site, true, type });
+                    if(access.updates & bit) accesses.push_back({ global, site, false, type });
+                }
+            }
+        }
+
+        void merge(std::vector<Access> &accesses) {
+            std::sort(accesses.begin(), accesses.end(), [](const Access &a, const Access &b) {
+                return shardIndex(a.global) < shardIndex(b.global);
+            });
+
+            for(size_t start = 0; start < accesses.size();) {
+                size_t shard = shardIndex(accesses[start].global);
+
+                size_t end = start;
+                while(end < accesses.size() and shardIndex(accesses[end].global) == shard) ++end;
+
+                std::lock_guard<std::mutex> guard(shards[shard].lock);
+
+                for(size_t i = start; i < end; ++i) {
+                    const Access &access = accesses[i];
+                    GlobalXref &xref = shards[shard].globals[access.global];
+
+                    xref.type = mergeXrefTypes(xref.type, access.type);
+                    (access.write ? xref.writes : xref.reads).push_back(access.site);
+                }
+
+                start = end;
+            }
+        }
+
+    public:
+        // Decodes 'paths' on 'pool', biggest first, and merges their global references into the table. Script
+        //  indices in the sites are positions in scripts().
+        void addScripts(const std::vector<std::string> &paths, const OpcodeTable &table,
+                        WorkStealingPool &pool, std::ostream &log = std::cerr) {
+            auto firstIndex = uint32_t(scriptPaths.size());
+            scriptPaths.insert(scriptPaths.end(), paths.begin(), paths.end());
+
+            // The log is shared by the workers.
+            std::mutex logLock;
+
+            forEachFileLargestFirst(pool, paths, [&](size_t i) {
+                MappedFile file(paths[i].c_str());
+
+                if(not file) {
+                    std::lock_guard<std::mutex> guard(logLock);
+                    log << "error: could not read " << paths[i] << '\n';
+                    return;
+                }
+
+                std::vector<Access> accesses;
+                collectAccesses(table, firstIndex + uint32_t(i), file.data, file.size, accesses);
+                merge(accesses);
+            });
+
+            // Workers finish in any order, so put the sites back into a predictable one.
+            for(Shard &shard : shards) {
+                std::lock_guard<std::mutex> guard(shard.lock);
+
+                for(auto &[offset, xref] : shard.globals) {
+                    std::sort(xref.reads.begin(), xref.reads.end());
+                    std::sort(xref.writes.begin(), xref.writes.end());
+                }
+            }
+        }
+
+        const std::vector<std::string> &scripts() const {
+            return scriptPaths;
+        }
+
+        // Copies the cross-references of one global. Returns false if no script uses it.
+        bool lookup(uint32_t offset, GlobalXref &out) const {
+            const Shard &shard = shards[shardIndex(offset)];
+            std::lock_guard<std::mutex> guard(shard.lock);
+
+            auto found = shard.globals.find(offset);
+            if(found == shard.globals.end()) return false;
+
+            out = found->second;
+            return true;
+        }
+
+        // The offsets of every global that has been seen, in order.
+        std::vector<uint32_t> offsets() const {
+            std::vector<uint32_t> all;
+
+            for(const Shard &shard : shards) {
+                std::lock_guard<std::mutex> guard(shard.lock);
+                for(auto &[offset, xref] : shard.globals) all.push_back(offset);
+            }
+
+            std::sort(all.begin(), all.end());
+            return all;
+        }
+
+        std::vector<uint8_t> encodeBinary() const {
+            std::vector<uint8_t> out { 'G', 'X', 'R', 'F' };
+
+            auto globalOffsets = offsets();
+
+            appendLE(out, uint32_t(1));
+            appendLE(out, uint32_t(scriptPaths.size()));
+            appendLE(out, uint32_t(globalOffsets.size()));
+
+            for(const std::string &path : scriptPaths) {
+                appendVarint(out, path.size());
+                out.insert(out.end(), path.begin(), path.end());
+            }
+
+            auto appendSites = [&](const std::vector<XrefSite> &sites) {
+                XrefSite previous { 0, 0, 0 };
+
+                for(size_t i = 0; i < sites.size(); ++i) {
+                    const XrefSite &site = sites[i];
+                    uint32_t scriptDelta = site.script - previous.script;
+
+                    appendVarint(out, scriptDelta);
+                    appendVarint(out, (scriptDelta == 0 and i != 0) ? site.offset - previous.offset : site.offset);
+                    appendVarint(out, site.opcode);
+
+                    previous = site;
+                }
+            };
+
+            uint32_t previousOffset = 0;
+            GlobalXref xref;
+
+            for(uint32_t offset : globalOffsets) {
+                lookup(offset, xref);
+
+                appendVarint(out, offset - previousOffset);
+                out.push_back(uint8_t(xref.type));
+                appendVarint(out, xref.reads.size());
+                appendVarint(out, xref.writes.size());
+
+                appendSites(xref.reads);
+                appendSites(xref.writes);
+
+                previousOffset = offset;
+            }
+
+            return out;
+        }
+
+        bool writeBinary(const std::string &path, std::ostream &log = std::cerr) const {
+            auto bytes = encodeBinary();
+
+            std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+            stream.write((const char *)bytes.data(), std::streamsize(bytes.size()));
+
+            if(not stream) {
+                log << "error: failed to write " << path << '\n';
+                return false;
+            }
+
+            return true;
+        }
+    };
+}
+
+#endif //GTASM_XREF_HPP
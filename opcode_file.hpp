@@ -0,0 +1,159 @@
+//
+// Loading of Sanny Builder-style opcode definition files (Opcodes.ini, SASCM.ini).
+//
+
+#ifndef GTASM_OPCODE_FILE_HPP
+#define GTASM_OPCODE_FILE_HPP
+
+#include <map>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include "util.hpp"
+#include "miss2/constructs.hpp"
+#include "miss2/decompiler_context.hpp"
+
+struct PlaceholderInstruction {
+    std::string name;
+    uint16_t opcode;
+    std::vector<uint8_t> paramSizes;
+
+    std::string toString() {
+        std::stringstream stream;
+
+        stream << std::hex << opcode << ": " << name << std::dec;
+
+        for(auto psize : paramSizes) {
+            stream << (int)psize << ' ';
+        }
+
+        return stream.str();
+    }
+};
+
+// Replaces the %1d%-style tokens in an opcode's name with $0, $1 etc. The number of each token goes in
+//  'psizes' and the letter after it (what the parameter is) in 'pkinds'.
+inline std::string removeTokens(std::string &dirty, std::vector<uint8_t> &psizes, std::vector<char> &pkinds) {
+    auto firstPercent = dirty.find("%");
+    if(firstPercent == std::string::npos) return dirty;
+
+    auto secondPercent = dirty.find_first_of('%', firstPercent + 1);
+    if(secondPercent == firstPercent or secondPercent == std::string::npos) return dirty;
+
+    //std::cout << dirty.substr(firstPercent, (secondPercent - firstPercent) + 1) << '\n';
+    auto numstr = dirty.substr(firstPercent + 1, (secondPercent - firstPercent) - 2);
+    //std::cout << numstr << '\n';
+
+    // Anything else between two percent signs is part of the name, not a token.
+    if(numstr.empty() or numstr.size() > 3 or numstr.find_first_not_of("0123456789") != std::string::npos) return dirty;
+    psizes.push_back(std::stoi(numstr));
+
+    // The letter after the number says what the parameter is ('p' for a label, 'o' for a model, etc.).
+    pkinds.push_back(dirty[secondPercent - 1]);
+
+    //dirty.erase(firstPercent, (secondPercent - firstPercent) + 1);
+    dirty.replace(firstPercent, (secondPercent - firstPercent) + 1, "$" +/* std::to_string(foundTokenIndex++)*/std::to_string(std::stoi(numstr) - 1));
+
+    return removeTokens(dirty, psizes, pkinds);
+}
+
+// Registers the opcodes in the file with 'context'.
+inline void parseOpcodeFile(string_ref path, miss2::DecompilerContext &context = miss2::DecompilerContext::shared()) {
+    std::ifstream stream(path);
+
+    std::vector<uint8_t> psizes;
+    std::vector<char> pkinds;
+
+    while(stream) {
+        std::stringstream thisLine;
+
+        char c;
+        while(stream and (c = stream.get()) != '\n') {
+            thisLine << c;
+        }
+
+        std::string s = thisLine.str();
+
+        if(s.starts_with(';') or s.starts_with('[')) continue;
+
+        auto commentIndex = s.find(';');
+        if(commentIndex != std::string::npos) {
+            s = s.substr(0, commentIndex);
+        }
+
+        commentIndex = s.find("//");
+        if(commentIndex != std::string::npos) {
+            s = s.substr(0, commentIndex);
+        }
+
+        trim(s);
+
+        PlaceholderInstruction instruction;
+
+        auto equalsIndex = s.find('=');
+        if(equalsIndex == std::string::npos) continue;
+
+        std::string opcodeString = s.substr(0, equalsIndex);
+        trim(opcodeString);
+
+        // Opcodes are 16 bits, so anything else isn't an opcode definition.
+        if(opcodeString.empty() or opcodeString.size() > 4) continue;
+        if(opcodeString.find_first_not_of("abcdefABCDEF0123456789") != std::string::npos) continue;
+
+        std::string infoString = s.substr(equalsIndex + 1);
+
+        auto commaIndex = s.find(',');
+        infoString = s.substr(commaIndex + 1);
+        trim(infoString);
+
+        instruction.opcode = std::stoi(opcodeString, 0, 16);
+        std::string before = infoString;
+        instruction.name = removeTokens(infoString, psizes, pkinds);
+
+        instruction.paramSizes = psizes;
+
+        miss2::Command m2cmd {
+            .name = instruction.name,
+            .opcode = instruction.opcode
+        };
+
+        // A parameter count of -1 means the command takes extra parameters up to an EOAL tag.
+        if(commaIndex != std::string::npos and commaIndex > equalsIndex) {
+            std::string countString = s.substr(equalsIndex + 1, commaIndex - equalsIndex - 1);
+            trim(countString);
+
+            m2cmd.variadic = countString == "-1";
+        }
+
+        for(size_t token = 0; token < psizes.size(); ++token) {
+            if(psizes[token] == 0 or psizes[token] > 32) continue;
+
+            if(pkinds[token] == 'p') m2cmd.labelMask |= 1u << (psizes[token] - 1);
+            if(pkinds[token] == 'o') m2cmd.modelMask |= 1u << (psizes[token] - 1);
+        }
+
+        psizes.clear();
+        pkinds.clear();
+
+        int i = 0;
+        for(auto &p : instruction.paramSizes) {
+            // Add and unknown type for now. The real type will be added when the decompiler
+            //  finds an instance of this command.
+            m2cmd.parameters.push_back(miss2::Unknown);
+            m2cmd.parameters.back().size = instruction.paramSizes[i++];
+        }
+
+        context.registerOpcode(instruction.opcode, m2cmd);
+
+        if(not (instruction.opcode & 0xF000)) {
+            uint16_t otherOpcode = instruction.opcode | 0x8000;
+            if(not context.get(otherOpcode)) {
+                m2cmd.opcode = otherOpcode;
+                context.registerOpcode(otherOpcode, m2cmd);
+            }
+        }
+    }
+}
+
+#endif //GTASM_OPCODE_FILE_HPP
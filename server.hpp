@@ -0,0 +1,363 @@
+/*
+ * Long-running decompiler server. The opcode database is loaded once and then any number of decompile
+ *  requests are answered, either over stdin/stdout or over a Unix domain socket (one or more clients).
+ *
+ * Both directions use length-prefixed frames. All integers are little-endian.
+ *
+ *   Request:
+ *     u32   length of the rest of the frame
+ *     u32   request ID (echoed in the reply)
+ *     u8    source: 0 = the body is a path to the script, 1 = the body is the script itself
+ *     u8    output: 0 = binary IR, 1 = text IR, 2 = rendered (pretty-printed) code
+ *     u8    option flags (request_clean, request_show_if_jumps, request_optimize)
+ *     u8    reserved (0)
+ *     ...   body
+ *
+ *   Reply:
+ *     u32   length of the rest of the frame
+ *     u32   request ID
+ *     u8    status (ReplyStatus)
+ *     u8[3] reserved (0)
+ *     u32   time taken to handle the request in microseconds, measured from when it was received
+ *     ...   payload: the requested output, or an error message if the status is not ReplyOK
+ *
+ * Requests are handled on a pool of worker threads, so replies may arrive in a different order to the
+ *  requests. Clients should match them up using the request ID.
+ */
+
+#ifndef GTASM_SERVER_HPP
+#define GTASM_SERVER_HPP
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "thread_pool.hpp"
+#include "miss2/decompiler.hpp"
+#include "miss2/ir.hpp"
+
+enum RequestSource : uint8_t {
+    SourcePath = 0,
+    SourceBytes = 1
+};
+
+enum RequestOutput : uint8_t {
+    OutputBinaryIR = 0,
+    OutputTextIR = 1,
+    OutputRendered = 2
+};
+
+enum ReplyStatus : uint8_t {
+    ReplyOK = 0,
+    ReplyBadRequest = 1,
+    ReplyReadFailed = 2,
+    ReplyInternalError = 3
+};
+
+// Request option flags. These only affect rendered output.
+static const uint8_t request_clean = 0x1; // DecompileOptions::clean
+static const uint8_t request_show_if_jumps = 0x2; // DecompileOptions::showIfJumps
+static const uint8_t request_optimize = 0x4; // DecompileOptions::optimize
+
+class DecompileServer {
+    // Anything bigger than this is rejected rather than buffered.
+    static const uint32_t max_frame_size = 256 * 1024 * 1024;
+
+    struct Connection {
+        int inputFD, outputFD;
+        bool ownsFDs;
+
+        // Replies from different workers must not interleave.
+        std::mutex writeLock;
+
+        // Set once a reply can't be written (the client has hung up), after which nothing more is read
+        //  from or written to the connection.
+        std::atomic<bool> dead = false;
+
+        Connection(int in, int out, bool owns) : inputFD { in }, outputFD { out }, ownsFDs { owns } {}
+
+        ~Connection() {
+            if(not ownsFDs) return;
+
+            close(inputFD);
+            if(outputFD != inputFD) close(outputFD);
+        }
+    };
+
+    struct Request {
+        uint32_t id;
+        uint8_t source, output, options;
+        std::vector<uint8_t> body;
+        std::chrono::steady_clock::time_point received;
+    };
+
+    // Every request is handled start to finish on one of the workers. Decoding only reads the opcodes, and
+    //  each script has its own options, so requests don't wait for each other.
+    ThreadPool pool;
+
+    static bool readExact(int fd, void *buffer, size_t length) {
+        auto *p = (uint8_t *)buffer;
+
+        while(length) {
+            ssize_t got = ::read(fd, p, length);
+
+            if(got < 0 and errno == EINTR) continue;
+            if(got <= 0) return false;
+
+            p += got;
+            length -= got;
+        }
+
+        return true;
+    }
+
+    static bool writeExact(int fd, const void *buffer, size_t length) {
+        auto *p = (const uint8_t *)buffer;
+
+        while(length) {
+            ssize_t written = ::write(fd, p, length);
+
+            if(written < 0 and errno == EINTR) continue;
+            if(written <= 0) return false;
+
+            p += written;
+            length -= written;
+        }
+
+        return true;
+    }
+
+    static void reply(Connection &connection, const Request &request, ReplyStatus status, const std::string &payload) {
+        auto elapsed = std::chrono::steady_clock::now() - request.received;
+        auto micros = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+
+        std::vector<uint8_t> frame;
+        frame.reserve(16 + payload.size());
+
+        miss2::appendLE<uint32_t>(frame, 12 + payload.size());
+        miss2::appendLE<uint32_t>(frame, request.id);
+        miss2::appendLE<uint32_t>(frame, status);
+        miss2::appendLE<uint32_t>(frame, uint32_t(std::min<int64_t>(micros, UINT32_MAX)));
+        frame.insert(frame.end(), payload.begin(), payload.end());
+
+        {
+            std::lock_guard<std::mutex> guard(connection.writeLock);
+
+            if(connection.dead) return;
+
+            if(not writeExact(connection.outputFD, frame.data(), frame.size())) {
+                connection.dead = true;
+                std::cerr << "request " << request.id << ": could not send the reply, dropping the connection\n";
+
+                return;
+            }
+        }
+
+        std::cerr << "request " << request.id << ": " << request.body.size() << " bytes in, "
+                  << payload.size() << " bytes out, status " << int(status) << ", "
+                  << double(micros) / 1000.0 << " ms\n";
+    }
+
+    // Runs 'body', turning any exception into an error reply, since an exception leaving a worker would end
+    //  the server for every client.
+    template <typename Body>
+    static void guarded(Connection &connection, const Request &request, Body body) {
+        const char *message;
+
+        try {
+            body();
+            return;
+        } catch(const std::bad_alloc &) {
+            message = "out of memory";
+        } catch(...) {
+            message = "internal error";
+        }
+
+        try {
+            reply(connection, request, ReplyInternalError, message);
+        } catch(...) {
+            // Not even the error could be sent, so the client would wait for this reply forever.
+            connection.dead = true;
+        }
+    }
+
+    void handle(Connection &connection, const Request &request) {
+        // Nobody is left to read the reply.
+        if(connection.dead) return;
+
+        guarded(connection, request, [&] { decompileRequest(connection, request); });
+    }
+
+    void decompileRequest(Connection &connection, const Request &request) {
+        if(request.source > SourceBytes or request.output > OutputRendered) {
+            reply(connection, request, ReplyBadRequest, "unknown source or output type");
+            return;
+        }
+
+        MappedFile file;
+        uint8_t *scriptBytes = (uint8_t *)request.body.data();
+        size_t scriptSize = request.body.size();
+
+        if(request.source == SourcePath) {
+            std::string path(request.body.begin(), request.body.end());
+
+            file = MappedFile(path.c_str());
+            if(not file) {
+                reply(connection, request, ReplyReadFailed, "could not read " + path);
+                return;
+            }
+
+            scriptBytes = file.data;
+            scriptSize = file.size;
+        }
+
+        // Progress messages are not wanted here.
+        std::ostream nullStream(nullptr);
+
+        miss2::Script script = miss2::Decompiler::decompile(scriptBytes, scriptSize, nullStream);
+        std::string rendered;
+
+        if(request.output == OutputRendered) {
+            script.options.clean = request.options & request_clean;
+            script.options.showIfJumps = request.options & request_show_if_jumps;
+            script.options.optimize = request.options & request_optimize;
+
+            std::ostringstream stream;
+            script.log = &nullStream;
+            script.prettyPrint(stream);
+            rendered = stream.str();
+        }
+
+        if(request.output == OutputBinaryIR) {
+            auto ir = miss2::encodeBinaryIR(script.commands, script.sourceSize);
+            reply(connection, request, ReplyOK, std::string(ir.begin(), ir.end()));
+        } else if(request.output == OutputTextIR) {
+            std::ostringstream stream;
+            miss2::writeTextIR(stream, script.commands);
+            reply(connection, request, ReplyOK, stream.str());
+        } else {
+            reply(connection, request, ReplyOK, rendered);
+        }
+    }
+
+    // Reads requests until the input is closed, handing each to the worker pool.
+    void serveConnection(const std::shared_ptr<Connection> &connection) {
+        while(not connection->dead) {
+            uint32_t length;
+            if(not readExact(connection->inputFD, &length, 4)) break;
+
+            auto request = std::make_shared<Request>();
+            request->received = std::chrono::steady_clock::now();
+
+            uint8_t fields[8];
+            if(length < sizeof(fields) or length > max_frame_size) {
+                // There's no way to find the next frame, so give up on this connection.
+                request->id = 0;
+                reply(*connection, *request, ReplyBadRequest, "bad frame length");
+                break;
+            }
+
+            if(not readExact(connection->inputFD, fields, sizeof(fields))) break;
+
+            std::memcpy(&request->id, fields, 4);
+            request->source = fields[4];
+            request->output = fields[5];
+            request->options = fields[6];
+
+            try {
+                request->body.resize(length - sizeof(fields));
+            } catch(const std::bad_alloc &) {
+                // The body can't be skipped without reading it, so this connection can't go on either.
+                reply(*connection, *request, ReplyInternalError, "out of memory");
+                break;
+            }
+
+            if(not readExact(connection->inputFD, request->body.data(), request->body.size())) break;
+
+            pool.submit([this, connection, request] {
+                handle(*connection, *request);
+            });
+        }
+    }
+
+public:
+    explicit DecompileServer(size_t workerCount = ThreadPool::defaultThreadCount()) : pool(workerCount) {}
+
+    // A client that hangs up before its reply is written must only lose its connection, so writes to a
+    //  closed pipe or socket have to fail with EPIPE instead of raising SIGPIPE (which ends the process).
+    static void ignoreBrokenPipes() {
+        std::signal(SIGPIPE, SIG_IGN);
+    }
+
+    // Serves requests from stdin, replying on stdout, until stdin is closed or stdout can't be written.
+    void serveStdio() {
+        ignoreBrokenPipes();
+
+        auto connection = std::make_shared<Connection>(STDIN_FILENO, STDOUT_FILENO, false);
+
+        serveConnection(connection);
+        pool.wait();
+    }
+
+    // Listens on a Unix domain socket at 'path'. Each client gets its own reader thread. Does not return
+    //  unless the socket cannot be set up.
+    bool serveSocket(string_ref path) {
+        sockaddr_un address {};
+        address.sun_family = AF_UNIX;
+
+        if(path.size() >= sizeof(address.sun_path)) {
+            std::cerr << "error: socket path is too long\n";
+            return false;
+        }
+
+        std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+        // Only a socket left behind by an earlier run is replaced. Anything else at the path is most likely
+        //  a mistyped argument.
+        struct stat existing {};
+
+        if(lstat(path.c_str(), &existing) == 0) {
+            if(not S_ISSOCK(existing.st_mode)) {
+                std::cerr << "error: " << path << " already exists and is not a socket\n";
+                return false;
+            }
+
+            unlink(path.c_str());
+        }
+
+        ignoreBrokenPipes();
+
+        int listenFD = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(listenFD < 0) {
+            std::cerr << "error: could not create socket\n";
+            return false;
+        }
+
+        if(bind(listenFD, (sockaddr *)&address, sizeof(address)) < 0 or listen(listenFD, 16) < 0) {
+            std::cerr << "error: could not listen on " << path << '\n';
+            close(listenFD);
+            return false;
+        }
+
+        std::cerr << "listening on " << path << " with " << pool.size() << " workers\n";
+
+        while(true) {
+            int clientFD = accept(listenFD, nullptr, nullptr);
+            if(clientFD < 0) continue;
+
+            auto connection = std::make_shared<Connection>(clientFD, clientFD, true);
+            std::thread([this, connection] { serveConnection(connection); }).detach();
+        }
+    }
+};
+
+#endif //GTASM_SERVER_HPP
@@ -0,0 +1,309 @@
+//
+// Byte-scanning kernels used when decoding strings and skipping padding. Each kernel has a scalar version
+//  and, on x86, SSE2 and AVX2 versions. The best one the CPU supports is picked the first time it is used.
+//
+
+#ifndef GTASM_SIMD_HPP
+#define GTASM_SIMD_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GTASM_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+namespace simd {
+    namespace scalar {
+        // Length of the run of printable characters (0x20 to 0x7e, as std::isprint in the C locale) at 'p'.
+        inline size_t printablePrefix(const uint8_t *p, size_t n) {
+            size_t i = 0;
+            while(i < n and p[i] >= 0x20 and p[i] < 0x7f) ++i;
+
+            return i;
+        }
+
+        // Number of bytes before the first NUL, or 'n' if there isn't one.
+        inline size_t nulLength(const uint8_t *p, size_t n) {
+            size_t i = 0;
+            while(i < n and p[i]) ++i;
+
+            return i;
+        }
+
+        // Length of the run of zero bytes at 'p'.
+        inline size_t zeroRun(const uint8_t *p, size_t n) {
+            size_t i = 0;
+            while(i < n and not p[i]) ++i;
+
+            return i;
+        }
+
+        // Length of the run of ASCII (< 0x80) bytes at 'p'.
+        inline size_t asciiPrefix(const uint8_t *p, size_t n) {
+            size_t i = 0;
+            while(i < n and p[i] < 0x80) ++i;
+
+            return i;
+        }
+
+        // As asciiPrefix(), for 'n' little-endian 16-bit units. The result is in units.
+        inline size_t asciiPrefix16(const uint8_t *p, size_t n) {
+            size_t i = 0;
+            while(i < n and p[i * 2] < 0x80 and p[i * 2 + 1] == 0) ++i;
+
+            return i;
+        }
+    }
+
+#ifdef GTASM_SIMD_X86
+    namespace sse2 {
+        // Signed comparison can't test an unsigned range directly, so the range [0x20, 0x7e] is shifted down
+        //  to [-128, -34] first.
+        inline __m128i printableMask(__m128i v) {
+            __m128i shifted = _mm_sub_epi8(v, _mm_set1_epi8((char)0xa0));
+            return _mm_cmplt_epi8(shifted, _mm_set1_epi8(-33));
+        }
+
+        inline size_t printablePrefix(const uint8_t *p, size_t n) {
+            // Most runs are short, so check the first byte before setting up the vectors.
+            if(n == 0 or p[0] < 0x20 or p[0] >= 0x7f) return 0;
+
+            size_t i = 0;
+
+            for(; i + 16 <= n; i += 16) {
+                __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+                unsigned bad = ~unsigned(_mm_movemask_epi8(printableMask(v))) & 0xffff;
+
+                if(bad) return i + __builtin_ctz(bad);
+            }
+
+            return i + scalar::printablePrefix(p + i, n - i);
+        }
+
+        inline size_t nulLength(const uint8_t *p, size_t n) {
+            size_t i = 0;
+
+            for(; i + 16 <= n; i += 16) {
+                __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+                unsigned zeros = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+
+                if(zeros) return i + __builtin_ctz(zeros);
+            }
+
+            return i + scalar::nulLength(p + i, n - i);
+        }
+
+        inline size_t zeroRun(const uint8_t *p, size_t n) {
+            if(n == 0 or p[0]) return 0;
+
+            size_t i = 0;
+
+            for(; i + 16 <= n; i += 16) {
+                __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+                unsigned nonZero = ~unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()))) & 0xffff;
+
+                if(nonZero) return i + __builtin_ctz(nonZero);
+            }
+
+            return i + scalar::zeroRun(p + i, n - i);
+        }
+
+        inline size_t asciiPrefix(const uint8_t *p, size_t n) {
+            size_t i = 0;
+
+            for(; i + 16 <= n; i += 16) {
+                unsigned high = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(p + i)));
+                if(high) return i + __builtin_ctz(high);
+            }
+
+            return i + scalar::asciiPrefix(p + i, n - i);
+        }
+
+        // A unit is ASCII if none of its top nine bits are set.
+        inline size_t asciiPrefix16(const uint8_t *p, size_t n) {
+            size_t i = 0;
+
+            for(; i + 8 <= n; i += 8) {
+                __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i *)(p + i * 2)), _mm_set1_epi16(short(0xff80)));
+                unsigned bad = ~unsigned(_mm_movemask_epi8(_mm_cmpeq_epi16(v, _mm_setzero_si128()))) & 0xffff;
+
+                if(bad) return i + __builtin_ctz(bad) / 2;
+            }
+
+            return i + scalar::asciiPrefix16(p + i * 2, n - i);
+        }
+    }
+
+    namespace avx2 {
+        __attribute__((target("avx2"))) inline size_t printablePrefix(const uint8_t *p, size_t n) {
+            if(n == 0 or p[0] < 0x20 or p[0] >= 0x7f) return 0;
+
+            size_t i = 0;
+
+            for(; i + 32 <= n; i += 32) {
+                __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+                __m256i shifted = _mm256_sub_epi8(v, _mm256_set1_epi8((char)0xa0));
+                __m256i printable = _mm256_cmpgt_epi8(_mm256_set1_epi8(-33), shifted);
+
+                unsigned bad = ~unsigned(_mm256_movemask_epi8(printable));
+                if(bad) return i + __builtin_ctz(bad);
+            }
+
+            return i + sse2::printablePrefix(p + i, n - i);
+        }
+
+        __attribute__((target("avx2"))) inline size_t nulLength(const uint8_t *p, size_t n) {
+            size_t i = 0;
+
+            for(; i + 32 <= n; i += 32) {
+                __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+                unsigned zeros = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+
+                if(zeros) return i + __builtin_ctz(zeros);
+            }
+
+            return i + sse2::nulLength(p + i, n - i);
+        }
+
+        __attribute__((target("avx2"))) inline size_t zeroRun(const uint8_t *p, size_t n) {
+            if(n == 0 or p[0]) return 0;
+
+            size_t i = 0;
+
+            for(; i + 32 <= n; i += 32) {
+                __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+                unsigned nonZero = ~unsigned(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256())));
+
+                if(nonZero) return i + __builtin_ctz(nonZero);
+            }
+
+            return i + sse2::zeroRun(p + i, n - i);
+        }
+
+        __attribute__((target("avx2"))) inline size_t asciiPrefix(const uint8_t *p, size_t n) {
+            size_t i = 0;
+
+            for(; i + 32 <= n; i += 32) {
+                unsigned high = _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)(p + i)));
+                if(high) return i + __builtin_ctz(high);
+            }
+
+            return i + sse2::asciiPrefix(p + i, n - i);
+        }
+
+        __attribute__((target("avx2"))) inline size_t asciiPrefix16(const uint8_t *p, size_t n) {
+            size_t i = 0;
+
+            for(; i + 16 <= n; i += 16) {
+                __m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(p + i * 2)),
+                                             _mm256_set1_epi16(short(0xff80)));
+                unsigned bad = ~unsigned(_mm256_movemask_epi8(_mm256_cmpeq_epi16(v, _mm256_setzero_si256())));
+
+                if(bad) return i + __builtin_ctz(bad) / 2;
+            }
+
+            return i + sse2::asciiPrefix16(p + i * 2, n - i);
+        }
+    }
+#endif
+
+    struct Kernels {
+        const char *name;
+        size_t (*printablePrefix)(const uint8_t *, size_t);
+        size_t (*nulLength)(const uint8_t *, size_t);
+        size_t (*zeroRun)(const uint8_t *, size_t);
+        size_t (*asciiPrefix)(const uint8_t *, size_t);
+        size_t (*asciiPrefix16)(const uint8_t *, size_t);
+    };
+
+    inline const Kernels scalarKernels {
+        "scalar", scalar::printablePrefix, scalar::nulLength, scalar::zeroRun, scalar::asciiPrefix, scalar::asciiPrefix16
+    };
+
+    // The kernels for the best instruction set this CPU supports.
+    inline const Kernels &bestKernels() {
+        static const Kernels best = [] {
+#ifdef GTASM_SIMD_X86
+            if(__builtin_cpu_supports("avx2")) {
+                return Kernels { "avx2", avx2::printablePrefix, avx2::nulLength, avx2::zeroRun, avx2::asciiPrefix,
+                                 avx2::asciiPrefix16 };
+            }
+
+            return Kernels { "sse2", sse2::printablePrefix, sse2::nulLength, sse2::zeroRun, sse2::asciiPrefix,
+                             sse2::asciiPrefix16 };
+#else
+            return scalarKernels;
+#endif
+        }();
+
+        return best;
+    }
+
+    // The kernels used by the functions below. This is bestKernels() unless it has been replaced (to compare
+    //  against the scalar code, for example).
+    inline const Kernels *&activeKernels() {
+        static const Kernels *active = &bestKernels();
+        return active;
+    }
+
+    inline size_t printablePrefix(const uint8_t *p, size_t n) {
+        return activeKernels()->printablePrefix(p, n);
+    }
+
+    inline size_t nulLength(const uint8_t *p, size_t n) {
+        return activeKernels()->nulLength(p, n);
+    }
+
+    inline size_t zeroRun(const uint8_t *p, size_t n) {
+        return activeKernels()->zeroRun(p, n);
+    }
+
+    inline size_t asciiPrefix(const uint8_t *p, size_t n) {
+        return activeKernels()->asciiPrefix(p, n);
+    }
+
+    inline size_t asciiPrefix16(const uint8_t *p, size_t n) {
+        return activeKernels()->asciiPrefix16(p, n);
+    }
+
+    // Length of the NUL-terminated string in an 8-byte field, or 8 if it isn't terminated. Too short for
+    //  vector registers to help, so this tests all eight bytes at once in a 64-bit word.
+    inline size_t nulLength8(const uint8_t *p) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+
+        uint64_t zeros = (word - 0x0101010101010101ull) & ~word & 0x8080808080808080ull;
+        if(not zeros) return 8;
+
+        // Only the lowest flagged byte is exact, which is the one we want (little-endian).
+        return size_t(__builtin_ctzll(zeros) / 8);
+    }
+
+    // Length of the run of ASCII bytes at 'p', with no upper bound. Only aligned 16-byte blocks are read
+    //  after the first few bytes, so the scan never reads from a page that the scalar loop wouldn't.
+    inline size_t asciiPrefixUnbounded(const uint8_t *p) {
+        size_t i = 0;
+
+        while((uintptr_t(p + i) & 15) != 0) {
+            if(p[i] >= 0x80) return i;
+            ++i;
+        }
+
+#ifdef GTASM_SIMD_X86
+        while(true) {
+            unsigned high = _mm_movemask_epi8(_mm_load_si128((const __m128i *)(p + i)));
+            if(high) return i + __builtin_ctz(high);
+
+            i += 16;
+        }
+#else
+        while(p[i] < 0x80) ++i;
+        return i;
+#endif
+    }
+}
+
+#endif //GTASM_SIMD_HPP
@@ -0,0 +1,98 @@
+//
+// A fixed-size pool of worker threads that run queued jobs in submission order.
+//
+
+#ifndef GTASM_THREAD_POOL_HPP
+#define GTASM_THREAD_POOL_HPP
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+
+class ThreadPool {
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+
+    std::mutex lock;
+    std::condition_variable jobAvailable;
+    std::condition_variable allDone;
+
+    size_t runningJobs = 0;
+    bool stopping = false;
+
+    void workerLoop() {
+        while(true) {
+            std::function<void()> job;
+
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                jobAvailable.wait(guard, [this] { return stopping or not jobs.empty(); });
+
+                if(jobs.empty()) return;
+
+                job = std::move(jobs.front());
+                jobs.pop_front();
+                ++runningJobs;
+            }
+
+            job();
+
+            std::lock_guard<std::mutex> guard(lock);
+            if(--runningJobs == 0 and jobs.empty()) {
+                allDone.notify_all();
+            }
+        }
+    }
+
+public:
+    static size_t defaultThreadCount() {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    explicit ThreadPool(size_t threadCount = defaultThreadCount()) {
+        for(size_t i = 0; i < std::max(threadCount, size_t(1)); ++i) {
+            workers.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    size_t size() const {
+        return workers.size();
+    }
+
+    void submit(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            jobs.push_back(std::move(job));
+        }
+
+        jobAvailable.notify_one();
+    }
+
+    // Blocks until every submitted job has finished.
+    void wait() {
+        std::unique_lock<std::mutex> guard(lock);
+        allDone.wait(guard, [this] { return jobs.empty() and runningJobs == 0; });
+    }
+
+    // Finishes the queued jobs before joining the workers.
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+
+        jobAvailable.notify_all();
+
+        for(std::thread &worker : workers) {
+            worker.join();
+        }
+    }
+};
+
+#endif //GTASM_THREAD_POOL_HPP
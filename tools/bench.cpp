@@ -0,0 +1,887 @@
+//
+// Component benchmarks: opcode database loading, raw decoding, each analysis pass, serial and concurrent
+//  analysis, corpus-wide analysis on the work-stealing pool, decompiling many scripts at once, decoding one
+//  big script in parallel chunks, rendering, learning parameter signatures and checking scripts against them,
+//  the SIMD byte-scanning kernels, the CRC-32 implementations and full decompilation of every script in a
+//  directory. Results are written as JSON so they can be compared across commits. Given GXT files, it also
+//  times decoding and exporting their text.
+//
+// Usage: gtasm_bench [--opcodes=<Opcodes.ini>] [--iterations=<n>] [--output=<file.json>]
+//                    [--gxt=<file or directory>]... [directory]
+//
+
+#include <iostream>
+#include <map>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <functional>
+#include <cstring>
+#include <iomanip>
+#include <filesystem>
+#include <algorithm>
+#include <numeric>
+#include <deque>
+#include <chrono>
+#include <set>
+#include "../util.hpp"
+#include "../opcode_file.hpp"
+#include "../miss2/decompiler.hpp"
+#include "../miss2/ir.hpp"
+#include "../miss2/signatures.hpp"
+#include "../simd.hpp"
+#include "../crc32.hpp"
+#include "../gxt_export.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static double millisecondsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Discards everything written to it, keeping only a count so the output can't be optimised away.
+struct CountingBuffer : std::streambuf {
+    size_t count = 0;
+
+protected:
+    int overflow(int c) override {
+        ++count;
+        return c;
+    }
+
+    std::streamsize xsputn(const char *, std::streamsize n) override {
+        count += n;
+        return n;
+    }
+};
+
+struct Measurement {
+    std::string name;
+
+    // Total time for each iteration.
+    std::vector<double> samples;
+
+    // Bytes of script processed per iteration (0 if throughput doesn't make sense).
+    size_t bytes = 0;
+    size_t items = 0;
+
+    // For jobs run on a work-stealing pool: how busy the workers were (if set), and how many jobs were stolen.
+    double busyPercent = -1;
+    size_t stolen = 0;
+
+    // For schedules worked out rather than run: the total time divided by the time on the busiest worker.
+    double speedup = 0;
+
+    double min() const {
+        return *std::min_element(samples.begin(), samples.end());
+    }
+
+    double median() const {
+        std::vector<double> sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+
+        size_t middle = sorted.size() / 2;
+        return sorted.size() % 2 ? sorted[middle] : (sorted[middle - 1] + sorted[middle]) / 2.0;
+    }
+
+    double mean() const {
+        return std::accumulate(samples.begin(), samples.end(), 0.0) / double(samples.size());
+    }
+};
+
+struct ScriptFile {
+    std::string name, path;
+    MappedFile file;
+};
+
+static std::string jsonEscape(string_ref s) {
+    std::string escaped;
+
+    for(char c : s) {
+        if(c == '"' or c == '\\') escaped += '\\';
+
+        if((unsigned char)c < 0x20) {
+            escaped += ' ';
+        } else {
+            escaped += c;
+        }
+    }
+
+    return escaped;
+}
+
+static void writeMeasurement(std::ostream &out, const Measurement &m) {
+    out << "    {\"name\": \"" << jsonEscape(m.name) << "\", "
+        << "\"min_ms\": " << m.min() << ", \"median_ms\": " << m.median() << ", \"mean_ms\": " << m.mean();
+
+    if(m.bytes) {
+        out << ", \"bytes\": " << m.bytes << ", \"mb_per_s\": " << (double(m.bytes) / 1e6) / (m.min() / 1000.0);
+    }
+
+    if(m.items) {
+        out << ", \"items\": " << m.items;
+    }
+
+    if(m.busyPercent >= 0) {
+        out << ", \"busy_percent\": " << m.busyPercent << ", \"stolen\": " << m.stolen;
+    }
+
+    if(m.speedup > 0) {
+        out << ", \"speedup\": " << m.speedup;
+    }
+
+    out << '}';
+}
+
+class Bench {
+    std::vector<ScriptFile> &files;
+    size_t iterations;
+    size_t totalBytes = 0;
+
+    std::ostream nullLog { nullptr };
+
+    volatile uint32_t crcSink = 0;
+
+    // Set when a kernel or implementation being timed gives the wrong answer.
+    bool failed = false;
+
+    // Measurements keyed by name, kept in the order they were first recorded. A deque keeps references
+    //  valid as more are added.
+    std::deque<Measurement> measurements;
+
+    Measurement &measurement(string_ref name) {
+        for(auto &m : measurements) {
+            if(m.name == name) return m;
+        }
+
+        measurements.push_back({ name, std::vector<double>(iterations, 0.0) });
+        return measurements.back();
+    }
+
+public:
+    bool anyFailed() const {
+        return failed;
+    }
+
+    Bench(std::vector<ScriptFile> &files, size_t iterations) : files { files }, iterations { iterations } {
+        for(auto &file : files) totalBytes += file.file.size;
+    }
+
+    void opcodeDatabase(string_ref path) {
+        Measurement &m = measurement("opcode_db_load");
+
+        for(size_t i = 0; i < iterations; ++i) {
+            auto start = Clock::now();
+            parseOpcodeFile(path);
+            m.samples[i] = millisecondsSince(start);
+        }
+
+        m.bytes = std::filesystem::file_size(path);
+    }
+
+    // DecompilerContext::read over every file without building a Script, using the given byte-scanning kernels.
+    void rawDecode(string_ref name, const simd::Kernels &kernels) {
+        Measurement &m = measurement(name);
+        m.bytes = totalBytes;
+
+        const simd::Kernels *oldKernels = simd::activeKernels();
+        simd::activeKernels() = &kernels;
+
+        for(size_t i = 0; i < iterations; ++i) {
+            size_t count = 0;
+
+            auto start = Clock::now();
+            for(auto &file : files) {
+                miss2::Decompiler::forEachCommand(file.file.data, file.file.size, [&](miss2::Command &) {
+                    ++count;
+                });
+            }
+
+            m.samples[i] = millisecondsSince(start);
+            m.items = count;
+        }
+
+        simd::activeKernels() = oldKernels;
+    }
+
+    // Decompiler::decompile, which also builds the offset table and jump information.
+    void scriptDecode() {
+        Measurement &m = measurement("decode_script");
+        m.bytes = totalBytes;
+
+        for(size_t i = 0; i < iterations; ++i) {
+            auto start = Clock::now();
+            for(auto &file : files) {
+                miss2::Decompiler::decompile(file.file.data, file.file.size, nullLog);
+            }
+
+            m.samples[i] = millisecondsSince(start);
+        }
+    }
+
+    // Each pass is timed on its own, running on the state left by the passes before it (as in
+    //  Script::analyse()).
+    void passes() {
+        std::vector<miss2::Script> decoded;
+        for(auto &file : files) {
+            decoded.push_back(miss2::Decompiler::decompile(file.file.data, file.file.size, nullLog));
+            decoded.back().log = &nullLog;
+        }
+
+        for(size_t i = 0; i < iterations; ++i) {
+            for(const miss2::Script &original : decoded) {
+                miss2::Script script = original;
+                std::set<int32_t> hiddenOffsets;
+
+                auto time = [&](string_ref name, const std::function<void()> &pass) {
+                    auto start = Clock::now();
+                    pass();
+                    measurement(name).samples[i] += millisecondsSince(start);
+                };
+
+                if(script.options.optimize) {
+                    time("pass_optimize", [&] { script.optimizeScript(); });
+                }
+
+                time("pass_if_statements", [&] {
+                    auto lastIfSize = script.ifStatements.size();
+
+                    while(true) {
+                        script.createIfStatements();
+                        if(script.ifStatements.size() == lastIfSize) break;
+                        lastIfSize = script.ifStatements.size();
+                    }
+                });
+
+                time("pass_for_loops", [&] { script.createForLoops(hiddenOffsets); });
+                time("pass_procedures", [&] { script.createProcedures(); });
+                time("pass_while_loops", [&] { script.createWhileLoops(hiddenOffsets); });
+
+                if(script.options.clean) {
+                    time("pass_dead_code", [&] { script.removeDeadCode(hiddenOffsets); });
+                }
+
+                time("pass_labels", [&] { script.createLabels(hiddenOffsets); });
+                time("pass_globals", [&] { script.createGlobals(); });
+
+                CountingBuffer buffer;
+                std::ostream out(&buffer);
+
+                time("render", [&] { script.render(out, hiddenOffsets); });
+                measurement("render").items += buffer.count;
+            }
+        }
+
+        // 'items' for rendering was summed over every iteration.
+        measurement("render").items /= iterations;
+    }
+
+    // Script::analyse() with every pass on the calling thread and with independent passes running at the same
+    //  time. gtasm_check checks that the output is the same either way.
+    void analysis() {
+        std::vector<miss2::Script> decoded;
+        for(auto &file : files) {
+            decoded.push_back(miss2::Decompiler::decompile(file.file.data, file.file.size, nullLog));
+            decoded.back().log = &nullLog;
+        }
+
+        // At least two threads, so the concurrent path is checked even on one core.
+        const std::pair<std::string, size_t> modes[] = {
+                { "serial", 1 },
+                { "parallel", std::max<size_t>(2, ThreadPool::defaultThreadCount()) },
+        };
+
+        for(size_t which = 0; which < std::size(modes); ++which) {
+            auto &[modeName, threads] = modes[which];
+
+            Measurement &m = measurement("analyse/" + modeName);
+            m.bytes = totalBytes;
+
+            for(size_t i = 0; i < iterations; ++i) {
+                for(const miss2::Script &original : decoded) {
+                    miss2::Script script = original;
+                    script.analysisThreads = threads;
+                    std::set<int32_t> hiddenOffsets;
+
+                    auto start = Clock::now();
+                    script.analyse(hiddenOffsets);
+                    m.samples[i] += millisecondsSince(start);
+                }
+            }
+        }
+    }
+
+    // Analyses and renders every script as a job on a work-stealing pool, biggest script first, with the
+    //  analysis passes of each script as jobs of their own. Records how busy the workers were. From the time
+    //  each script took on one thread, it also works out the best speedup that scheduling whole scripts could
+    //  give on up to 32 cores. One core has to do all of the biggest script, which limits the rest.
+    void corpusAnalysis() {
+        std::vector<miss2::Script> decoded;
+        for(auto &file : files) {
+            decoded.push_back(miss2::Decompiler::decompile(file.file.data, file.file.size, nullLog));
+            decoded.back().log = &nullLog;
+        }
+
+        std::vector<double> scriptTimes(decoded.size(), 0.0);
+
+        for(size_t threads : { size_t(1), std::max<size_t>(2, ThreadPool::defaultThreadCount()) }) {
+            Measurement &m = measurement("corpus_analyse/" + std::to_string(threads) + "_threads");
+            m.bytes = totalBytes;
+            m.items = decoded.size();
+
+            double busy = 0;
+            size_t stolen = 0;
+
+            for(size_t i = 0; i < iterations; ++i) {
+                WorkStealingPool pool(threads);
+                std::vector<std::pair<uint64_t, std::function<void()>>> jobs;
+
+                for(size_t s = 0; s < decoded.size(); ++s) {
+                    jobs.emplace_back(decoded[s].commands.size(), [&, s, threads] {
+                        auto start = Clock::now();
+
+                        // Each job has its own log, as writing to a stream changes its state.
+                        std::ostream log(nullptr);
+
+                        miss2::Script script = decoded[s];
+                        script.scheduler = &pool;
+                        script.log = &log;
+
+                        CountingBuffer buffer;
+                        std::ostream out(&buffer);
+                        script.prettyPrint(out);
+
+                        if(threads == 1) scriptTimes[s] += millisecondsSince(start);
+                    });
+                }
+
+                pool.resetUtilisation();
+                auto start = Clock::now();
+
+                pool.submitLargestFirst(std::move(jobs));
+                pool.wait();
+
+                m.samples[i] = millisecondsSince(start);
+
+                auto utilisation = pool.utilisation();
+                busy += utilisation.busyFraction();
+                stolen += utilisation.stolen();
+            }
+
+            m.busyPercent = busy / double(iterations) * 100.0;
+            m.stolen = stolen / iterations;
+        }
+
+        // The best time that many workers could manage with whole scripts as jobs, from the one-thread times.
+        //  On a machine with few cores, this shows how far scheduling by file could scale. Splitting big
+        //  scripts into chunks only makes the real runs better than this.
+        double totalTime = std::accumulate(scriptTimes.begin(), scriptTimes.end(), 0.0) / double(iterations);
+
+        std::vector<double> sortedTimes = scriptTimes;
+        std::sort(sortedTimes.begin(), sortedTimes.end(), std::greater<>());
+
+        for(size_t workers = 1; workers <= 32; workers *= 2) {
+            // Each script goes to the least loaded worker, biggest first, as with submitLargestFirst().
+            std::vector<double> loads(workers, 0.0);
+
+            for(double time : sortedTimes) {
+                *std::min_element(loads.begin(), loads.end()) += time / double(iterations);
+            }
+
+            double makespan = *std::max_element(loads.begin(), loads.end());
+
+            Measurement &bound = measurement("corpus_analyse_bound/" + std::to_string(workers) + "_workers");
+            std::fill(bound.samples.begin(), bound.samples.end(), makespan);
+            bound.speedup = makespan > 0 ? totalTime / makespan : 0;
+        }
+    }
+
+    // Each byte-scanning kernel run across every file, once with the scalar code and once with the kernels
+    //  picked for this CPU. A kernel returns the length of a run, so each scan steps over one run at a time.
+    void stringKernels() {
+        using Kernel = size_t (*)(const uint8_t *, size_t);
+
+        std::vector<std::pair<std::string, Kernel simd::Kernels::*>> kinds {
+            { "printable_prefix", &simd::Kernels::printablePrefix },
+            { "nul_length", &simd::Kernels::nulLength },
+            { "zero_run", &simd::Kernels::zeroRun },
+            { "ascii_prefix", &simd::Kernels::asciiPrefix }
+        };
+
+        for(auto &[kindName, member] : kinds) {
+            size_t runCounts[2] {};
+            const simd::Kernels *implementations[] { &simd::scalarKernels, &simd::bestKernels() };
+
+            for(int which = 0; which < 2; ++which) {
+                Kernel kernel = implementations[which]->*member;
+                Measurement &m = measurement("kernel_" + kindName + "/" + implementations[which]->name);
+                m.bytes = totalBytes;
+
+                for(size_t i = 0; i < iterations; ++i) {
+                    size_t runs = 0;
+
+                    auto start = Clock::now();
+                    for(auto &file : files) {
+                        for(size_t position = 0; position < file.file.size; ++runs) {
+                            position += kernel(file.file.data + position, file.file.size - position) + 1;
+                        }
+                    }
+
+                    m.samples[i] = millisecondsSince(start);
+                    m.items = runCounts[which] = runs;
+                }
+            }
+
+            if(runCounts[0] != runCounts[1]) {
+                std::cerr << "error: " << kindName << " kernels disagree (" << runCounts[0] << " runs vs "
+                          << runCounts[1] << ")\n";
+                failed = true;
+            }
+        }
+    }
+
+    // Each CRC-32 implementation over the bytes of every file, and the GXT key hash over short keys like the
+    //  ones the game uses. Every implementation is checked first.
+    void crcVariants() {
+        if(not crc::selfTest()) {
+            std::cerr << "error: CRC-32 self-test failed\n";
+            failed = true;
+        }
+
+        for(const crc::Variant &variant : crc::allVariants()) {
+            Measurement &m = measurement(std::string("crc_") + variant.name);
+            m.bytes = totalBytes;
+
+            uint32_t checksum = 0;
+
+            for(size_t i = 0; i < iterations; ++i) {
+                auto start = Clock::now();
+                for(auto &file : files) {
+                    checksum ^= variant.update(~0u, file.file.data, file.file.size);
+                }
+
+                m.samples[i] = millisecondsSince(start);
+            }
+
+            // Keep the results live.
+            crcSink = checksum;
+        }
+
+        std::vector<std::string> keys;
+        size_t keyBytes = 0;
+
+        for(int i = 0; i < 100000; ++i) {
+            keys.push_back("mis_" + std::to_string(i));
+            keyBytes += keys.back().size();
+        }
+
+        Measurement &m = measurement("gxt_key_hash");
+        m.bytes = keyBytes;
+        m.items = keys.size();
+
+        for(size_t i = 0; i < iterations; ++i) {
+            uint32_t combined = 0;
+
+            auto start = Clock::now();
+            for(const std::string &key : keys) combined ^= crc::gxtKeyHash(key);
+
+            m.samples[i] = millisecondsSince(start);
+            crcSink = combined;
+        }
+    }
+
+    // Decoding every string of the GXT files to UTF-8 with the scalar kernels and the ones picked for this
+    //  CPU, then exporting every subtable (as gtasm --export-gxt does, without writing the files) on one
+    //  thread and on all of them.
+    void gxtText(const std::vector<std::string> &paths) {
+        std::vector<GXT> gxts(paths.size());
+        size_t textBytes = 0, stringCount = 0;
+
+        for(size_t f = 0; f < paths.size(); ++f) {
+            if(not gxts[f].open(paths[f])) return;
+
+            for(const GXT::Subtable &subtable : gxts[f].allSubtables()) {
+                textBytes += subtable.dataSize;
+                stringCount += subtable.keyCount;
+            }
+        }
+
+        const simd::Kernels *oldKernels = simd::activeKernels();
+        const simd::Kernels *implementations[] { &simd::scalarKernels, &simd::bestKernels() };
+        size_t outputSizes[2] {};
+
+        for(int which = 0; which < 2; ++which) {
+            simd::activeKernels() = implementations[which];
+
+            Measurement &m = measurement(std::string("gxt_decode/") + implementations[which]->name);
+            m.bytes = textBytes;
+            m.items = stringCount;
+
+            for(size_t i = 0; i < iterations; ++i) {
+                size_t outputSize = 0;
+                std::string text;
+
+                auto start = Clock::now();
+                for(const GXT &gxt : gxts) {
+                    for(const GXT::Subtable &subtable : gxt.allSubtables()) {
+                        for(uint32_t k = 0; k < subtable.keyCount; ++k) {
+                            if(gxt.text(subtable, k, text)) outputSize += text.size();
+                        }
+                    }
+                }
+
+                m.samples[i] = millisecondsSince(start);
+                outputSizes[which] = outputSize;
+            }
+        }
+
+        simd::activeKernels() = oldKernels;
+
+        if(outputSizes[0] != outputSizes[1]) {
+            std::cerr << "error: GXT decoding kernels disagree (" << outputSizes[0] << " bytes vs " << outputSizes[1]
+                      << ")\n";
+            failed = true;
+        }
+
+        GXTKeyNames noNames;
+
+        for(size_t threads : { size_t(1), ThreadPool::defaultThreadCount() }) {
+            Measurement &m = measurement("gxt_export/" + std::to_string(threads) + "_threads");
+            m.bytes = textBytes;
+            m.items = stringCount;
+
+            for(size_t i = 0; i < iterations; ++i) {
+                std::vector<std::vector<std::string>> sections(gxts.size());
+                for(size_t f = 0; f < gxts.size(); ++f) sections[f].resize(gxts[f].allSubtables().size());
+
+                auto start = Clock::now();
+
+                {
+                    ThreadPool pool(threads);
+
+                    for(size_t f = 0; f < gxts.size(); ++f) {
+                        for(size_t s = 0; s < gxts[f].allSubtables().size(); ++s) {
+                            pool.submit([&, f, s] {
+                                sections[f][s] = exportGXTSubtable(gxts[f], gxts[f].allSubtables()[s], noNames);
+                            });
+                        }
+                    }
+
+                    pool.wait();
+                }
+
+                m.samples[i] = millisecondsSince(start);
+            }
+
+            if(threads == 1 and ThreadPool::defaultThreadCount() == 1) break;
+        }
+    }
+
+    // Every file decompiled, rendered and encoded as binary IR on several threads at once. Each file is queued
+    //  twice, so the same script is also decoded on two threads at the same time. gtasm_check checks the
+    //  results against doing the files one at a time.
+    void concurrentDecompile() {
+        auto decompileFile = [](const ScriptFile &file) {
+            std::ostream log(nullptr);
+            miss2::Script script = miss2::Decompiler::decompile(file.file.data, file.file.size, log);
+
+            std::ostringstream out;
+            script.prettyPrint(out);
+
+            auto ir = miss2::encodeBinaryIR(script.commands, script.sourceSize);
+            return out.str() + std::string(ir.begin(), ir.end());
+        };
+
+        size_t threads = std::max<size_t>(2, ThreadPool::defaultThreadCount());
+
+        Measurement &m = measurement("decompile_concurrent/" + std::to_string(threads) + "_threads");
+        m.bytes = totalBytes * 2;
+        m.items = files.size() * 2;
+
+        for(size_t i = 0; i < iterations; ++i) {
+            std::vector<std::string> results(files.size() * 2);
+            ThreadPool pool(threads);
+
+            auto start = Clock::now();
+
+            for(size_t job = 0; job < results.size(); ++job) {
+                pool.submit([&, job] { results[job] = decompileFile(files[job / 2]); });
+            }
+
+            pool.wait();
+            m.samples[i] = millisecondsSince(start);
+        }
+    }
+
+    // Decoding one big script: every file joined together until there are at least 2 MB (decoding doesn't
+    //  depend on where an instruction is). The serial decoder is timed against the checkpoint scan on its own
+    //  and chunked decoding with one thread and with all of them (gtasm_check checks that the commands are
+    //  the same). From the time each chunk took on one thread, it also works out the speedup that 1 to 32 workers
+    //  could get, with the scan and the hand-over of the commands in order left serial.
+    void parallelDecode() {
+        std::vector<uint8_t> input;
+
+        while(input.size() < 2 * 1024 * 1024) {
+            for(auto &file : files) input.insert(input.end(), file.file.data, file.file.data + file.file.size);
+        }
+
+        Measurement &serial = measurement("decode_large/serial");
+        serial.bytes = input.size();
+
+        for(size_t i = 0; i < iterations; ++i) {
+            std::vector<miss2::Command> commands;
+
+            auto start = Clock::now();
+            miss2::Decompiler::forEachCommand(input.data(), input.size(), [&](miss2::Command &command) {
+                commands.push_back(std::move(command));
+            });
+            serial.samples[i] = millisecondsSince(start);
+
+            serial.items = commands.size();
+        }
+
+        Measurement &scan = measurement("decode_large/checkpoint_scan");
+        scan.bytes = input.size();
+
+        std::vector<size_t> checkpoints;
+
+        for(size_t i = 0; i < iterations; ++i) {
+            auto start = Clock::now();
+            checkpoints = miss2::Decompiler::findCheckpoints(input.data(), input.size());
+            scan.samples[i] = millisecondsSince(start);
+
+            scan.items = checkpoints.size();
+        }
+
+        double oneThread = 0;
+
+        for(size_t threads : { size_t(1), std::max<size_t>(2, ThreadPool::defaultThreadCount()) }) {
+            Measurement &m = measurement("decode_large/" + std::to_string(threads) + "_threads");
+            m.bytes = input.size();
+
+            for(size_t i = 0; i < iterations; ++i) {
+                WorkStealingPool pool(threads);
+                std::vector<miss2::Command> commands;
+
+                auto start = Clock::now();
+                miss2::Decompiler::forEachCommandParallel(input.data(), input.size(), pool, [&](miss2::Command &command) {
+                    commands.push_back(std::move(command));
+                });
+                m.samples[i] = millisecondsSince(start);
+
+                m.items = commands.size();
+            }
+
+            if(threads == 1) oneThread = m.median();
+        }
+
+        // Each chunk on its own, for the bound.
+        std::vector<double> chunkTimes(checkpoints.size(), 0.0);
+
+        for(size_t i = 0; i < iterations; ++i) {
+            for(size_t c = 0; c < checkpoints.size(); ++c) {
+                std::vector<miss2::Command> commands;
+
+                auto start = Clock::now();
+                miss2::Decompiler::decodeChunk(input.data(), input.size(), checkpoints, c, [&](miss2::Command &command) {
+                    commands.push_back(std::move(command));
+                });
+                chunkTimes[c] += millisecondsSince(start) / double(iterations);
+            }
+        }
+
+        double chunkTotal = std::accumulate(chunkTimes.begin(), chunkTimes.end(), 0.0);
+
+        // Everything that isn't decoding a chunk: the scan, and handing the commands over in order.
+        double serialPart = scan.median() + std::max(0.0, oneThread - scan.median() - chunkTotal);
+
+        std::vector<double> sortedTimes = chunkTimes;
+        std::sort(sortedTimes.begin(), sortedTimes.end(), std::greater<>());
+
+        for(size_t workers = 1; workers <= 32; workers *= 2) {
+            std::vector<double> loads(workers, 0.0);
+
+            for(double time : sortedTimes) {
+                *std::min_element(loads.begin(), loads.end()) += time;
+            }
+
+            double bound = serialPart + *std::max_element(loads.begin(), loads.end());
+
+            Measurement &m = measurement("decode_large_bound/" + std::to_string(workers) + "_workers");
+            std::fill(m.samples.begin(), m.samples.end(), bound);
+            m.bytes = input.size();
+            m.speedup = bound > 0 ? serial.median() / bound : 0;
+        }
+    }
+
+    // Learning the parameter signatures of the corpus on every core, then checking every instruction against
+    //  them. The database must read back as it was written.
+    void signatures() {
+        std::vector<std::string> paths;
+        for(auto &file : files) paths.push_back(file.path);
+
+        auto table = miss2::OpcodeTable::fromContext();
+        std::vector<uint8_t> encoded;
+
+        Measurement &learn = measurement("learn_signatures");
+        learn.bytes = totalBytes;
+
+        for(size_t i = 0; i < iterations; ++i) {
+            WorkStealingPool pool;
+            miss2::SignatureDatabase signatures;
+
+            auto start = Clock::now();
+            signatures.addScripts(paths, table, pool);
+            learn.samples[i] = millisecondsSince(start);
+
+            learn.items = signatures.all().size();
+            encoded = signatures.encodeBinary();
+        }
+
+        miss2::SignatureDatabase signatures;
+
+        if(not signatures.decodeBinary(encoded.data(), encoded.size()) or signatures.encodeBinary() != encoded) {
+            std::cerr << "error: the signature database doesn't read back as it was written\n";
+            failed = true;
+        }
+
+        Measurement &check = measurement("check_signatures");
+        check.bytes = totalBytes;
+
+        for(size_t i = 0; i < iterations; ++i) {
+            size_t outliers = 0;
+            auto start = Clock::now();
+
+            for(auto &file : files) {
+                miss2::FlatDecoder decoder(table, file.file.data, file.file.size);
+                miss2::FlatInstruction instruction;
+
+                while(decoder.next(instruction)) {
+                    if(signatures.check(instruction)) ++outliers;
+                }
+            }
+
+            check.samples[i] = millisecondsSince(start);
+            check.items = outliers;
+        }
+    }
+
+    // Load, decompile and render every file, one at a time.
+    void endToEnd() {
+        Measurement &total = measurement("end_to_end");
+        total.bytes = totalBytes;
+
+        for(size_t i = 0; i < iterations; ++i) {
+            for(auto &file : files) {
+                auto start = Clock::now();
+
+                MappedFile source(file.path.c_str());
+                miss2::Script script = miss2::Decompiler::decompile(source.data, source.size, nullLog);
+
+                CountingBuffer buffer;
+                std::ostream out(&buffer);
+                script.prettyPrint(out);
+
+                double elapsed = millisecondsSince(start);
+                total.samples[i] += elapsed;
+
+                Measurement &perFile = measurement("end_to_end/" + file.name);
+                perFile.samples[i] = elapsed;
+                perFile.bytes = file.file.size;
+            }
+        }
+    }
+
+    void writeJSON(std::ostream &out, string_ref directory) {
+        out << std::fixed << std::setprecision(4);
+        out << "{\n";
+        out << "  \"directory\": \"" << jsonEscape(directory) << "\",\n";
+        out << "  \"files\": " << files.size() << ",\n";
+        out << "  \"bytes\": " << totalBytes << ",\n";
+        out << "  \"iterations\": " << iterations << ",\n";
+        out << "  \"benchmarks\": [\n";
+
+        for(size_t i = 0; i < measurements.size(); ++i) {
+            writeMeasurement(out, measurements[i]);
+            out << (i + 1 < measurements.size() ? ",\n" : "\n");
+        }
+
+        out << "  ]\n}\n";
+    }
+};
+
+int main(int argc, char **argv) {
+    std::string opcodePath = "Opcodes.ini";
+    std::string directory = "GTA Scripts";
+    std::string outputPath;
+    std::vector<std::string> gxtPaths;
+    size_t iterations = 5;
+
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+
+        if(arg.starts_with("--opcodes=")) {
+            opcodePath = arg.substr(std::strlen("--opcodes="));
+        } else if(arg.starts_with("--iterations=")) {
+            iterations = std::max(1, std::atoi(arg.c_str() + std::strlen("--iterations=")));
+        } else if(arg.starts_with("--output=")) {
+            outputPath = arg.substr(std::strlen("--output="));
+        } else if(arg.starts_with("--gxt=")) {
+            gxtPaths.push_back(arg.substr(std::strlen("--gxt=")));
+        } else {
+            directory = arg;
+        }
+    }
+
+    std::vector<ScriptFile> files;
+    for(auto &entry : std::filesystem::directory_iterator(directory)) {
+        if(entry.is_regular_file() and stringLower(entry.path().extension().string()) == ".scm") {
+            files.push_back({ entry.path().filename().string(), entry.path().string(), MappedFile(entry.path().c_str()) });
+
+            if(not files.back().file) {
+                std::cerr << "error: could not read " << entry.path() << '\n';
+                return 1;
+            }
+        }
+    }
+
+    if(files.empty()) {
+        std::cerr << "error: no .scm files found in " << directory << '\n';
+        return 1;
+    }
+
+    std::sort(files.begin(), files.end(), [](const ScriptFile &a, const ScriptFile &b) {
+        return a.name < b.name;
+    });
+
+    Bench bench(files, iterations);
+    bench.opcodeDatabase(opcodePath);
+    bench.rawDecode("decode_raw", simd::bestKernels());
+    bench.rawDecode("decode_raw/scalar_kernels", simd::scalarKernels);
+    bench.scriptDecode();
+    bench.passes();
+    bench.analysis();
+    bench.corpusAnalysis();
+    bench.concurrentDecompile();
+    bench.parallelDecode();
+    bench.signatures();
+    bench.stringKernels();
+    bench.crcVariants();
+    if(not gxtPaths.empty()) bench.gxtText(collectFiles(gxtPaths, ".gxt"));
+    bench.endToEnd();
+
+    if(outputPath.empty()) {
+        bench.writeJSON(std::cout, directory);
+        return bench.anyFailed() ? 1 : 0;
+    }
+
+    std::ofstream output(outputPath);
+    bench.writeJSON(output, directory);
+
+    if(not output) {
+        std::cerr << "error: could not write " << outputPath << '\n';
+        return 1;
+    }
+
+    return bench.anyFailed() ? 1 : 0;
+}
@@ -0,0 +1,370 @@
+//
+// Consistency checks for everything that runs on several threads. Each check does the same work one way on
+//  one thread and another way on several, and the results have to be identical:
+//
+//   - analysis with every pass on one thread, and with independent passes at the same time
+//   - rendering a script in one go, and in chunks on the work-stealing pool
+//   - decompiling every script one at a time, and all of them (each twice) on several threads at once
+//   - decoding a big script serially, and in chunks between checkpoints on the pool
+//
+// It also runs search patterns (miss2/search.hpp) over small hand-built scripts whose matches are known, and
+//  checks every CRC-32 implementation in crc32.hpp, including the GXT key hash, with crc::selfTest().
+//
+// Prints each mismatch and exits with a non-zero status if there were any, so it runs as a test (ctest runs
+//  it on "GTA Scripts"). Built with -DGTASM_SANITIZE=thread, it also checks all of this for data races.
+//
+// Usage: gtasm_check [--opcodes=<Opcodes.ini>] [--threads=<n>] [directory]
+//
+
+#include <iostream>
+#include <map>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <functional>
+#include <cstring>
+#include <filesystem>
+#include <algorithm>
+#include <set>
+#include "../util.hpp"
+#include "../crc32.hpp"
+#include "../opcode_file.hpp"
+#include "../miss2/decompiler.hpp"
+#include "../miss2/ir.hpp"
+#include "../miss2/search.hpp"
+
+struct ScriptFile {
+    std::string name;
+    MappedFile file;
+};
+
+class Checker {
+    std::vector<ScriptFile> &files;
+    size_t threads;
+
+    std::ostream nullLog { nullptr };
+
+    size_t failures = 0;
+
+    void fail(const std::string &message) {
+        std::cerr << "error: " << message << '\n';
+        ++failures;
+    }
+
+    // Rendered code without the comment at the top, which has the time in it.
+    static std::string withoutHeader(const std::string &text) {
+        return text.substr(std::min(text.find("*/"), text.size()));
+    }
+
+    // Compiles 'text' and checks that it finds exactly the (start, end) offsets in 'expected'.
+    void searchCase(const miss2::OpcodeTable &table, const std::vector<uint8_t> &bytes, const char *text,
+                    const std::vector<std::pair<uint32_t, uint32_t>> &expected) {
+        miss2::SearchPattern pattern;
+        std::string error;
+
+        if(not miss2::SearchPattern::compile(text, pattern, error)) {
+            fail(std::string("pattern '") + text + "' doesn't compile: " + error);
+            return;
+        }
+
+        std::vector<std::pair<uint32_t, uint32_t>> found;
+        pattern.scan(table, bytes.data(), bytes.size(), [&](uint32_t start, uint32_t end) {
+            found.emplace_back(start, end);
+        });
+
+        if(found != expected) {
+            std::string message = std::string("pattern '") + text + "' matches at";
+            for(auto &[start, end] : found) message += " " + std::to_string(start) + "-" + std::to_string(end);
+
+            fail(message + (found.empty() ? " nothing" : "") + ", expected " + std::to_string(expected.size()) + " match(es)");
+        }
+    }
+
+    std::vector<miss2::Script> decodeAll() {
+        std::vector<miss2::Script> decoded;
+
+        for(auto &file : files) {
+            decoded.push_back(miss2::Decompiler::decompile(file.file.data, file.file.size, nullLog));
+            decoded.back().log = &nullLog;
+        }
+
+        return decoded;
+    }
+
+public:
+    Checker(std::vector<ScriptFile> &files, size_t threads) : files { files }, threads { threads } {}
+
+    size_t failureCount() const {
+        return failures;
+    }
+
+    void analysis() {
+        auto decoded = decodeAll();
+
+        for(size_t f = 0; f < files.size(); ++f) {
+            std::string rendered[2];
+
+            for(int parallel = 0; parallel < 2; ++parallel) {
+                miss2::Script script = decoded[f];
+                script.analysisThreads = parallel ? threads : 1;
+
+                std::ostringstream out;
+                script.prettyPrint(out);
+                rendered[parallel] = withoutHeader(out.str());
+            }
+
+            if(rendered[0] != rendered[1]) {
+                fail(files[f].name + ": analysing on " + std::to_string(threads) + " threads gives different output");
+            }
+        }
+    }
+
+    void chunkedRender() {
+        auto decoded = decodeAll();
+        WorkStealingPool pool(threads);
+
+        for(size_t f = 0; f < files.size(); ++f) {
+            std::string rendered[2];
+
+            for(int chunked = 0; chunked < 2; ++chunked) {
+                miss2::Script script = decoded[f];
+                if(chunked) script.scheduler = &pool;
+
+                std::ostringstream out;
+                script.prettyPrint(out);
+                rendered[chunked] = withoutHeader(out.str());
+            }
+
+            if(rendered[0] != rendered[1]) {
+                fail(files[f].name + ": rendering in chunks gives different output");
+            }
+        }
+    }
+
+    void search() {
+        auto table = miss2::OpcodeTable::fromContext();
+
+        // wait 10, end_thread, return, end_thread, return, if 0 (at 0, 4, 6, 8, 10 and 12).
+        std::vector<uint8_t> flow {
+                0x01, 0x00, miss2::S8, 10,
+                0x4E, 0x00,
+                0x51, 0x00,
+                0x4E, 0x00,
+                0x51, 0x00,
+                0xD6, 0x00, miss2::S8, 0,
+        };
+
+        // Only the second 'return' is followed by 'if', so the gap has to survive the first.
+        searchCase(table, flow, "0001 ... 0051 00D6", { { 0, 12 } });
+        searchCase(table, flow, "0051 ... 00D6", { { 10, 12 } });
+        searchCase(table, flow, "004E 0051", { { 4, 6 }, { 8, 10 } });
+        searchCase(table, flow, "0001 * *", { { 0, 6 } });
+        searchCase(table, flow, "0001 ... 004E ... 00D6", { { 0, 12 } });
+        searchCase(table, flow, "00D6 ... 0001", {});
+        searchCase(table, flow, "?(10)", { { 0, 0 } });
+        searchCase(table, flow, "0001(>5)", { { 0, 0 } });
+        searchCase(table, flow, "0001(<5)", {});
+        searchCase(table, flow, "00D6(!0)", {});
+
+        // $12 = 5, name_thread 'MAIN', @3 = 1.5, $12 == 5, not $12 == 5 (at 0, 7, 18, 28 and 35).
+        std::vector<uint8_t> params {
+                0x04, 0x00, miss2::GlobalIntFloat, 12, 0, miss2::S8, 5,
+                0xA4, 0x03, miss2::String8, 'M', 'A', 'I', 'N', 0, 0, 0, 0,
+                0x06, 0x00, miss2::LocalIntFloat, 3, 0, miss2::F32, 0x00, 0x00, 0xC0, 0x3F,
+                0x38, 0x00, miss2::GlobalIntFloat, 12, 0, miss2::S8, 5,
+                0x38, 0x80, miss2::GlobalIntFloat, 12, 0, miss2::S8, 5,
+        };
+
+        searchCase(table, params, "0004($12, 5)", { { 0, 0 } });
+        searchCase(table, params, "0004($12, 6)", {});
+        searchCase(table, params, "0004(@12)", {});
+        searchCase(table, params, "?(_, 5)", { { 0, 0 }, { 28, 28 }, { 35, 35 } });
+        searchCase(table, params, "?($12) ... ?($12)", { { 0, 28 }, { 28, 35 } });
+        searchCase(table, params, "03A4('main')", { { 7, 7 } });
+        searchCase(table, params, "03A4('MAIN2')", {});
+        searchCase(table, params, "0006(@3, 1.5)", { { 18, 18 } });
+        searchCase(table, params, "0006(_, >2.0)", {});
+        searchCase(table, params, "0038", { { 28, 28 }, { 35, 35 } });
+        searchCase(table, params, "8038", { { 35, 35 } });
+        searchCase(table, params, "0004 * ... 8038", { { 0, 35 } });
+
+        for(const char *bad : { "", "0001 ...", "*(1)", "0001(", "0001(1,,2)", "0001(x)", "10000" }) {
+            miss2::SearchPattern pattern;
+            std::string error;
+
+            if(miss2::SearchPattern::compile(bad, pattern, error)) {
+                fail(std::string("pattern '") + bad + "' compiles but shouldn't");
+            }
+        }
+    }
+
+    // Every CRC-32 variant the machine supports (slice-by-8, SSE4.2 and so on) and the fixed GXT key hashes.
+    void crc() {
+        // selfTest() writes what was wrong to std::cerr itself.
+        if(not crc::selfTest()) fail("the CRC-32 self-test failed");
+    }
+
+    // Each file is queued twice, so the same script is also decoded on two threads at the same time.
+    void concurrentDecompile() {
+        auto decompileFile = [](const ScriptFile &file) {
+            std::ostream log(nullptr);
+            miss2::Script script = miss2::Decompiler::decompile(file.file.data, file.file.size, log);
+
+            std::ostringstream out;
+            script.prettyPrint(out);
+
+            auto ir = miss2::encodeBinaryIR(script.commands, script.sourceSize);
+            return withoutHeader(out.str()) + std::string(ir.begin(), ir.end());
+        };
+
+        std::vector<std::string> expected;
+        for(auto &file : files) expected.push_back(decompileFile(file));
+
+        std::vector<std::string> results(files.size() * 2);
+
+        {
+            ThreadPool pool(threads);
+
+            for(size_t job = 0; job < results.size(); ++job) {
+                pool.submit([&, job] { results[job] = decompileFile(files[job / 2]); });
+            }
+
+            pool.wait();
+        }
+
+        std::set<std::string> reported;
+
+        for(size_t job = 0; job < results.size(); ++job) {
+            const std::string &name = files[job / 2].name;
+
+            if(results[job] != expected[job / 2] and reported.insert(name).second) {
+                fail(name + ": decompiling on several threads gives different output");
+            }
+        }
+    }
+
+    // Every file joined into one script, decoded with the default checkpoint spacing and with a small one
+    //  so that there are many chunks.
+    void chunkedDecode() {
+        std::vector<uint8_t> input;
+        for(auto &file : files) input.insert(input.end(), file.file.data, file.file.data + file.file.size);
+
+        auto decode = [&](auto &&run) {
+            std::vector<miss2::Command> commands;
+
+            miss2::DecodeResult result = run([&](miss2::Command &command) {
+                commands.push_back(std::move(command));
+            });
+
+            auto ir = miss2::encodeBinaryIR(commands, input.size());
+            return std::string(ir.begin(), ir.end()) + (result.truncated ? result.message() : "");
+        };
+
+        std::string expected = decode([&](auto &&handler) {
+            return miss2::Decompiler::forEachCommand(input.data(), input.size(), handler);
+        });
+
+        WorkStealingPool pool(threads);
+
+        for(size_t spacing : { miss2::Decompiler::checkpoint_spacing, size_t(1024) }) {
+            std::string chunked = decode([&](auto &&handler) {
+                return miss2::Decompiler::forEachCommandParallel(input.data(), input.size(), pool, handler,
+                                                                 miss2::DecompilerContext::shared(), spacing);
+            });
+
+            if(chunked != expected) {
+                fail("decoding in chunks " + std::to_string(spacing) + " bytes apart gives different commands");
+            }
+
+            // The chunked decoder falls back to decoding serially if a chunk doesn't end at the next
+            //  checkpoint, which would hide a mistake in the checkpoints.
+            auto checkpoints = miss2::Decompiler::findCheckpoints(input.data(), input.size(), spacing);
+
+            for(size_t c = 0; c + 1 < checkpoints.size(); ++c) {
+                size_t stopped = miss2::Decompiler::decodeChunk(input.data(), input.size(), checkpoints, c, [](miss2::Command &) {});
+
+                if(stopped != checkpoints[c + 1]) {
+                    fail("the chunk at " + std::to_string(checkpoints[c]) + " ends at " + std::to_string(stopped)
+                         + " instead of the next checkpoint, " + std::to_string(checkpoints[c + 1]));
+                    break;
+                }
+            }
+        }
+    }
+};
+
+int main(int argc, char **argv) {
+    std::string opcodePath = "Opcodes.ini";
+    std::string directory = "GTA Scripts";
+
+    // At least two, so the concurrent paths are checked even on one core.
+    size_t threads = std::max<size_t>(2, ThreadPool::defaultThreadCount());
+
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+
+        if(arg.starts_with("--opcodes=")) {
+            opcodePath = arg.substr(std::strlen("--opcodes="));
+        } else if(arg.starts_with("--threads=")) {
+            threads = std::max(2, std::atoi(arg.c_str() + std::strlen("--threads=")));
+        } else {
+            directory = arg;
+        }
+    }
+
+    if(not std::ifstream(opcodePath)) {
+        std::cerr << "error: could not read " << opcodePath << '\n';
+        return 1;
+    }
+
+    parseOpcodeFile(opcodePath);
+
+    std::vector<ScriptFile> files;
+    std::error_code error;
+
+    for(auto &entry : std::filesystem::directory_iterator(directory, error)) {
+        if(entry.is_regular_file() and stringLower(entry.path().extension().string()) == ".scm") {
+            files.push_back({ entry.path().filename().string(), MappedFile(entry.path().c_str()) });
+
+            if(not files.back().file) {
+                std::cerr << "error: could not read " << entry.path() << '\n';
+                return 1;
+            }
+        }
+    }
+
+    if(files.empty()) {
+        std::cerr << "error: no .scm files found in " << directory << '\n';
+        return 1;
+    }
+
+    std::sort(files.begin(), files.end(), [](const ScriptFile &a, const ScriptFile &b) {
+        return a.name < b.name;
+    });
+
+    const std::pair<const char *, void (Checker::*)()> checks[] = {
+            { "analysis", &Checker::analysis },
+            { "chunked render", &Checker::chunkedRender },
+            { "concurrent decompile", &Checker::concurrentDecompile },
+            { "chunked decode", &Checker::chunkedDecode },
+            { "search", &Checker::search },
+            { "crc", &Checker::crc },
+    };
+
+    Checker checker(files, threads);
+
+    for(auto &[name, check] : checks) {
+        size_t before = checker.failureCount();
+        (checker.*check)();
+
+        std::cerr << name << ": " << (checker.failureCount() == before ? "ok" : "FAILED") << '\n';
+    }
+
+    if(checker.failureCount()) {
+        std::cerr << checker.failureCount() << " check(s) failed\n";
+        return 1;
+    }
+
+    std::cerr << "all checks passed on " << files.size() << " scripts with " << threads << " threads\n";
+    return 0;
+}
@@ -0,0 +1,231 @@
+//
+// libFuzzer target for everything that reads untrusted bytes: Decompiler::forEachCommand() (and the chunked
+//  decoding built on it), FlatDecoder::next(), Resync::skipLength() and BinaryIRReader. Each input is copied
+//  into a buffer of exactly its own size, so with -DGTASM_SANITIZE=address any read past the end is caught.
+//  Besides not crashing, the results must be consistent:
+//
+//   - every decoded command ends within the input, and the commands come in offset order
+//   - a DecodeResult that isn't 'truncated' means everything was decoded, and one that is describes an
+//     instruction that starts within the input and needs more bytes than were left
+//   - decoding the chunks between findCheckpoints() offsets gives the same commands as forEachCommand()
+//   - binary IR encoded from the commands reads back as the same opcodes and offsets
+//
+// Configure with -DGTASM_FUZZ=ON. With clang, the target is linked with -fsanitize=fuzzer:
+//
+//   gtasm_fuzz_decode [corpus directory] [libFuzzer options]
+//
+// With other compilers there is no libFuzzer, so a small driver runs each file given on the command line
+//  through the target once instead (to replay a crash, for example). The opcode file is the repository's
+//  Opcodes.ini unless GTASM_FUZZ_OPCODES names another.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include "../util.hpp"
+#include "../opcode_file.hpp"
+#include "../miss2/decompiler.hpp"
+#include "../miss2/opcode_table.hpp"
+#include "../miss2/resync.hpp"
+#include "../miss2/ir.hpp"
+
+#ifndef GTASM_FUZZ_OPCODES_PATH
+#define GTASM_FUZZ_OPCODES_PATH "Opcodes.ini"
+#endif
+
+#define FUZZ_CHECK(condition) \
+    do { \
+        if(not (condition)) { \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            std::abort(); \
+        } \
+    } while(false)
+
+// Chunks this small give a few checkpoints even for short inputs.
+static const size_t fuzz_checkpoint_spacing = 64;
+
+static const miss2::OpcodeTable *opcodeTable = nullptr;
+
+// The number of bytes 'command' took up in the input.
+static size_t commandLength(const miss2::Command &command) {
+    size_t length = 2;
+
+    for(const miss2::Value &param : command.parameters) {
+        if(param.type == miss2::RawBytes) {
+            length += param.byteCount();
+        } else {
+            length += 1 + (param.type == miss2::StringVar ? 1 : 0) + param.byteCount();
+        }
+    }
+
+    return length;
+}
+
+static std::vector<miss2::Command> checkForEachCommand(uint8_t *bytes, size_t size) {
+    std::vector<miss2::Command> commands;
+
+    miss2::DecodeResult result = miss2::Decompiler::forEachCommand(bytes, size, [&](miss2::Command &command) {
+        FUZZ_CHECK(command.offset >= 0);
+        FUZZ_CHECK(size_t(command.offset) + commandLength(command) <= size);
+
+        if(not commands.empty()) {
+            FUZZ_CHECK(command.offset >= commands.back().offset + int32_t(commandLength(commands.back())));
+        }
+
+        commands.push_back(command);
+    });
+
+    if(result.truncated) {
+        FUZZ_CHECK(result.offset < size);
+        FUZZ_CHECK(result.offset + result.available == size);
+        FUZZ_CHECK(result.length > result.available);
+
+        if(not commands.empty()) {
+            FUZZ_CHECK(size_t(commands.back().offset) + commandLength(commands.back()) <= result.offset);
+        }
+    } else {
+        FUZZ_CHECK(result.offset == 0 and result.length == 0 and result.available == 0);
+    }
+
+    return commands;
+}
+
+static void checkChunks(uint8_t *bytes, size_t size, const std::vector<miss2::Command> &expected) {
+    auto checkpoints = miss2::Decompiler::findCheckpoints(bytes, size, fuzz_checkpoint_spacing);
+
+    FUZZ_CHECK(not checkpoints.empty() and checkpoints[0] == 0);
+
+    std::vector<miss2::Command> commands;
+    auto collect = [&](miss2::Command &command) { commands.push_back(command); };
+
+    for(size_t c = 0; c < checkpoints.size(); ++c) {
+        size_t stopped = miss2::Decompiler::decodeChunk(bytes, size, checkpoints, c, collect);
+
+        if(c + 1 < checkpoints.size()) {
+            FUZZ_CHECK(checkpoints[c + 1] > checkpoints[c]);
+            FUZZ_CHECK(stopped == checkpoints[c + 1]);
+        }
+    }
+
+    // The tail after the last chunk is decoded the same way by both, so only the chunks are compared.
+    FUZZ_CHECK(commands.size() <= expected.size());
+
+    for(size_t i = 0; i < commands.size(); ++i) {
+        FUZZ_CHECK(commands[i].offset == expected[i].offset);
+        FUZZ_CHECK(commands[i].opcode == expected[i].opcode);
+        FUZZ_CHECK(commands[i].parameters.size() == expected[i].parameters.size());
+    }
+}
+
+static void checkFlatDecoder(const uint8_t *bytes, size_t size) {
+    miss2::FlatDecoder decoder(*opcodeTable, bytes, size);
+    miss2::FlatInstruction instruction;
+
+    int64_t previous = -1;
+
+    while(decoder.next(instruction)) {
+        FUZZ_CHECK(int64_t(instruction.offset) > previous);
+        FUZZ_CHECK(size_t(instruction.offset) + 2 <= size);
+        FUZZ_CHECK(instruction.paramCount <= miss2::FlatInstruction::max_params);
+
+        previous = instruction.offset;
+    }
+}
+
+static void checkResync(const uint8_t *bytes, size_t size) {
+    miss2::Resync resync = miss2::Resync::fromContext(miss2::DecompilerContext::shared());
+
+    // Every offset is tried as a bad instruction, but only near the start, so long inputs don't time out.
+    for(size_t start = 0; start < size and start < 256; ++start) {
+        size_t available = size - start;
+        size_t skip = resync.skipLength(bytes + start, bytes + size);
+
+        FUZZ_CHECK(skip <= available);
+        FUZZ_CHECK(skip >= std::min<size_t>(available, 2));
+    }
+}
+
+static void checkBinaryIR(const uint8_t *bytes, size_t size) {
+    miss2::BinaryIRReader reader(bytes, size);
+    miss2::BinaryIRRecord record;
+
+    while(reader.next(record)) {
+        for(size_t i = 0; i < record.paramCount; ++i) {
+            const miss2::BinaryIRParam &param = record.params[i];
+            if(not param.size) continue;
+
+            FUZZ_CHECK(param.data >= bytes and param.data + param.size <= bytes + size);
+        }
+    }
+}
+
+static void checkIRRoundTrip(const std::vector<miss2::Command> &commands, size_t size) {
+    auto ir = miss2::encodeBinaryIR(commands, size);
+
+    miss2::BinaryIRReader reader(ir.data(), ir.size());
+    FUZZ_CHECK(reader.valid());
+
+    miss2::BinaryIRRecord record;
+    size_t count = 0;
+
+    while(reader.next(record)) {
+        FUZZ_CHECK(count < commands.size());
+        FUZZ_CHECK(record.offset == commands[count].offset);
+        FUZZ_CHECK(record.opcode == commands[count].opcode);
+        FUZZ_CHECK(record.paramCount == commands[count].parameters.size());
+
+        ++count;
+    }
+
+    FUZZ_CHECK(count == commands.size());
+}
+
+extern "C" int LLVMFuzzerInitialize(int *, char ***) {
+    const char *path = std::getenv("GTASM_FUZZ_OPCODES");
+    if(not path) path = GTASM_FUZZ_OPCODES_PATH;
+
+    if(not std::ifstream(path)) {
+        std::cerr << "error: could not read " << path << " (set GTASM_FUZZ_OPCODES)\n";
+        std::exit(1);
+    }
+
+    parseOpcodeFile(path);
+    opcodeTable = new miss2::OpcodeTable(miss2::OpcodeTable::fromContext());
+
+    return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    // An exact-size copy, so a sanitizer sees any read past the end.
+    std::vector<uint8_t> bytes(data, data + size);
+
+    auto commands = checkForEachCommand(bytes.data(), bytes.size());
+
+    checkChunks(bytes.data(), bytes.size(), commands);
+    checkFlatDecoder(bytes.data(), bytes.size());
+    checkResync(bytes.data(), bytes.size());
+    checkBinaryIR(bytes.data(), bytes.size());
+    checkIRRoundTrip(commands, bytes.size());
+
+    return 0;
+}
+
+#ifdef GTASM_FUZZ_STANDALONE
+
+// Runs the target once on each file named on the command line.
+int main(int argc, char **argv) {
+    LLVMFuzzerInitialize(&argc, &argv);
+
+    for(int i = 1; i < argc; ++i) {
+        std::vector<char> bytes = readFileBytes(argv[i]);
+        LLVMFuzzerTestOneInput((const uint8_t *)bytes.data(), bytes.size());
+
+        std::cerr << argv[i] << ": ok\n";
+    }
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,193 @@
+//
+// Round-trip check: decompiles every script in a directory, assembles the decoded commands again and
+//  compares the result with the original file byte for byte. Each phase is timed, so this also serves as
+//  the standing end-to-end benchmark.
+//
+// Usage: gtasm_roundtrip [--opcodes=<Opcodes.ini>] [directory (default "GTA Scripts")]
+//
+
+#include <iostream>
+#include <map>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <functional>
+#include <cstring>
+#include <iomanip>
+#include <filesystem>
+#include <algorithm>
+#include <chrono>
+#include "../util.hpp"
+#include "../opcode_file.hpp"
+#include "../miss2/decompiler.hpp"
+#include "../miss2/assembler.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static double millisecondsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+struct PhaseTimes {
+    double load = 0, decode = 0, encode = 0, compare = 0;
+
+    void add(const PhaseTimes &other) {
+        load += other.load;
+        decode += other.decode;
+        encode += other.encode;
+        compare += other.compare;
+    }
+};
+
+struct FileResult {
+    std::string name;
+    size_t size = 0;
+    size_t commands = 0;
+    size_t unknownCommands = 0;
+    std::vector<size_t> mismatches;
+    PhaseTimes times;
+};
+
+// The command that covers 'offset', for reporting.
+static const miss2::Command *commandCovering(const std::vector<miss2::Command> &commands, size_t offset) {
+    auto after = std::upper_bound(commands.begin(), commands.end(), offset, [](size_t o, const miss2::Command &cmd) {
+        return int64_t(o) < cmd.offset;
+    });
+
+    return after == commands.begin() ? nullptr : &*(after - 1);
+}
+
+static FileResult checkFile(const std::filesystem::path &path) {
+    FileResult result;
+    result.name = path.filename().string();
+
+    auto start = Clock::now();
+    MappedFile file(path.c_str());
+    result.times.load = millisecondsSince(start);
+
+    if(not file) {
+        result.mismatches.push_back(0);
+        return result;
+    }
+
+    result.size = file.size;
+
+    std::ostream nullStream(nullptr);
+
+    start = Clock::now();
+    miss2::Script script = miss2::Decompiler::decompile(file.data, file.size, nullStream);
+    result.times.decode = millisecondsSince(start);
+
+    result.commands = script.commands.size();
+    for(auto &command : script.commands) {
+        if(not command) ++result.unknownCommands;
+    }
+
+    start = Clock::now();
+    size_t unresolvedLabels;
+    std::vector<miss2::Command> commands = script.commands;
+    auto bytecode = miss2::Assembler::assemble(commands, true, file.size, unresolvedLabels);
+    result.times.encode = millisecondsSince(start);
+
+    start = Clock::now();
+    size_t common = std::min(bytecode.size(), file.size);
+
+    if(bytecode.size() != file.size or std::memcmp(bytecode.data(), file.data, common) != 0) {
+        for(size_t i = 0; i < common; ++i) {
+            if(bytecode[i] != file.data[i]) result.mismatches.push_back(i);
+        }
+
+        if(bytecode.size() != file.size) result.mismatches.push_back(common);
+    }
+
+    result.times.compare = millisecondsSince(start);
+
+    for(size_t i = 0; i < result.mismatches.size() and i < 5; ++i) {
+        size_t offset = result.mismatches[i];
+        const miss2::Command *command = commandCovering(script.commands, offset);
+
+        std::cout << "  " << result.name << ": mismatch at offset " << offset;
+        if(command) {
+            std::cout << " (in command 0x" << to_string_hex(command->opcode) << " at " << command->offset << ")";
+        }
+
+        std::cout << '\n';
+    }
+
+    return result;
+}
+
+int main(int argc, char **argv) {
+    std::string opcodePath = "Opcodes.ini";
+    std::string directory = "GTA Scripts";
+
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+
+        if(arg.starts_with("--opcodes=")) {
+            opcodePath = arg.substr(std::strlen("--opcodes="));
+        } else {
+            directory = arg;
+        }
+    }
+
+    auto start = Clock::now();
+    parseOpcodeFile(opcodePath);
+    double opcodeLoadTime = millisecondsSince(start);
+
+    std::vector<std::filesystem::path> paths;
+    for(auto &entry : std::filesystem::directory_iterator(directory)) {
+        if(entry.is_regular_file() and stringLower(entry.path().extension().string()) == ".scm") {
+            paths.push_back(entry.path());
+        }
+    }
+
+    std::sort(paths.begin(), paths.end());
+
+    if(paths.empty()) {
+        std::cerr << "error: no .scm files found in " << directory << '\n';
+        return 1;
+    }
+
+    std::vector<FileResult> results;
+    for(auto &path : paths) {
+        results.push_back(checkFile(path));
+    }
+
+    std::cout << std::left << std::setw(24) << "file" << std::right
+              << std::setw(10) << "bytes" << std::setw(10) << "commands" << std::setw(9) << "unknown"
+              << std::setw(12) << "mismatches" << std::setw(11) << "decode ms" << std::setw(11) << "encode ms" << '\n';
+
+    PhaseTimes total;
+    size_t totalBytes = 0, totalCommands = 0, totalUnknown = 0, failedFiles = 0;
+
+    std::cout << std::fixed << std::setprecision(3);
+
+    for(auto &result : results) {
+        std::cout << std::left << std::setw(24) << result.name << std::right
+                  << std::setw(10) << result.size << std::setw(10) << result.commands << std::setw(9) << result.unknownCommands
+                  << std::setw(12) << result.mismatches.size() << std::setw(11) << result.times.decode
+                  << std::setw(11) << result.times.encode << '\n';
+
+        total.add(result.times);
+        totalBytes += result.size;
+        totalCommands += result.commands;
+        totalUnknown += result.unknownCommands;
+        failedFiles += not result.mismatches.empty();
+    }
+
+    auto rate = [&](double ms) {
+        return ms > 0 ? (double(totalBytes) / 1e6) / (ms / 1000.0) : 0.0;
+    };
+
+    std::cout << '\n' << results.size() << " files, " << totalBytes << " bytes, " << totalCommands << " commands ("
+              << totalUnknown << " with unknown opcodes)\n";
+    std::cout << "opcode database: " << opcodeLoadTime << " ms\n";
+    std::cout << "load:    " << total.load << " ms\n";
+    std::cout << "decode:  " << total.decode << " ms (" << rate(total.decode) << " MB/s)\n";
+    std::cout << "encode:  " << total.encode << " ms (" << rate(total.encode) << " MB/s)\n";
+    std::cout << "compare: " << total.compare << " ms\n";
+    std::cout << (failedFiles ? std::to_string(failedFiles) + " files did not round-trip\n" : "all files round-tripped\n");
+
+    return failedFiles ? 1 : 0;
+}
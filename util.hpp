@@ -8,6 +8,7 @@
 #include <algorithm>
 #include <cctype>
 #include <locale>
+#include "simd.hpp"
 
 // trim from start (in place)
 static inline void ltrim(std::string &s) {
@@ -62,6 +63,14 @@ static std::vector<char> readFileBytes(char const* filename) {
     return result;
 }
 
+// Writes the whole buffer with a single write call.
+static bool writeFileBytes(char const *filename, const std::vector<uint8_t> &bytes) {
+    std::ofstream ofs(filename, std::ios::binary | std::ios::trunc);
+    ofs.write((const char *)bytes.data(), std::streamsize(bytes.size()));
+
+    return bool(ofs);
+}
+
 static void replaceAll(std::string &s, string_ref search, string_ref replace) {
     for (size_t pos = 0;; pos += replace.length()) {
         pos = s.find(search, pos);
@@ -93,28 +102,25 @@ static std::string replaceTokens(std::string s, const std::vector<std::string> &
 }
 
 static std::string cleanString(uint8_t *dirtyChars) {
-    std::stringstream stream;
-
-    int c;
-    while(isascii(c = *(dirtyChars++))) {
-        stream << (char)c;
-    }
-
-    return stream.str();
+    return std::string((char *)dirtyChars, simd::asciiPrefixUnbounded(dirtyChars));
 }
 
 #include <chrono>
 #include <ctime>
 
-std::string currentDateString(){
+inline std::string currentDateString(){
     std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
 
+    // localtime() shares one result between threads, and scripts are rendered on several at once.
+    std::tm local {};
+    localtime_r(&now, &local);
+
     std::string s(40, '\0');
-    std::strftime(&s[0], s.size(), "%A %d %B %Y at %r", std::localtime(&now));
+    std::strftime(&s[0], s.size(), "%A %d %B %Y at %r", &local);
     return s;
 }
 
-std::string lastPathComponent(string_ref fullPath) {
+inline std::string lastPathComponent(string_ref fullPath) {
     auto pos = fullPath.find_last_of("/\\");
     if(pos == std::string::npos) pos = 0;
 
@@ -137,6 +143,89 @@ std::string stringLower(S s) {
     return s;
 }
 
+#include <filesystem>
+#include <vector>
+
+// Expands directories to the files inside them with 'extension' (such as ".scm", in any case), sorted and not
+//  recursively. Other paths are kept as they are.
+inline std::vector<std::string> collectFiles(const std::vector<std::string> &paths, const std::string &extension) {
+    std::vector<std::string> files;
+    std::string wanted = stringLower(extension);
+
+    for(const std::string &path : paths) {
+        std::error_code error;
+
+        if(not std::filesystem::is_directory(path, error)) {
+            files.push_back(path);
+            continue;
+        }
+
+        std::vector<std::string> inDirectory;
+        for(auto &entry : std::filesystem::directory_iterator(path, error)) {
+            if(entry.is_regular_file() and stringLower(entry.path().extension().string()) == wanted) {
+                inDirectory.push_back(entry.path().string());
+            }
+        }
+
+        std::sort(inDirectory.begin(), inDirectory.end());
+        files.insert(files.end(), inDirectory.begin(), inDirectory.end());
+    }
+
+    return files;
+}
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// A read-only memory mapping of a whole file.
+struct MappedFile {
+    uint8_t *data = nullptr;
+    size_t size = 0;
+
+    MappedFile() = default;
+
+    explicit MappedFile(char const *filename) {
+        int fd = open(filename, O_RDONLY);
+        if(fd < 0) return;
+
+        struct stat info {};
+        if(fstat(fd, &info) == 0 and info.st_size > 0) {
+            void *mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+            if(mapping != MAP_FAILED) {
+                data = (uint8_t *)mapping;
+                size = info.st_size;
+            }
+        }
+
+        close(fd);
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    MappedFile(MappedFile &&other) noexcept : data { other.data }, size { other.size } {
+        other.data = nullptr;
+        other.size = 0;
+    }
+
+    MappedFile &operator=(MappedFile &&other) noexcept {
+        std::swap(data, other.data);
+        std::swap(size, other.size);
+        return *this;
+    }
+
+    operator bool() const {
+        return data != nullptr;
+    }
+
+    ~MappedFile() {
+        if(data) munmap(data, size);
+    }
+};
+
 template <typename T>
 inline std::string to_string_hex(T v) {
     std::stringstream s;
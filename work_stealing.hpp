@@ -0,0 +1,384 @@
+//
+// A pool of worker threads with a deque of jobs each. A worker runs the newest job in its own deque first.
+//  When its deque is empty, it takes the oldest job from another worker's deque. Jobs that a job submits go
+//  to the submitting worker's deque, so a big file can be split into smaller tasks, and idle workers steal
+//  those tasks instead of waiting behind the file.
+//
+// Jobs whose cost is known up front (file sizes, for example) can be seeded largest first, so the biggest
+//  jobs start straight away and the small ones fill in the gaps at the end. A job can wait for a group of
+//  jobs it submitted; while it waits, its worker runs other jobs, so nesting never ties up a thread.
+//
+// The pool keeps counts of jobs run and stolen, and how long each worker was busy, so the way work spreads
+//  over the workers can be checked.
+//
+
+#ifndef GTASM_WORK_STEALING_HPP
+#define GTASM_WORK_STEALING_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "thread_pool.hpp"
+
+class WorkStealingPool {
+public:
+    // A set of jobs that can be waited for on its own.
+    struct TaskGroup {
+        std::atomic<size_t> pending = 0;
+    };
+
+    struct WorkerStats {
+        size_t jobs = 0;
+
+        // Jobs taken from another worker's deque.
+        size_t stolen = 0;
+
+        // Time spent running jobs.
+        double busyMilliseconds = 0;
+    };
+
+    struct Utilisation {
+        // Time since the pool was created or the counts were last reset.
+        double wallMilliseconds = 0;
+
+        std::vector<WorkerStats> workers;
+
+        size_t jobs() const {
+            size_t total = 0;
+            for(auto &worker : workers) total += worker.jobs;
+
+            return total;
+        }
+
+        size_t stolen() const {
+            size_t total = 0;
+            for(auto &worker : workers) total += worker.stolen;
+
+            return total;
+        }
+
+        // Share of the workers' time spent running jobs, from 0 to 1.
+        double busyFraction() const {
+            if(workers.empty() or wallMilliseconds <= 0) return 0;
+
+            double busy = 0;
+            for(auto &worker : workers) busy += worker.busyMilliseconds;
+
+            return std::min(1.0, busy / (wallMilliseconds * double(workers.size())));
+        }
+    };
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Job {
+        std::function<void()> run;
+        TaskGroup *group = nullptr;
+    };
+
+    struct Worker {
+        std::mutex lock;
+        std::deque<Job> jobs;
+
+        std::atomic<size_t> jobsRun = 0;
+        std::atomic<size_t> jobsStolen = 0;
+        std::atomic<int64_t> busyNanoseconds = 0;
+
+        // For picking which worker to steal from.
+        uint32_t randomState = 0;
+
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    // Jobs that are in a deque, and jobs that haven't finished (queued or running).
+    std::atomic<size_t> queuedJobs = 0;
+    std::atomic<size_t> unfinishedJobs = 0;
+
+    // Where the next job submitted from outside the pool goes.
+    std::atomic<size_t> nextWorker = 0;
+
+    std::mutex sleepLock;
+    std::condition_variable jobAvailable;
+    std::condition_variable jobFinished;
+    bool stopping = false;
+
+    Clock::time_point countsStart = Clock::now();
+
+    // The worker the calling thread is, if it is one of this pool's.
+    static inline thread_local WorkStealingPool *currentPool = nullptr;
+    static inline thread_local size_t currentWorker = 0;
+
+    // How many group waits the calling worker is inside.
+    static inline thread_local size_t depth = 0;
+
+    // Adds jobs to the end of a worker's deque, in order.
+    void push(size_t workerIndex, std::vector<Job> jobs, TaskGroup *group) {
+        if(jobs.empty()) return;
+
+        size_t count = jobs.size();
+
+        if(group) group->pending += count;
+        unfinishedJobs += count;
+
+        {
+            std::lock_guard<std::mutex> guard(workers[workerIndex]->lock);
+
+            // Counted before they can be taken, so a worker that takes one never brings the count below zero.
+            queuedJobs += count;
+
+            for(Job &job : jobs) {
+                workers[workerIndex]->jobs.push_back(std::move(job));
+            }
+        }
+
+        // Taking the lock means a worker that is about to sleep either sees the jobs or gets the signal.
+        { std::lock_guard<std::mutex> guard(sleepLock); }
+
+        if(count == 1) {
+            jobAvailable.notify_one();
+        } else {
+            jobAvailable.notify_all();
+        }
+    }
+
+    bool popOwn(Worker &worker, Job &job) {
+        std::lock_guard<std::mutex> guard(worker.lock);
+        if(worker.jobs.empty()) return false;
+
+        job = std::move(worker.jobs.back());
+        worker.jobs.pop_back();
+
+        return true;
+    }
+
+    bool steal(size_t thief, Job &job) {
+        Worker &self = *workers[thief];
+
+        // xorshift32, so each worker starts looking at a different victim.
+        self.randomState ^= self.randomState << 13;
+        self.randomState ^= self.randomState >> 17;
+        self.randomState ^= self.randomState << 5;
+
+        size_t first = self.randomState % workers.size();
+
+        for(size_t i = 0; i < workers.size(); ++i) {
+            size_t victim = (first + i) % workers.size();
+            if(victim == thief) continue;
+
+            Worker &other = *workers[victim];
+            std::lock_guard<std::mutex> guard(other.lock);
+
+            if(other.jobs.empty()) continue;
+
+            job = std::move(other.jobs.front());
+            other.jobs.pop_front();
+
+            return true;
+        }
+
+        return false;
+    }
+
+    // Runs one job from the worker's own deque or stolen from another. Returns false if there were none.
+    bool runOne(size_t workerIndex) {
+        Job job;
+        bool stolen = false;
+
+        if(not popOwn(*workers[workerIndex], job)) {
+            if(not steal(workerIndex, job)) return false;
+            stolen = true;
+        }
+
+        --queuedJobs;
+
+        Worker &worker = *workers[workerIndex];
+
+        auto start = Clock::now();
+        job.run();
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+
+        // A job that waits for a group runs other jobs meanwhile. Only the outermost job on a worker adds to
+        //  its busy time, which therefore includes any time spent waiting for the rest of a group.
+        ++worker.jobsRun;
+        if(stolen) ++worker.jobsStolen;
+        if(depth == 0) worker.busyNanoseconds += elapsed;
+
+        bool groupDone = job.group and --job.group->pending == 0;
+        bool allDone = --unfinishedJobs == 0;
+
+        if(groupDone or allDone) {
+            std::lock_guard<std::mutex> guard(sleepLock);
+            jobFinished.notify_all();
+        }
+
+        return true;
+    }
+
+    void workerLoop(size_t workerIndex) {
+        currentPool = this;
+        currentWorker = workerIndex;
+
+        while(true) {
+            if(runOne(workerIndex)) continue;
+
+            std::unique_lock<std::mutex> guard(sleepLock);
+            jobAvailable.wait(guard, [this] { return stopping or queuedJobs > 0; });
+
+            if(stopping and queuedJobs == 0) return;
+        }
+    }
+
+public:
+    explicit WorkStealingPool(size_t threadCount = ThreadPool::defaultThreadCount()) {
+        threadCount = std::max(threadCount, size_t(1));
+
+        for(size_t i = 0; i < threadCount; ++i) {
+            workers.push_back(std::make_unique<Worker>());
+            workers.back()->randomState = uint32_t(i) * 0x9e3779b9u + 1;
+        }
+
+        for(size_t i = 0; i < threadCount; ++i) {
+            workers[i]->thread = std::thread([this, i] { workerLoop(i); });
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    size_t size() const {
+        return workers.size();
+    }
+
+    // Queues a job. From inside a job, it goes on the current worker's deque, and otherwise the jobs are
+    //  spread over the workers in turn.
+    void submit(std::function<void()> job, TaskGroup *group = nullptr) {
+        size_t workerIndex = currentPool == this ? currentWorker : nextWorker++ % workers.size();
+
+        std::vector<Job> jobs;
+        jobs.push_back({ std::move(job), group });
+        push(workerIndex, std::move(jobs), group);
+    }
+
+    // Queues jobs with a known cost (any unit, such as bytes) so that the most costly ones run first.
+    void submitLargestFirst(std::vector<std::pair<uint64_t, std::function<void()>>> jobs, TaskGroup *group = nullptr) {
+        std::stable_sort(jobs.begin(), jobs.end(), [](auto &a, auto &b) {
+            return a.first > b.first;
+        });
+
+        // Deal the jobs out like cards, so every worker gets one of the biggest. Workers run their newest job
+        //  first, so each worker's share is queued smallest first. Thieves take the oldest job, which is then
+        //  the smallest, to even out the end of the run.
+        std::vector<std::vector<Job>> shares(std::min(workers.size(), jobs.size()));
+
+        for(size_t j = 0; j < jobs.size(); ++j) {
+            shares[j % shares.size()].push_back({ std::move(jobs[j].second), group });
+        }
+
+        size_t first = currentPool == this ? currentWorker : 0;
+
+        for(size_t w = 0; w < shares.size(); ++w) {
+            std::reverse(shares[w].begin(), shares[w].end());
+            push((first + w) % workers.size(), std::move(shares[w]), group);
+        }
+    }
+
+    // Blocks until every job in 'group' has finished. Called from a job, the worker runs other jobs until
+    //  then instead of blocking.
+    void wait(TaskGroup &group) {
+        if(currentPool == this) {
+            ++depth;
+
+            while(group.pending > 0) {
+                if(runOne(currentWorker)) continue;
+
+                // The rest of the group is running on other workers.
+                std::unique_lock<std::mutex> guard(sleepLock);
+                jobFinished.wait_for(guard, std::chrono::microseconds(100), [&] {
+                    return group.pending == 0 or queuedJobs > 0;
+                });
+            }
+
+            --depth;
+            return;
+        }
+
+        std::unique_lock<std::mutex> guard(sleepLock);
+        jobFinished.wait(guard, [&] { return group.pending == 0; });
+    }
+
+    // Blocks until every job has finished. Must not be called from a job (wait for a TaskGroup instead).
+    void wait() {
+        std::unique_lock<std::mutex> guard(sleepLock);
+        jobFinished.wait(guard, [this] { return unfinishedJobs == 0; });
+    }
+
+    Utilisation utilisation() const {
+        Utilisation result;
+        result.wallMilliseconds = std::chrono::duration<double, std::milli>(Clock::now() - countsStart).count();
+
+        for(auto &worker : workers) {
+            result.workers.push_back({ worker->jobsRun, worker->jobsStolen, double(worker->busyNanoseconds) / 1e6 });
+        }
+
+        return result;
+    }
+
+    // Starts counting again from zero. Only call this while no jobs are running.
+    void resetUtilisation() {
+        for(auto &worker : workers) {
+            worker->jobsRun = 0;
+            worker->jobsStolen = 0;
+            worker->busyNanoseconds = 0;
+        }
+
+        countsStart = Clock::now();
+    }
+
+    // Finishes the queued jobs before joining the workers.
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> guard(sleepLock);
+            stopping = true;
+        }
+
+        jobAvailable.notify_all();
+
+        for(auto &worker : workers) {
+            worker->thread.join();
+        }
+    }
+};
+
+// Runs 'job(i)' for each file in 'paths' on 'pool', biggest file first, and returns when they have all run.
+//  Files that can't be found count as empty.
+inline void forEachFileLargestFirst(WorkStealingPool &pool, const std::vector<std::string> &paths,
+                                    const std::function<void(size_t)> &job) {
+    std::vector<std::pair<uint64_t, std::function<void()>>> jobs;
+    jobs.reserve(paths.size());
+
+    for(size_t i = 0; i < paths.size(); ++i) {
+        std::error_code error;
+        uint64_t size = std::filesystem::file_size(paths[i], error);
+
+        jobs.emplace_back(error ? 0 : size, [&job, i] { job(i); });
+    }
+
+    WorkStealingPool::TaskGroup group;
+    pool.submitLargestFirst(std::move(jobs), &group);
+    pool.wait(group);
+}
+
+#endif //GTASM_WORK_STEALING_HPP